@@ -0,0 +1,231 @@
+// Batch reflow: applies the editor's merge/split rules to many SRT files without a GUI
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QDirIterator>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSet>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <stdio.h>
+#include <dialogseq.h>
+#include <reflow.h>
+#include <srtreader.h>
+#include <srtwriter.h>
+#include <textmeasurer.h>
+#include <batch/workpool.h>
+
+namespace
+{
+  struct Totals
+  {
+    std::atomic<i64> cues, bytes, merges, splits;
+    std::atomic<i32> files, failed;
+  };
+
+  std::mutex gPrintLock;
+
+  void Print(FILE *to, const QString &msg)
+  {
+    std::lock_guard<std::mutex> l(gPrintLock);
+    fputs(qPrintable(msg), to);
+    fputc('\n', to);
+  }
+
+  struct Input
+  {
+    QString path;
+    QString relative; ///< To the directory it was found in, just the name for files given directly
+  };
+
+  // Files to process, each directory given is searched recursively for *.srt. Results written
+  // beside their inputs by an earlier run are left out.
+  std::vector<Input> CollectInputs(const QStringList &args, bool skipResults)
+  {
+    std::vector<Input> ret;
+    for(auto &i : args)
+    {
+      if(!QFileInfo(i).isDir())
+      {
+        ret.push_back(Input { .path = i, .relative = QFileInfo(i).fileName() });
+        continue;
+      }
+      QDir dir(i);
+      QDirIterator it(i, QStringList() << "*.srt", QDir::Files, QDirIterator::Subdirectories);
+      while(it.hasNext())
+      {
+        auto path = it.next();
+        if(skipResults && path.endsWith(".reflow.srt", Qt::CaseInsensitive))
+          continue;
+        ret.push_back(Input { .path = path, .relative = dir.relativeFilePath(path) });
+      }
+    }
+    return ret;
+  }
+
+  QString OutputFor(const Input &input, const QString &outDir)
+  {
+    if(outDir.isEmpty())
+    {
+      QFileInfo fi(input.path);
+      return fi.dir().filePath(fi.completeBaseName() + ".reflow.srt");
+    }
+    return QDir::cleanPath(QDir(outDir).filePath(input.relative));
+  }
+
+  void ProcessFile(const QString &input, const QString &output, const ReflowLimits &limits,
+                   bool verbose, Totals &totals)
+  {
+    QFile f(input);
+    if(!f.open(QFile::ReadOnly))
+    {
+      Print(stderr, QString("%1: %2").arg(input, f.errorString()));
+      totals.failed++;
+      return;
+    }
+    auto size = f.size();
+    FixedPitchMeasurer measurer;
+    WordSplitter splitter(measurer);
+    DialogSeq model;
+    auto cues = ReadSrt(&f, splitter, model);
+    f.close();
+
+    auto stats = Reflow(model, limits);
+
+    SrtWriter w(model.size());
+    for(const auto &i : model)
+      w.Append(i);
+    auto err = SaveSrt(output, w.Data());
+    if(!err.isEmpty())
+    {
+      Print(stderr, QString("%1: %2").arg(output, err));
+      totals.failed++;
+      return;
+    }
+
+    totals.files++;
+    totals.cues += cues;
+    totals.bytes += size;
+    totals.merges += stats.merges;
+    totals.splits += stats.splits;
+    if(verbose)
+      Print(stdout, QString("%1: %2 cues, %3 merged, %4 split")
+                    .arg(input).arg(cues).arg(stats.merges).arg(stats.splits));
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("lrbatch");
+
+  auto defaults = ReflowLimits::Default();
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Reflow SRT files with the merge/split rules of the editor.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("inputs", "SRT files, or directories to search for them.", "<file|dir>...");
+  QCommandLineOption outDirOpt({ "o", "output" },
+    "Write results into <dir>, under the same paths as below the directory they were found in, "
+    "instead of <name>.reflow.srt beside the input.", "dir");
+  QCommandLineOption maxCharsOpt("max-chars", "Longest line in characters.", "n",
+                                 QString::number(defaults.maxChars));
+  QCommandLineOption minDurOpt("min-duration", "Shortest line in milliseconds.", "ms",
+                               QString::number(defaults.minDurationMs));
+  QCommandLineOption maxDurOpt("max-duration", "Longest line in milliseconds.", "ms",
+                               QString::number(defaults.maxDurationMs));
+  QCommandLineOption cpsOpt("max-cps", "Fastest reading speed in characters per second.", "cps",
+                            QString::number(defaults.maxCps));
+  QCommandLineOption gapOpt("max-gap", "Never merge lines further apart than this, in milliseconds.", "ms",
+                            QString::number(defaults.maxMergeGapMs));
+  QCommandLineOption jobsOpt({ "j", "jobs" }, "Worker threads, 0 for one per core.", "n", "0");
+  QCommandLineOption verboseOpt({ "v", "verbose" }, "Report every file.");
+  parser.addOptions({ outDirOpt, maxCharsOpt, minDurOpt, maxDurOpt, cpsOpt, gapOpt, jobsOpt, verboseOpt });
+  parser.process(app);
+
+  ReflowLimits limits;
+  bool ok[6];
+  limits.maxChars = parser.value(maxCharsOpt).toInt(&ok[0]);
+  limits.minDurationMs = parser.value(minDurOpt).toULongLong(&ok[1]);
+  limits.maxDurationMs = parser.value(maxDurOpt).toULongLong(&ok[2]);
+  limits.maxCps = parser.value(cpsOpt).toDouble(&ok[3]);
+  limits.maxMergeGapMs = parser.value(gapOpt).toULongLong(&ok[4]);
+  auto jobs = parser.value(jobsOpt).toInt(&ok[5]);
+  if(std::find(ok, ok + 6, false) != ok + 6 || limits.maxChars <= 0 || limits.maxCps <= 0 ||
+     limits.minDurationMs > limits.maxDurationMs)
+  {
+    fputs("Invalid limits.\n", stderr);
+    return 2;
+  }
+
+  auto outDir = parser.value(outDirOpt);
+  auto inputs = CollectInputs(parser.positionalArguments(), outDir.isEmpty());
+  if(inputs.empty())
+    parser.showHelp(2);
+
+  // Two inputs must never be written to the same file, nor an input over itself
+  QHash<QString, QString> outputs;
+  QSet<QString> outputDirs;
+  for(auto &i : inputs)
+  {
+    auto output = OutputFor(i, outDir);
+    auto key = QFileInfo(output).absoluteFilePath();
+    if(key == QFileInfo(i.path).absoluteFilePath())
+    {
+      Print(stderr, QString("%1 would be written over itself").arg(i.path));
+      return 2;
+    }
+    if(outputs.contains(key))
+    {
+      Print(stderr, QString("%1 and %2 would both be written to %3").arg(outputs[key], i.path, output));
+      return 2;
+    }
+    outputs.insert(key, i.path);
+    outputDirs.insert(QFileInfo(output).path());
+  }
+  for(auto &i : outputDirs)
+  {
+    if(!QDir().mkpath(i))
+    {
+      Print(stderr, QString("Cannot create %1").arg(i));
+      return 1;
+    }
+  }
+
+  // Largest first, the pool balances the small ones that are left at the end
+  std::vector<std::pair<i64, Input>> bySize;
+  for(auto &i : inputs)
+    bySize.push_back({ QFileInfo(i.path).size(), i });
+  std::stable_sort(bySize.begin(), bySize.end(),
+                   [](const std::pair<i64, Input> &a, const std::pair<i64, Input> &b)
+  {
+    return a.first > b.first;
+  });
+
+  Totals totals {};
+  auto verbose = parser.isSet(verboseOpt);
+  std::vector<WorkPool::Task> tasks;
+  for(auto &i : bySize)
+  {
+    auto input = i.second.path;
+    auto output = OutputFor(i.second, outDir);
+    tasks.push_back([input, output, limits, verbose, &totals]()
+    {
+      ProcessFile(input, output, limits, verbose, totals);
+    });
+  }
+
+  QElapsedTimer timer;
+  timer.start();
+  WorkPool::Run(std::move(tasks), jobs);
+  auto secs = std::max(timer.nsecsElapsed() / 1e9, 1e-9);
+
+  printf("%d files (%d failed), %lld cues, %lld merged, %lld split\n",
+         totals.files.load(), totals.failed.load(), (long long)totals.cues.load(),
+         (long long)totals.merges.load(), (long long)totals.splits.load());
+  printf("%.3f s, %.0f cues/s, %.2f MB/s\n", secs, totals.cues / secs, totals.bytes / secs / (1 << 20));
+  return totals.failed ? 1 : 0;
+}
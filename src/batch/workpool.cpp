@@ -0,0 +1,68 @@
+#include <batch/workpool.h>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+  struct Queue
+  {
+    std::mutex lock;
+    std::deque<WorkPool::Task> tasks;
+  };
+
+  bool Take(Queue &q, bool own, WorkPool::Task &out)
+  {
+    std::lock_guard<std::mutex> l(q.lock);
+    if(q.tasks.empty())
+      return false;
+    if(own)
+    {
+      out = std::move(q.tasks.front());
+      q.tasks.pop_front();
+    }
+    else
+    {
+      out = std::move(q.tasks.back());
+      q.tasks.pop_back();
+    }
+    return true;
+  }
+}
+
+void WorkPool::Run(std::vector<Task> tasks, i32 threads)
+{
+  if(threads <= 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::max(1, std::min(threads, (i32)tasks.size()));
+
+  std::vector<std::unique_ptr<Queue>> queues;
+  for(i32 i = 0; i < threads; i++)
+    queues.emplace_back(new Queue);
+  for(size_t i = 0; i < tasks.size(); i++)
+    queues[i % threads]->tasks.push_back(std::move(tasks[i]));
+
+  // Nothing is added once started, so a thread that finds every deque empty is done
+  auto worker = [&queues, threads](i32 self)
+  {
+    Task t;
+    for(;;)
+    {
+      bool found = Take(*queues[self], true, t);
+      for(i32 i = 1; !found && i < threads; i++)
+        found = Take(*queues[(self + i) % threads], false, t);
+      if(!found)
+        return;
+      t();
+    }
+  };
+
+  std::vector<std::thread> pool;
+  for(i32 i = 1; i < threads; i++)
+    pool.emplace_back(worker, i);
+  worker(0);
+  for(auto &i : pool)
+    i.join();
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+#include <rint.h>
+
+/// Runs a fixed batch of independent tasks on a set of threads.
+///
+/// Every thread has its own deque, filled round robin in the order given. A thread takes its
+/// own tasks from the front and, once out of them, steals from the back of the others, so a
+/// few huge files in one deque do not leave the remaining threads idle. Hand the tasks over
+/// largest first and the stolen ones are the small leftovers.
+class WorkPool
+{
+  public:
+    typedef std::function<void()> Task;
+
+    /// Blocks until every task has run. threads <= 0 uses one per core.
+    static void Run(std::vector<Task> tasks, i32 threads = 0);
+};
@@ -0,0 +1,70 @@
+#include <bench/harness.h>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QSysInfo>
+#include <QThread>
+#include <algorithm>
+#include <stdio.h>
+#include <vector>
+
+Harness::Harness(const QString &filter, f64 minSeconds) :
+  mFilter(filter), mMinSeconds(minSeconds)
+{ }
+
+void Harness::Run(const QString &name, f64 items, f64 bytes, const std::function<void()> &body)
+{
+  if(!name.contains(mFilter))
+    return;
+  QElapsedTimer timer;
+  timer.start();
+  body();
+  auto once = std::max<i64>(timer.nsecsElapsed(), 1);
+
+  i64 batch = std::max<i64>(1, mMinSeconds * 1e8 / once), runs = 0;
+  std::vector<f64> perRun;
+  i64 spent = 0;
+  while(spent < mMinSeconds * 1e9 || perRun.size() < 3)
+  {
+    timer.restart();
+    for(i64 i = 0; i < batch; i++)
+      body();
+    auto ns = timer.nsecsElapsed();
+    spent += ns;
+    runs += batch;
+    perRun.push_back((f64)ns / batch);
+  }
+  std::sort(perRun.begin(), perRun.end());
+  auto best = perRun.front(), median = perRun[perRun.size() / 2];
+
+  QJsonObject r;
+  r["name"] = name;
+  r["runs"] = (qint64)runs;
+  r["ns_per_run"] = best;
+  r["ns_per_run_median"] = median;
+  if(items > 0)
+    r["items_per_second"] = items * 1e9 / best;
+  if(bytes > 0)
+    r["bytes_per_second"] = bytes * 1e9 / best;
+  mResults.append(r);
+
+  fprintf(stderr, "%-40s %14.0f ns %14.0f ns median", qPrintable(name), best, median);
+  if(items > 0)
+    fprintf(stderr, " %14.0f items/s", items * 1e9 / best);
+  if(bytes > 0)
+    fprintf(stderr, " %10.2f MB/s", bytes * 1e9 / best / (1 << 20));
+  fputc('\n', stderr);
+}
+
+QJsonDocument Harness::Report() const
+{
+  QJsonObject root;
+  root["version"] = QCoreApplication::applicationVersion();
+  root["qt"] = qVersion();
+  root["cpu"] = QSysInfo::currentCpuArchitecture();
+  root["os"] = QSysInfo::prettyProductName();
+  root["threads"] = QThread::idealThreadCount();
+  root["min_seconds"] = mMinSeconds;
+  root["results"] = mResults;
+  return QJsonDocument(root);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QString>
+#include <functional>
+#include <rint.h>
+
+/// Times benchmark bodies and collects the results as JSON.
+///
+/// A body is first run once to warm up, then in batches sized to take about a tenth of the
+/// minimum time each, until the minimum time is spent. Batches give the best and the median
+/// time per run, the best being the steadiest number to compare versions by.
+class Harness
+{
+  public:
+    Harness(const QString &filter, f64 minSeconds);
+
+    /// items and bytes are what one run of body processes, for the rates, 0 if meaningless
+    void Run(const QString &name, f64 items, f64 bytes, const std::function<void()> &body);
+
+    QJsonDocument Report() const;
+
+  private:
+    QString mFilter;
+    f64 mMinSeconds;
+    QJsonArray mResults;
+};
@@ -0,0 +1,338 @@
+// Benchmarks for the hot paths of the editor, results go out as JSON to compare versions by
+#include <QApplication>
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QEventLoop>
+#include <QFile>
+#include <QImage>
+#include <QPushButton>
+#include <QScrollBar>
+#include <QTemporaryDir>
+#include <QUndoStack>
+#include <algorithm>
+#include <stdio.h>
+#include <commands.h>
+#include <fontmeasurer.h>
+#include <reorganizer.h>
+#include <replace.h>
+#include <srtreader.h>
+#include <timestretch.h>
+#include <wavdecoder.h>
+#include <wordsplit.h>
+#include <bench/harness.h>
+#include <gen/synth.h>
+
+namespace
+{
+  // Mostly Latin with some CJK and RTL, gaps and overlaps, like our files
+  QByteArray SyntheticSrt(i32 cues)
+  {
+    auto spec = Synth::SrtSpec::Default();
+    spec.cues = cues;
+    return Synth::FormatSrt(Synth::GenerateCues(spec));
+  }
+
+  QByteArray SyntheticWav(Synth::SampleFormat format, i32 sampleRate, i32 seconds)
+  {
+    QByteArray ret;
+    QBuffer buf(&ret);
+    buf.open(QBuffer::WriteOnly);
+    Synth::WriteWav(&buf, Synth::WavSpec { (u64)sampleRate * seconds, sampleRate, 1, format, false, 1 }, { });
+    return ret;
+  }
+
+  // Cue texts all in one script
+  QStringList Lines(Synth::Script script, i32 count, i32 words)
+  {
+    auto spec = Synth::SrtSpec::Default();
+    spec.cues = count;
+    spec.minWords = spec.maxWords = words;
+    spec.latin = script == Synth::Latin;
+    spec.cjk = script == Synth::Cjk;
+    spec.rtl = script == Synth::Rtl;
+    QStringList ret;
+    for(auto &i : Synth::GenerateCues(spec))
+      ret.append(i.text);
+    return ret;
+  }
+
+  // Lines of words long, the commands all work on the one in the middle
+  DialogSeq LongLines(i32 lines, i32 words)
+  {
+    DialogSeq ret;
+    FixedPitchMeasurer measurer;
+    auto texts = Lines(Synth::Latin, lines, words);
+    for(i32 i = 0; i < lines; i++)
+      AppendDialog(ret, i * 10000ull, i * 10000ull + 9000, texts[i], measurer);
+    return ret;
+  }
+
+  QString Size(i32 cues)
+  {
+    return cues >= 1000 ? QString("%1k").arg(cues / 1000) : QString::number(cues);
+  }
+
+  void BenchFiles(Harness &h, Reorganizer &reorg, const QTemporaryDir &dir)
+  {
+    for(auto cues : { 1000, 10000, 100000 })
+    {
+      auto data = SyntheticSrt(cues);
+      auto name = dir.filePath(QString("bench_%1.srt").arg(cues));
+      QFile f(name);
+      f.open(QFile::WriteOnly);
+      f.write(data);
+      f.close();
+
+      FixedPitchMeasurer fixed;
+      h.Run("srt/parse/" + Size(cues), cues, data.size(), [&data, &fixed]()
+      {
+        QBuffer buf(&data);
+        buf.open(QBuffer::ReadOnly);
+        DialogSeq model;
+        WordSplitter splitter(fixed);
+        ReadSrt(&buf, splitter, model);
+      });
+      h.Run("srt/open_file/" + Size(cues), cues, data.size(), [&reorg, &name]()
+      {
+        reorg.OpenFile(name);
+      });
+
+      // The save runs on a worker, it is done when the editor reports back
+      auto saved = dir.filePath(QString("bench_%1_saved.srt").arg(cues));
+      reorg.OpenFile(name);
+      h.Run("srt/save_file/" + Size(cues), cues, data.size(), [&reorg, &saved]()
+      {
+        QEventLoop loop;
+        QObject::connect(&reorg, &Reorganizer::SendNotify, &loop, &QEventLoop::quit);
+        reorg.SaveFile(saved);
+        loop.exec();
+      });
+    }
+  }
+
+  void BenchPeaks(Harness &h)
+  {
+    static constexpr i32 SampleRate = 48000, Seconds = 60, Columns = 1000;
+    // What the decoder reads as Int8, Int16, Int32 and Float32
+    const QPair<Synth::SampleFormat, QString> types[] = {
+      { Synth::U8, "int8" }, { Synth::S16, "int16" }, { Synth::S32, "int32" }, { Synth::F32, "float32" }
+    };
+    for(auto &type : types)
+    {
+      auto data = SyntheticWav(type.first, SampleRate, Seconds);
+      QBuffer buf(&data);
+      buf.open(QBuffer::ReadOnly);
+      WavDecoder wav(nullptr);
+      wav.cacheAll(&buf);
+      // One strip of the waveform at 1 ms, 10 ms, 100 ms and 1 s per pixel
+      for(auto perColumn : { SampleRate / 1000, SampleRate / 100, SampleRate / 10, SampleRate })
+      {
+        auto span = (i32)std::min<i64>((i64)perColumn * Columns, SampleRate * Seconds);
+        h.Run(QString("peaks/%1/%2_per_px").arg(type.second).arg(perColumn), span, 0,
+              [&wav, perColumn, span]()
+        {
+          f32 sink = 0;
+          for(i32 at = 0; at + perColumn <= span; at += perColumn)
+            sink += wav.GetWaveformPeaksForRange(at, at + perColumn).first;
+          static volatile f32 keep;
+          keep = sink;
+        });
+      }
+    }
+  }
+
+  void BenchStretch(Harness &h)
+  {
+    static constexpr i32 SampleRate = 48000, Seconds = 10, Block = 1024;
+    auto data = SyntheticWav(Synth::S16, SampleRate, Seconds);
+    QBuffer buf(&data);
+    buf.open(QBuffer::ReadOnly);
+    WavDecoder wav(nullptr);
+    wav.cacheAll(&buf);
+    auto audio = wav.Reader();
+    std::vector<f32> input(audio.Frames());
+    audio.Read(0, input.size(), input.data());
+
+    // Everything through at once, the time per input frame is what the callback spends
+    for(auto speed : { 0.5, 1.0, 1.5, 2.0 })
+    {
+      h.Run(QString("stretch/%1x").arg(speed), input.size(), 0, [&input, speed]()
+      {
+        SampleRing ring(1, input.size());
+        ring.Write(input.data(), input.size());
+        ring.Finish();
+        TimeStretch stretch(1, SampleRate);
+        stretch.SetSpeed(speed);
+        f32 out[Block];
+        while(!stretch.Done())
+          stretch.Process(ring, out, Block);
+      });
+    }
+  }
+
+  void BenchSplit(Harness &h, const TextMeasurer &measurer)
+  {
+    auto latin = Lines(Synth::Latin, 1000, 12), cjk = Lines(Synth::Cjk, 1000, 4);
+    const QPair<QString, QStringList*> sets[] = { { "latin", &latin }, { "cjk", &cjk } };
+    for(auto &set : sets)
+    {
+      i64 chars = 0;
+      for(auto &i : *set.second)
+        chars += i.size();
+      auto lines = set.second;
+      h.Run("split/" + set.first, chars, chars * sizeof(QChar), [lines, &measurer]()
+      {
+        for(auto &i : *lines)
+          SplitDialog(i, measurer);
+      });
+      // Every line again, as when a file is reopened
+      WordSplitter splitter(measurer);
+      splitter.SplitAll(*lines);
+      h.Run("split_cached/" + set.first, chars, chars * sizeof(QChar), [lines, &splitter]()
+      {
+        splitter.SplitAll(*lines);
+      });
+    }
+  }
+
+  void BenchCommands(Harness &h)
+  {
+    static constexpr i32 Lines = 1000, Words = 400, Mid = Lines / 2, At = Words / 2;
+    auto model = LongLines(Lines, Words);
+    DiscreteWord word { .text = "replacement", .delim = ' ', ._cachedBlockWidthPx = 80 };
+    QVector<DiscreteWord> insertion(3, word);
+
+    // Every run is a redo and the undo that puts the model back as it was
+    auto bench = [&h](const QString &name, LRCmd::CmdBase *cmd)
+    {
+      h.Run("command/" + name, 0, 0, [cmd]()
+      {
+        cmd->redo();
+        cmd->undo();
+      });
+      delete cmd;
+    };
+    bench("merge_to_prev_line", new LRCmd::MergeToPrevLine(model, Mid, At, Mid - 1));
+    bench("merge_to_next_line", new LRCmd::MergeToNextLine(model, Mid, At, Mid + 1));
+    bench("split_to_next_line", new LRCmd::SplitToNextLine(model, Mid, At));
+    bench("split_to_prev_line", new LRCmd::SplitToPrevLine(model, Mid, At));
+    bench("change_word", new LRCmd::ChangeWord(model, Mid, At, word));
+    bench("insert_words", new LRCmd::InsertWords(model, Mid, At, insertion));
+    bench("remove_word", new LRCmd::RemoveWord(model, Mid, At));
+    bench("retime_range", new LRCmd::RetimeRange(model, Mid, Lines, TimeMap::Shift(100)));
+  }
+
+  void BenchReplace(Harness &h)
+  {
+    static constexpr i32 Count = 100000, Words = 8;
+    FixedPitchMeasurer measurer;
+    DialogSeq model;
+    auto texts = Lines(Synth::Latin, Count, Words);
+    for(i32 i = 0; i < Count; i++)
+      AppendDialog(model, i * 3000ull, i * 3000ull + 2500, texts[i], measurer);
+    // A word that occurs a few thousand times
+    auto spec = ReplaceSpec { .find = model.at(0).words[0].text, .replacement = "replacement",
+                              .regex = false, .caseSensitive = true, .wholeWords = true };
+
+    h.Run("replace/plan/100k", Count, 0, [&model, &spec]()
+    {
+      PlanReplace(model.Snapshot(), spec);
+    });
+    // One macro the way the editor pushes it, then its undo
+    h.Run("replace/apply_undo/100k", Count, 0, [&model, &spec, &measurer]()
+    {
+      QUndoStack stack;
+      auto lines = PlanReplace(model.Snapshot(), spec);
+      stack.beginMacro("replace");
+      ApplyReplace(model, lines, measurer, [&stack](LRCmd::CmdBase *cmd)
+      {
+        stack.push(cmd);
+      });
+      stack.endMacro();
+      stack.undo();
+    });
+  }
+
+  void BenchPaint(Harness &h, Reorganizer &reorg, const QTemporaryDir &dir)
+  {
+    auto srt = dir.filePath("paint.srt"), wav = dir.filePath("paint.wav");
+    QFile f(srt);
+    f.open(QFile::WriteOnly);
+    f.write(SyntheticSrt(10000));
+    f.close();
+    f.setFileName(wav);
+    f.open(QFile::WriteOnly);
+    f.write(SyntheticWav(Synth::S16, 48000, 60));
+    f.close();
+    reorg.OpenFile(srt);
+    reorg.OpenWave(wav);
+
+    for(auto size : { QSize(1280, 720), QSize(1920, 1080), QSize(2560, 1440) })
+    {
+      reorg.resize(size);
+      QImage image(size, QImage::Format_ARGB32_Premultiplied);
+      h.Run(QString("paint/%1x%2").arg(size.width()).arg(size.height()), 0,
+            (f64)size.width() * size.height() * 4, [&reorg, &image]()
+      {
+        reorg.render(&image);
+      });
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  // Painting goes into images, no display needed
+  if(!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+  QApplication app(argc, argv);
+  QCoreApplication::setApplicationName("lrbench");
+  QCoreApplication::setApplicationVersion(LR_VERSION);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Benchmark parsing, saving, peaks, word splitting, commands, replacing and painting.");
+  parser.addHelpOption();
+  QCommandLineOption outOpt({ "o", "output" }, "Write the JSON report to <file> instead of stdout.", "file");
+  QCommandLineOption filterOpt({ "f", "filter" }, "Only run benchmarks whose name contains <text>.", "text");
+  QCommandLineOption minTimeOpt("min-time", "Seconds to spend on each benchmark at least.", "s", "0.5");
+  parser.addOptions({ outOpt, filterOpt, minTimeOpt });
+  parser.process(app);
+
+  Harness h(parser.value(filterOpt), std::max(0.01, parser.value(minTimeOpt).toDouble()));
+  QTemporaryDir dir;
+  if(!dir.isValid())
+  {
+    fputs("Cannot create a temporary directory.\n", stderr);
+    return 1;
+  }
+
+  // The editor as the main window sets it up
+  Reorganizer reorg;
+  QScrollBar horiz(Qt::Horizontal), vert(Qt::Vertical), nleHoriz(Qt::Horizontal);
+  QPushButton begin, end;
+  reorg.SetScrollBars(&horiz, &vert, &nleHoriz);
+  reorg.SetTimecodeEditBtns(&begin, &end);
+
+  FontMeasurer measurer(QFontMetricsF(QFont("sansserif", 10)), 10);
+  BenchFiles(h, reorg, dir);
+  BenchPeaks(h);
+  BenchStretch(h);
+  BenchSplit(h, measurer);
+  BenchCommands(h);
+  BenchReplace(h);
+  BenchPaint(h, reorg, dir);
+
+  auto json = h.Report().toJson();
+  if(!parser.isSet(outOpt))
+  {
+    fwrite(json.constData(), 1, json.size(), stdout);
+    return 0;
+  }
+  QFile out(parser.value(outOpt));
+  if(!out.open(QFile::WriteOnly) || out.write(json) != json.size())
+  {
+    fprintf(stderr, "Cannot write %s\n", qPrintable(out.fileName()));
+    return 1;
+  }
+  return 0;
+}
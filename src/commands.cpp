@@ -1,90 +1,241 @@
 
 #include <commands.h>
-#include <reorganizer.h>
+#include <undobudget.h>
+#include <wordsplit.h>
 #include <QDebug>
+#include <algorithm>
 
-LRCmd::CmdBase::CmdBase(DialogVec &model) : mModel(model) { }
+LRCmd::CmdBase::CmdBase(DialogVec &model) :
+  mModel(model), mStore(nullptr), mSpillOffset(-1), mSpillSize(0)
+{ }
+
+bool LRCmd::CmdBase::Spill(UndoBudget &store)
+{
+  if(IsSpilled() || PayloadBytes() == 0)
+    return false;
+  QByteArray data;
+  QDataStream s(&data, QIODevice::WriteOnly);
+  WritePayload(s);
+  auto at = store.Write(data);
+  if(at < 0)
+    return false;
+  DropPayload();
+  mStore = &store;
+  mSpillOffset = at;
+  mSpillSize = data.size();
+  return true;
+}
+
+bool LRCmd::CmdBase::Reload()
+{
+  if(!IsSpilled())
+    return true;
+  auto data = mStore->Read(mSpillOffset, mSpillSize);
+  if(data.size() != mSpillSize)
+    return false;
+  QDataStream s(data);
+  ReadPayload(s);
+  if(s.status() != QDataStream::Ok)
+  {
+    // Stay spilled, whatever was read is garbage
+    DropPayload();
+    return false;
+  }
+  mSpillOffset = -1;
+  mSpillSize = 0;
+  return true;
+}
+
+// Where a cut the editor placed ends up, within the line as it is now
+static u64 Within(u64 at, const Dialog &d)
+{
+  return std::min(std::max(at, d.begin), d.end());
+}
+
+// Logs written before the cuts were recorded end right after the other arguments
+static u64 ReadBoundary(QDataStream &s)
+{
+  if(s.atEnd())
+    return LRCmd::ByWordCount;
+  quint64 at;
+  s >> at;
+  return s.status() == QDataStream::Ok ? at : LRCmd::ByWordCount;
+}
+
+static i64 StringBytes(const QString &str)
+{
+  return str.isNull() ? 0 : str.capacity() * (i64)sizeof(QChar) + 24; // With the array header
+}
+
+static i64 WordBytes(const DiscreteWord &w)
+{
+  return sizeof(DiscreteWord) + StringBytes(w.text);
+}
+
+void LRCmd::CmdBase::Write(QDataStream &s) const
+{
+  s << (u8)CmdKind() << mDialog << mWord;
+  WriteArgs(s);
+}
+
+LRCmd::CmdBase *LRCmd::CmdBase::Read(QDataStream &s, DialogVec &model)
+{
+  u8 kind;
+  i32 iDialog, iWord, iOther;
+  s >> kind >> iDialog >> iWord;
+  if(s.status() != QDataStream::Ok || iDialog < 0 || iDialog > model.size())
+    return nullptr;
+  // Only a retiming may start past the last line, as an empty range
+  if(iDialog == model.size() && kind != KindRetimeRange)
+    return nullptr;
+  // Check indices against the model, so a log that does not belong to it can't crash us
+  auto wordCount = iDialog < model.size() ? model[iDialog].words.size() : 0;
+  auto validWord = iWord >= 0 && iWord < wordCount;
+  switch(kind)
+  {
+    case KindMergeToPrevLine:
+    case KindMergeToNextLine:
+      s >> iOther;
+      if(s.status() != QDataStream::Ok || !validWord ||
+         iOther != (kind == KindMergeToPrevLine ? iDialog - 1 : iDialog + 1) ||
+         iOther < 0 || iOther >= model.size() || model[iOther].words.isEmpty())
+        return nullptr;
+      if(kind == KindMergeToPrevLine)
+        return new MergeToPrevLine(model, iDialog, iWord, iOther, ReadBoundary(s));
+      return new MergeToNextLine(model, iDialog, iWord, iOther, ReadBoundary(s));
+
+    case KindSplitToNextLine:
+      return validWord ? new SplitToNextLine(model, iDialog, iWord, ReadBoundary(s)) : nullptr;
+
+    case KindSplitToPrevLine:
+      return validWord ? new SplitToPrevLine(model, iDialog, iWord, ReadBoundary(s)) : nullptr;
+
+    case KindChangeWord:
+    {
+      DiscreteWord word;
+      s >> word;
+      if(s.status() != QDataStream::Ok || !validWord)
+        return nullptr;
+      return new ChangeWord(model, iDialog, iWord, word);
+    }
+
+    case KindInsertWords:
+    {
+      QVector<DiscreteWord> insertion;
+      s >> insertion;
+      if(s.status() != QDataStream::Ok || iWord < 0 || iWord > wordCount)
+        return nullptr;
+      return new InsertWords(model, iDialog, iWord, insertion);
+    }
+
+    case KindRemoveWord:
+      return validWord ? new RemoveWord(model, iDialog, iWord) : nullptr;
+
+    case KindRetimeRange:
+    {
+      TimeMap map;
+      s >> iOther >> map.scale >> map.offset;
+      if(s.status() != QDataStream::Ok || iOther < iDialog || iOther > model.size() || map.scale <= 0.0)
+        return nullptr;
+      return new RetimeRange(model, iDialog, iOther, map);
+    }
+  }
+  return nullptr;
+}
 
 //
 // MergeToPrevLine
 //
 
 
-LRCmd::MergeToPrevLine::MergeToPrevLine(DialogVec &model, i32 iDialog, i32 iWord, i32 iPrevDialog) :
+LRCmd::MergeToPrevLine::MergeToPrevLine(DialogVec &model, i32 iDialog, i32 iWord, i32 iPrevDialog, u64 at) :
   CmdBase(model)
 {
   setText("Merge to previous line");
   mDialog = iDialog;
   mWord = iWord;
   mPrevDialog = iPrevDialog;
-  mCurrDestroyed = false;
+  mSteps.append(Step { .word = iWord, .at = at, .currDestroyed = false });
 }
 
 void LRCmd::MergeToPrevLine::undo()
 {
-  if(mCurrDestroyed)
+  for(i32 i = mSteps.size() - 1; i >= 0; i--)
+    UndoStep(mSteps[i]);
+}
+
+void LRCmd::MergeToPrevLine::redo()
+{
+  for(auto &st : mSteps)
+    RedoStep(st);
+}
+
+bool LRCmd::MergeToPrevLine::mergeWith(const QUndoCommand *other)
+{
+  // Keep pulling words over the same boundary, as long as this line is still there
+  auto o = static_cast<const MergeToPrevLine*>(other);
+  if(o->mDialog != mDialog || o->mPrevDialog != mPrevDialog || mSteps.last().currDestroyed)
+    return false;
+  mSteps += o->mSteps;
+  return true;
+}
+
+void LRCmd::MergeToPrevLine::UndoStep(const Step &st)
+{
+  if(st.currDestroyed)
   {
     mModel.insert(mDialog, Dialog {
                     .type = Dialog::Real
                   });
   }
   auto &curr = mModel[mDialog], &prev = mModel[mPrevDialog];
-  prev.duration = mPrevDuration;
-  curr.begin = mCurrBegin;
-  curr.duration = mCurrDuration;
+  prev.duration = st.prevDuration;
+  curr.begin = st.currBegin;
+  curr.duration = st.currDuration;
 
-  prev.words.last().delim = mDelimMovedTail;
+  prev.SetDelim(prev.words.size() - 1, st.delimMovedTail);
 
-  auto begin = prev.words.size() - mWord - 1;
-  for(int i = 0; i <= mWord; i++)
-  {
-    curr.words.insert(i, prev.words[begin]);
-    prev.words.removeAt(begin);
-  }
+  curr.SpliceWords(0, prev, prev.words.size() - st.word - 1, st.word + 1);
 
-  prev.words.last().delim = '\0';
-  curr.UpdatedWidth();
-  prev.UpdatedWidth();
-  curr.UpdatedCompleteText();
-  prev.UpdatedCompleteText();
+  prev.SetDelim(prev.words.size() - 1, '\0');
+  mModel.Touch(mDialog);
+  mModel.Touch(mPrevDialog);
 }
 
-void LRCmd::MergeToPrevLine::redo()
+void LRCmd::MergeToPrevLine::RedoStep(Step &st)
 {
   auto &curr = mModel[mDialog], &prev = mModel[mPrevDialog];
   auto currSize = curr.words.size();
-  mPrevDuration = prev.duration;
-  mCurrDuration = curr.duration;
-  mCurrBegin = curr.begin;
+  st.prevDuration = prev.duration;
+  st.currDuration = curr.duration;
+  st.currBegin = curr.begin;
 
-  for(int i = 0; i <= mWord; i++)
-  {
-    prev.words.append(curr.words[0]);
-    curr.words.removeAt(0);
-  }
+  prev.SpliceWords(prev.words.size(), curr, 0, st.word + 1);
 
-  mDelimMovedTail = prev.words.last().delim;
-  prev.words.last().delim = '\0';
+  st.delimMovedTail = prev.words.last().delim;
+  prev.SetDelim(prev.words.size() - 1, '\0');
 
   if(curr.words.size() == 0)
   {
     prev.duration += curr.duration;
-    prev.UpdatedWidth();
-    prev.UpdatedCompleteText();
     mModel.removeAt(mDialog);
-    mCurrDestroyed = true;
+    st.currDestroyed = true;
   }
   else
   {
-    u64 timeDelta = (mWord + 1.0) / currSize * curr.duration;
+    u64 timeDelta = st.at == ByWordCount ? (st.word + 1.0) / currSize * curr.duration
+                                         : Within(st.at, curr) - curr.begin;
     curr.begin += timeDelta;
     curr.duration -= timeDelta;
     prev.duration += timeDelta;
-    curr.UpdatedWidth();
-    prev.UpdatedWidth();
-    curr.UpdatedCompleteText();
-    prev.UpdatedCompleteText();
+    mModel.Touch(mDialog);
   }
+  mModel.Touch(mPrevDialog);
+}
+
+void LRCmd::MergeToPrevLine::WriteArgs(QDataStream &s) const
+{
+  s << mPrevDialog << (quint64)mSteps.first().at;
 }
 
 //
@@ -92,113 +243,128 @@ void LRCmd::MergeToPrevLine::redo()
 //
 
 
-LRCmd::MergeToNextLine::MergeToNextLine(DialogVec &model, i32 iDialog, i32 iWord, i32 iNextDialog) :
+LRCmd::MergeToNextLine::MergeToNextLine(DialogVec &model, i32 iDialog, i32 iWord, i32 iNextDialog, u64 at) :
   CmdBase(model)
 {
   setText("Merge to next line");
   mDialog = iDialog;
   mWord = iWord;
   mNextDialog = iNextDialog;
-  mCurrDestroyed = false;
-  mMoveCount = 0;
+  mSteps.append(Step { .word = iWord, .moveCount = 0, .at = at, .currDestroyed = false });
 }
 
 void LRCmd::MergeToNextLine::undo()
 {
-  if(mCurrDestroyed)
+  for(i32 i = mSteps.size() - 1; i >= 0; i--)
+    UndoStep(mSteps[i]);
+}
+
+void LRCmd::MergeToNextLine::redo()
+{
+  for(auto &st : mSteps)
+    RedoStep(st);
+}
+
+bool LRCmd::MergeToNextLine::mergeWith(const QUndoCommand *other)
+{
+  auto o = static_cast<const MergeToNextLine*>(other);
+  if(o->mDialog != mDialog || o->mNextDialog != mNextDialog || mSteps.last().currDestroyed)
+    return false;
+  mSteps += o->mSteps;
+  return true;
+}
+
+void LRCmd::MergeToNextLine::UndoStep(const Step &st)
+{
+  if(st.currDestroyed)
   {
     mModel.insert(mDialog, Dialog {
                     .type = Dialog::Real,
-                    .begin = mModel[mDialog].begin
+                    .begin = st.currBegin
                   });
   }
   else
   {
-    mModel[mDialog].words.last().delim = mDelimMovedTail;
+    auto &curr = mModel[mDialog];
+    curr.SetDelim(curr.words.size() - 1, st.delimMovedTail);
   }
   auto &curr = mModel[mDialog], &next = mModel[mNextDialog];
-  next.begin = mNextBegin;
-  next.duration = mNextDuration;
-  curr.duration = mCurrDuration;
+  next.begin = st.nextBegin;
+  next.duration = st.nextDuration;
+  curr.duration = st.currDuration;
 
-  for(int i = 0; i < mMoveCount; i++)
-  {
-    curr.words.append(next.words[0]);
-    next.words.removeAt(0);
-  }
+  curr.SpliceWords(curr.words.size(), next, 0, st.moveCount);
 
-  curr.words.last().delim = '\0';
-  curr.UpdatedWidth();
-  next.UpdatedWidth();
-  curr.UpdatedCompleteText();
-  next.UpdatedCompleteText();
+  curr.SetDelim(curr.words.size() - 1, '\0');
+  mModel.Touch(mDialog);
+  mModel.Touch(mNextDialog);
 }
 
-void LRCmd::MergeToNextLine::redo()
+void LRCmd::MergeToNextLine::RedoStep(Step &st)
 {
   auto &curr = mModel[mDialog], &next = mModel[mNextDialog];
   auto currSize = curr.words.size();
-  mCurrDuration = curr.duration;
-  mNextDuration = next.duration;
-  mNextBegin = next.begin;
+  st.currBegin = curr.begin;
+  st.currDuration = curr.duration;
+  st.nextDuration = next.duration;
+  st.nextBegin = next.begin;
 
-  curr.words.last().delim = ' ';
+  curr.SetDelim(curr.words.size() - 1, JoinDelim(curr.words.last().text,
+                                                 next.words.size() ? next.words.first().text : QString()));
 
-  mMoveCount = curr.words.size() - mWord;
-  for(int i = 0; i < mMoveCount; i++)
-  {
-    next.words.insert(i, curr.words[mWord]);
-    curr.words.removeAt(mWord);
-  }
+  st.moveCount = curr.words.size() - st.word;
+  next.SpliceWords(0, curr, st.word, st.moveCount);
 
-  if(mWord == 0)
+  if(st.word == 0)
   {
     next.duration += curr.duration;
     next.begin -= curr.duration;
     mModel.removeAt(mDialog);
-    mCurrDestroyed = true;
-    next.UpdatedWidth();
-    next.UpdatedCompleteText();
+    st.currDestroyed = true;
+    mModel.Touch(mDialog); // Next line took our place
   }
   else
   {
-    mDelimMovedTail = curr.words.last().delim;
-    curr.words.last().delim = '\0';
+    st.delimMovedTail = curr.words.last().delim;
+    curr.SetDelim(curr.words.size() - 1, '\0');
 
-    u64 timeDelta = ((f64)currSize - mWord) / currSize * curr.duration;
+    u64 timeDelta = st.at == ByWordCount ? ((f64)currSize - st.word) / currSize * curr.duration
+                                         : curr.end() - Within(st.at, curr);
     curr.duration -= timeDelta;
     next.begin -= timeDelta;
     next.duration += timeDelta;
-    curr.UpdatedWidth();
-    next.UpdatedWidth();
-    curr.UpdatedCompleteText();
-    next.UpdatedCompleteText();
+    mModel.Touch(mDialog);
+    mModel.Touch(mNextDialog);
   }
 }
 
+void LRCmd::MergeToNextLine::WriteArgs(QDataStream &s) const
+{
+  s << mNextDialog << (quint64)mSteps.first().at;
+}
+
 //
 // SplitToNextLine
 //
 
 
-LRCmd::SplitToNextLine::SplitToNextLine(DialogVec &model, i32 iDialog, i32 iWord) :
+LRCmd::SplitToNextLine::SplitToNextLine(DialogVec &model, i32 iDialog, i32 iWord, u64 at) :
   CmdBase(model)
 {
   setText("Split to new line after");
   mDialog = iDialog;
   mWord = iWord;
+  mAt = at;
 }
 
 void LRCmd::SplitToNextLine::undo()
 {
   auto &curr = mModel[mDialog], &next = mModel[mDialog + 1];
-  auto &currwords = curr.words, &nextwords = next.words;
 
-  currwords.append(nextwords);
+  curr.SpliceWords(curr.words.size(), next, 0, next.words.size());
   curr.duration += next.duration;
-  curr.UpdatedWidth();
-  curr.UpdatedCompleteText();
   mModel.removeAt(mDialog + 1);
+  mModel.Touch(mDialog);
 }
 
 void LRCmd::SplitToNextLine::redo()
@@ -207,7 +373,8 @@ void LRCmd::SplitToNextLine::redo()
   auto &currwords = curr.words;
   i32 currSize = currwords.size();
 
-  u64 timeDelta = ((f64)currSize - mWord) / currSize * curr.duration;
+  u64 timeDelta = mAt == ByWordCount ? ((f64)currSize - mWord) / currSize * curr.duration
+                                     : curr.end() - Within(mAt, curr);
   curr.duration -= timeDelta;
 
   Dialog newdialog {
@@ -215,19 +382,15 @@ void LRCmd::SplitToNextLine::redo()
     .duration = timeDelta
   };
 
-  auto &newwords = newdialog.words;
-
-  for(int i = mWord; i < currSize; i++)
-  {
-    newwords.append(currwords[mWord]);
-    currwords.removeAt(mWord);
-  }
-  newdialog.UpdatedWidth();
-  newdialog.UpdatedCompleteText();
+  newdialog.SpliceWords(0, curr, mWord, currSize - mWord);
 
   mModel.insert(mDialog + 1, newdialog);
-  curr.UpdatedWidth();
-  curr.UpdatedCompleteText();
+  mModel.Touch(mDialog);
+}
+
+void LRCmd::SplitToNextLine::WriteArgs(QDataStream &s) const
+{
+  s << (quint64)mAt;
 }
 
 //
@@ -235,31 +398,28 @@ void LRCmd::SplitToNextLine::redo()
 //
 
 
-LRCmd::SplitToPrevLine::SplitToPrevLine(DialogVec &model, i32 iDialog, i32 iWord) :
+LRCmd::SplitToPrevLine::SplitToPrevLine(DialogVec &model, i32 iDialog, i32 iWord, u64 at) :
   CmdBase(model)
 {
   setText("Split to previous line");
   mDialog = iDialog;
   mWord = iWord;
+  mAt = at;
 }
 
 void LRCmd::SplitToPrevLine::undo()
 {
   auto &prev = mModel[mDialog];
-  auto &prevwords = prev.words;
   auto &curr = mModel[mDialog + 1];
-  auto &currwords = curr.words;
 
-  prevwords.last().delim = mDelimMovedTail;
+  prev.SetDelim(prev.words.size() - 1, mDelimMovedTail);
 
-  for(int i = 0; i < prevwords.size(); i++)
-    currwords.insert(i, prevwords[i]);
-  curr.UpdatedWidth();
-  curr.UpdatedCompleteText();
+  curr.SpliceWords(0, prev, 0, prev.words.size());
   curr.begin -= prev.duration;
   curr.duration += prev.duration;
 
   mModel.removeAt(mDialog);
+  mModel.Touch(mDialog);
 }
 
 void LRCmd::SplitToPrevLine::redo()
@@ -268,7 +428,8 @@ void LRCmd::SplitToPrevLine::redo()
   auto &currwords = curr.words;
   i32 currSize = currwords.size();
 
-  u64 timeDelta = ((f64)mWord / currSize) * curr.duration;
+  u64 timeDelta = mAt == ByWordCount ? ((f64)mWord / currSize) * curr.duration
+                                     : Within(mAt, curr) - curr.begin;
 
   mDelimMovedTail = currwords[mWord].delim;
 
@@ -280,19 +441,16 @@ void LRCmd::SplitToPrevLine::redo()
   curr.duration -= timeDelta;
   curr.begin += timeDelta;
 
-  auto &newwords = newdialog.words;
-  for(int i = 0; i <= mWord; i++)
-  {
-    newwords.append(currwords[0]);
-    currwords.remove(0);
-  }
-  newdialog.UpdatedWidth();
-  newwords.last().delim = '\0';
-  newdialog.UpdatedCompleteText();
+  newdialog.SpliceWords(0, curr, 0, mWord + 1);
+  newdialog.SetDelim(mWord, '\0');
 
   mModel.insert(mDialog, newdialog);
-  curr.UpdatedWidth();
-  curr.UpdatedCompleteText();
+  mModel.Touch(mDialog + 1);
+}
+
+void LRCmd::SplitToPrevLine::WriteArgs(QDataStream &s) const
+{
+  s << (quint64)mAt;
 }
 
 //
@@ -303,27 +461,101 @@ void LRCmd::SplitToPrevLine::redo()
 LRCmd::ChangeWord::ChangeWord(DialogVec &model, i32 iDialog, i32 iWord, DiscreteWord &word) :
   CmdBase(model)
 {
-  mChangeWord = word;
+  mChanges.append(Change { .word = iWord, .change = word });
   mDialog = iDialog;
   mWord = iWord;
 }
 
 void LRCmd::ChangeWord::undo()
 {
+  if(!Reload())
+    return;
   auto &curr = mModel[mDialog];
-  curr.words[mWord] = mOrigWord;
-  curr.UpdatedWidth();
-  curr.UpdatedCompleteText();
+  for(auto &i : mChanges)
+    curr.SetWord(i.word, i.orig);
+  mModel.Touch(mDialog);
 }
 
 void LRCmd::ChangeWord::redo()
 {
+  if(!Reload())
+    return;
   auto &curr = mModel[mDialog];
-  mOrigWord = curr.words[mWord];
-  mChangeWord.delim = mOrigWord.delim; // Preserve delimiter! This is important
-  curr.words[mWord] = mChangeWord;
-  curr.UpdatedWidth();
-  curr.UpdatedCompleteText();
+  for(auto &i : mChanges)
+  {
+    i.orig = curr.words[i.word];
+    i.change.delim = i.orig.delim; // Preserve delimiter! This is important
+    curr.SetWord(i.word, i.change);
+  }
+  mModel.Touch(mDialog);
+}
+
+bool LRCmd::ChangeWord::mergeWith(const QUndoCommand *other)
+{
+  auto o = static_cast<const ChangeWord*>(other);
+  if(o->mDialog != mDialog || IsSpilled())
+    return false;
+  for(auto &i : o->mChanges)
+  {
+    auto same = std::find_if(mChanges.begin(), mChanges.end(), [&i](const Change &c)
+    {
+      return c.word == i.word;
+    });
+    if(same == mChanges.end())
+      mChanges.append(i);
+    else
+      same->change = i.change; // Keep the text from before our first edit
+  }
+  // Words that were edited back to what they were
+  mChanges.erase(std::remove_if(mChanges.begin(), mChanges.end(), [](const Change &c)
+  {
+    return c.change.text == c.orig.text;
+  }), mChanges.end());
+  if(mChanges.isEmpty())
+    setObsolete(true);
+  return true;
+}
+
+void LRCmd::ChangeWord::WriteArgs(QDataStream &s) const
+{
+  s << mChanges.first().change;
+}
+
+i64 LRCmd::ChangeWord::PayloadBytes() const
+{
+  i64 ret = 0;
+  for(auto &i : mChanges)
+    ret += sizeof(Change) + WordBytes(i.change) + WordBytes(i.orig) - 2 * sizeof(DiscreteWord);
+  return ret;
+}
+
+void LRCmd::ChangeWord::WritePayload(QDataStream &s) const
+{
+  s << mChanges.size();
+  for(auto &i : mChanges)
+    s << i.word << i.change << i.orig;
+}
+
+void LRCmd::ChangeWord::ReadPayload(QDataStream &s)
+{
+  i32 count;
+  s >> count;
+  // At most one change per word of the line, which a ChangeWord never adds or removes
+  auto wordCount = mModel.at(mDialog).words.size();
+  if(s.status() != QDataStream::Ok || count < 0 || count > wordCount)
+    return s.setStatus(QDataStream::ReadCorruptData);
+  mChanges.resize(count);
+  for(auto &i : mChanges)
+  {
+    s >> i.word >> i.change >> i.orig;
+    if(i.word < 0 || i.word >= wordCount)
+      return s.setStatus(QDataStream::ReadCorruptData);
+  }
+}
+
+void LRCmd::ChangeWord::DropPayload()
+{
+  mChanges = QVector<Change>();
 }
 
 //
@@ -341,25 +573,46 @@ LRCmd::InsertWords::InsertWords(DialogVec &model, i32 iDialog, i32 iWord, QVecto
 
 void LRCmd::InsertWords::undo()
 {
-  auto &curr = mModel[mDialog];
-  auto &currwords = curr.words;
-  auto &ins = mInsertedWords;
-
-  currwords.remove(mWord, ins.size());
-  curr.UpdatedWidth();
-  curr.UpdatedCompleteText();
+  if(!Reload())
+    return;
+  mModel[mDialog].RemoveWords(mWord, mInsertedWords.size());
+  mModel.Touch(mDialog);
 }
 
 void LRCmd::InsertWords::redo()
 {
-  auto &curr = mModel[mDialog];
-  auto &currwords = curr.words;
-  auto &ins = mInsertedWords;
+  if(!Reload())
+    return;
+  mModel[mDialog].InsertWords(mWord, mInsertedWords);
+  mModel.Touch(mDialog);
+}
+
+void LRCmd::InsertWords::WriteArgs(QDataStream &s) const
+{
+  s << mInsertedWords;
+}
+
+i64 LRCmd::InsertWords::PayloadBytes() const
+{
+  i64 ret = 0;
+  for(auto &i : mInsertedWords)
+    ret += WordBytes(i);
+  return ret;
+}
+
+void LRCmd::InsertWords::WritePayload(QDataStream &s) const
+{
+  s << mInsertedWords;
+}
+
+void LRCmd::InsertWords::ReadPayload(QDataStream &s)
+{
+  s >> mInsertedWords;
+}
 
-  for(int i = 0; i < ins.size(); i++)
-    currwords.insert(mWord + i, ins[i]);
-  curr.UpdatedWidth();
-  curr.UpdatedCompleteText();
+void LRCmd::InsertWords::DropPayload()
+{
+  mInsertedWords = QVector<DiscreteWord>();
 }
 
 //
@@ -376,21 +629,99 @@ LRCmd::RemoveWord::RemoveWord(DialogVec &model, i32 iDialog, i32 iWord) :
 
 void LRCmd::RemoveWord::undo()
 {
-  auto &curr = mModel[mDialog];
-  auto &currwords = curr.words;
-  currwords.insert(mWord, mRemovedWord);
-  curr.UpdatedWidth();
-  curr.UpdatedCompleteText();
+  if(!Reload())
+    return;
+  mModel[mDialog].InsertWords(mWord, { mRemovedWord });
+  mModel.Touch(mDialog);
 }
 
 void LRCmd::RemoveWord::redo()
 {
+  if(!Reload())
+    return;
   auto &curr = mModel[mDialog];
-  auto &currwords = curr.words;
-  mRemovedWord = currwords[mWord];
-  currwords.removeAt(mWord);
-  curr.UpdatedWidth();
-  curr.UpdatedCompleteText();
+  mRemovedWord = curr.words[mWord];
+  curr.RemoveWords(mWord, 1);
+  mModel.Touch(mDialog);
+}
+
+void LRCmd::RemoveWord::WriteArgs(QDataStream &s) const
+{
+  Q_UNUSED(s)
+}
+
+i64 LRCmd::RemoveWord::PayloadBytes() const
+{
+  return WordBytes(mRemovedWord);
+}
+
+void LRCmd::RemoveWord::WritePayload(QDataStream &s) const
+{
+  s << mRemovedWord;
+}
+
+void LRCmd::RemoveWord::ReadPayload(QDataStream &s)
+{
+  s >> mRemovedWord;
 }
 
+void LRCmd::RemoveWord::DropPayload()
+{
+  mRemovedWord = DiscreteWord();
+}
+
+//
+// RetimeRange
+//
+
+
+LRCmd::RetimeRange::RetimeRange(DialogVec &model, i32 iBegin, i32 iEnd, const TimeMap &map) :
+  CmdBase(model)
+{
+  setText("Retime lines");
+  mDialog = iBegin;
+  mWord = 0;
+  mEnd = iEnd;
+  mMap = map;
+}
 
+void LRCmd::RetimeRange::undo()
+{
+  if(!Reload())
+    return;
+  mModel.RestoreRange(mDialog, mEnd, mOrig);
+}
+
+void LRCmd::RetimeRange::redo()
+{
+  if(!Reload())
+    return;
+  mOrig = mModel.TransformRange(mDialog, mEnd, mMap);
+}
+
+void LRCmd::RetimeRange::WriteArgs(QDataStream &s) const
+{
+  s << mEnd << mMap.scale << mMap.offset;
+}
+
+i64 LRCmd::RetimeRange::PayloadBytes() const
+{
+  // Right after retiming, only the root of the range is ours, the rest is still the model's
+  return mOrig.Bytes();
+}
+
+void LRCmd::RetimeRange::WritePayload(QDataStream &s) const
+{
+  mOrig.Write(s);
+}
+
+void LRCmd::RetimeRange::ReadPayload(QDataStream &s)
+{
+  if(!mOrig.Read(s))
+    s.setStatus(QDataStream::ReadCorruptData);
+}
+
+void LRCmd::RetimeRange::DropPayload()
+{
+  mOrig.Release();
+}
@@ -1,71 +1,159 @@
 
 #pragma once
 
-#include "reorganizer.h"
+#include <dialogseq.h>
 #include <QUndoCommand>
+#include <QDataStream>
 #include <QVector>
 #include <rint.h>
 
-struct Dialog;
+class UndoBudget;
 
 namespace LRCmd
 {
-  using DialogVec = QVector<Dialog>;
+  using DialogVec = DialogSeq;
+
+  /// Where the split and merge commands put the cut between two parts of a line. Without one
+  /// the time is shared by word count.
+  static constexpr u64 ByWordCount = ~0ull;
 
   class CmdBase : public QUndoCommand
   {
     public:
       CmdBase(DialogVec &model);
+
+      enum Kind : u8
+      {
+        KindMergeToPrevLine = 1,
+        KindMergeToNextLine,
+        KindSplitToNextLine,
+        KindSplitToPrevLine,
+        KindChangeWord,
+        KindInsertWords,
+        KindRemoveWord,
+        KindRetimeRange
+      };
+      virtual Kind CmdKind() const = 0;
+
+      /// Write what the command was constructed with, Read() builds the same command from it
+      void Write(QDataStream &s) const;
+      static CmdBase *Read(QDataStream &s, DialogVec &model); ///< nullptr if the data is unusable
+
+      /// Bytes held by the command. Shared strings are counted as if they were not, dialogs still
+      /// shared with the model not at all.
+      i64 Footprint() const { return CommandBytes + (IsSpilled() ? 0 : PayloadBytes()); }
+      /// Move the payload out to disk and free it, it is read back on the next undo or redo
+      bool Spill(UndoBudget &store);
+      bool IsSpilled() const { return mSpillOffset >= 0; }
+      i32 SpilledBytes() const { return mSpillSize; }
+      /// Read a spilled payload back, false if it cannot be, in which case the command stays
+      /// spilled and undo() and redo() do nothing
+      bool Reload();
+
     protected:
+      virtual void WriteArgs(QDataStream &s) const = 0;
+
+      // Payload, only the commands that keep words or dialogs around have one
+      virtual i64 PayloadBytes() const { return 0; }
+      virtual void WritePayload(QDataStream &s) const { Q_UNUSED(s) }
+      virtual void ReadPayload(QDataStream &s) { Q_UNUSED(s) }
+      virtual void DropPayload() { }
+
       DialogVec &mModel;
       i32 mDialog, mWord;
+
+    private:
+      UndoBudget *mStore;
+      i64 mSpillOffset;
+      i32 mSpillSize;
+
+      static constexpr i64 CommandBytes = 192; ///< Roughly, with QUndoCommand and its private data
   };
 
   class MergeToPrevLine : public CmdBase
   {
     public:
-      MergeToPrevLine(DialogVec &model, i32 iDialog, i32 iWord, i32 iPrevDialog);
+      MergeToPrevLine(DialogVec &model, i32 iDialog, i32 iWord, i32 iPrevDialog, u64 at = ByWordCount);
       void undo() override;
       void redo() override;
+      int id() const override { return KindMergeToPrevLine; }
+      bool mergeWith(const QUndoCommand *other) override;
+      Kind CmdKind() const override { return KindMergeToPrevLine; }
+    protected:
+      void WriteArgs(QDataStream &s) const override;
     private:
+      /// One drag. Consecutive drags over the same boundary are kept as steps of one command,
+      /// each step truncates its own share of time so the steps can't be folded into one.
+      struct Step
+      {
+        i32 word;
+        u64 at;
+        QChar delimMovedTail;
+        u64 prevDuration, currBegin, currDuration;
+        bool currDestroyed;
+      };
+      void UndoStep(const Step &st);
+      void RedoStep(Step &st);
+
       i32 mPrevDialog;
-      QChar mDelimMovedTail;
-      u64 mPrevDuration, mCurrBegin, mCurrDuration;
-      bool mCurrDestroyed;
+      QVector<Step> mSteps;
   };
 
   class MergeToNextLine : public CmdBase
   {
     public:
-      MergeToNextLine(DialogVec &model, i32 iDialog, i32 iWord, i32 iNextDialog);
+      MergeToNextLine(DialogVec &model, i32 iDialog, i32 iWord, i32 iNextDialog, u64 at = ByWordCount);
       void undo() override;
       void redo() override;
+      int id() const override { return KindMergeToNextLine; }
+      bool mergeWith(const QUndoCommand *other) override;
+      Kind CmdKind() const override { return KindMergeToNextLine; }
+    protected:
+      void WriteArgs(QDataStream &s) const override;
     private:
-      i32 mNextDialog, mMoveCount;
-      QChar mDelimMovedTail;
-      u64 mNextDuration, mNextBegin, mCurrDuration;
-      bool mCurrDestroyed;
+      /// One drag, see MergeToPrevLine::Step
+      struct Step
+      {
+        i32 word, moveCount;
+        u64 at;
+        QChar delimMovedTail;
+        u64 nextDuration, nextBegin, currBegin, currDuration;
+        bool currDestroyed;
+      };
+      void UndoStep(const Step &st);
+      void RedoStep(Step &st);
+
+      i32 mNextDialog;
+      QVector<Step> mSteps;
   };
 
   class SplitToNextLine : public CmdBase
   {
     public:
-      SplitToNextLine(DialogVec &model, i32 iDialog, i32 iWord);
+      SplitToNextLine(DialogVec &model, i32 iDialog, i32 iWord, u64 at = ByWordCount);
       void undo() override;
       void redo() override;
+      Kind CmdKind() const override { return KindSplitToNextLine; }
+    protected:
+      void WriteArgs(QDataStream &s) const override;
     private:
       i32 mNextDialog;
+      u64 mAt;
       QChar mDelimMovedTail;
   };
 
   class SplitToPrevLine : public CmdBase
   {
     public:
-      SplitToPrevLine(DialogVec &model, i32 iDialog, i32 iWord);
+      SplitToPrevLine(DialogVec &model, i32 iDialog, i32 iWord, u64 at = ByWordCount);
       void undo() override;
       void redo() override;
+      Kind CmdKind() const override { return KindSplitToPrevLine; }
+    protected:
+      void WriteArgs(QDataStream &s) const override;
     private:
       i32 mPrevDialog;
+      u64 mAt;
       QChar mDelimMovedTail;
   };
 
@@ -75,8 +163,23 @@ namespace LRCmd
       ChangeWord(DialogVec &model, i32 iDialog, i32 iWord, DiscreteWord &word);
       void undo() override;
       void redo() override;
+      int id() const override { return KindChangeWord; }
+      bool mergeWith(const QUndoCommand *other) override; ///< Any word of the same dialog
+      Kind CmdKind() const override { return KindChangeWord; }
+    protected:
+      void WriteArgs(QDataStream &s) const override;
+      i64 PayloadBytes() const override;
+      void WritePayload(QDataStream &s) const override;
+      void ReadPayload(QDataStream &s) override;
+      void DropPayload() override;
     private:
-      DiscreteWord mChangeWord, mOrigWord;
+      /// Net change of one word, the text it had before the first edit and after the last one
+      struct Change
+      {
+        i32 word;
+        DiscreteWord change, orig;
+      };
+      QVector<Change> mChanges;
   };
 
   class InsertWords : public CmdBase
@@ -85,6 +188,13 @@ namespace LRCmd
       InsertWords(DialogVec &model, i32 iDialog, i32 iWord, QVector<DiscreteWord> &insertion);
       void undo() override;
       void redo() override;
+      Kind CmdKind() const override { return KindInsertWords; }
+    protected:
+      void WriteArgs(QDataStream &s) const override;
+      i64 PayloadBytes() const override;
+      void WritePayload(QDataStream &s) const override;
+      void ReadPayload(QDataStream &s) override;
+      void DropPayload() override;
     private:
       QVector<DiscreteWord> mInsertedWords;
   };
@@ -95,7 +205,33 @@ namespace LRCmd
       RemoveWord(DialogVec &model, i32 iDialog, i32 iWord);
       void undo() override;
       void redo() override;
+      Kind CmdKind() const override { return KindRemoveWord; }
+    protected:
+      void WriteArgs(QDataStream &s) const override;
+      i64 PayloadBytes() const override;
+      void WritePayload(QDataStream &s) const override;
+      void ReadPayload(QDataStream &s) override;
+      void DropPayload() override;
     private:
       DiscreteWord mRemovedWord;
   };
+
+  class RetimeRange : public CmdBase
+  {
+    public:
+      RetimeRange(DialogVec &model, i32 iBegin, i32 iEnd, const TimeMap &map);
+      void undo() override;
+      void redo() override;
+      Kind CmdKind() const override { return KindRetimeRange; }
+    protected:
+      void WriteArgs(QDataStream &s) const override;
+      i64 PayloadBytes() const override;
+      void WritePayload(QDataStream &s) const override;
+      void ReadPayload(QDataStream &s) override;
+      void DropPayload() override;
+    private:
+      i32 mEnd;
+      TimeMap mMap;
+      DialogSeq::Subtree mOrig; ///< Range as it was before, putting it back is an exact undo
+  };
 }
@@ -0,0 +1,106 @@
+#include <dialog.h>
+#include <QDataStream>
+#include <iterator>
+#include <utility>
+
+void SpliceWords(QVector<DiscreteWord> &dst, i32 dstPos, QVector<DiscreteWord> &src, i32 srcPos, i32 count)
+{
+  if(count <= 0)
+    return;
+
+  auto srcBegin = src.begin() + srcPos, srcEnd = srcBegin + count;
+  if(dst.isEmpty() && count == src.size())
+  {
+    dst.swap(src);
+    return;
+  }
+
+  if(dstPos == dst.size())
+  {
+    // Appending, the common case when merging into previous line
+    dst.reserve(dst.size() + count);
+    std::move(srcBegin, srcEnd, std::back_inserter(dst));
+  }
+  else
+  {
+    QVector<DiscreteWord> spliced;
+    spliced.reserve(dst.size() + count);
+    std::move(dst.begin(), dst.begin() + dstPos, std::back_inserter(spliced));
+    std::move(srcBegin, srcEnd, std::back_inserter(spliced));
+    std::move(dst.begin() + dstPos, dst.end(), std::back_inserter(spliced));
+    dst.swap(spliced);
+  }
+  src.erase(srcBegin, srcEnd);
+}
+
+static f64 SumWidth(const QVector<DiscreteWord> &words, i32 begin, i32 count)
+{
+  f64 ret = 0.0;
+  for(i32 i = begin; i < begin + count; i++)
+    ret += words[i]._cachedBlockWidthPx;
+  return ret;
+}
+
+void Dialog::SpliceWords(i32 at, Dialog &src, i32 srcPos, i32 count)
+{
+  auto delta = SumWidth(src.words, srcPos, count);
+  ::SpliceWords(words, at, src.words, srcPos, count);
+  width += delta;
+  src.width -= delta;
+  textDirty = src.textDirty = true;
+}
+
+void Dialog::InsertWords(i32 at, QVector<DiscreteWord> insertion)
+{
+  width += SumWidth(insertion, 0, insertion.size());
+  ::SpliceWords(words, at, insertion, 0, insertion.size());
+  textDirty = true;
+}
+
+void Dialog::RemoveWords(i32 at, i32 count)
+{
+  width -= SumWidth(words, at, count);
+  words.remove(at, count);
+  textDirty = true;
+}
+
+void Dialog::SetWord(i32 i, const DiscreteWord &word)
+{
+  width += word._cachedBlockWidthPx - words[i]._cachedBlockWidthPx;
+  words[i] = word;
+  textDirty = true;
+}
+
+void Dialog::SetDelim(i32 i, QChar delim)
+{
+  words[i].delim = delim;
+  textDirty = true;
+}
+
+QDataStream &operator<<(QDataStream &s, const DiscreteWord &w)
+{
+  return s << w.text << w.delim << w._cachedBlockWidthPx;
+}
+
+QDataStream &operator>>(QDataStream &s, DiscreteWord &w)
+{
+  return s >> w.text >> w.delim >> w._cachedBlockWidthPx;
+}
+
+QDataStream &operator<<(QDataStream &s, const Dialog &d)
+{
+  return s << (u8)d.type << (quint64)d.begin << (quint64)d.duration << d.words;
+}
+
+QDataStream &operator>>(QDataStream &s, Dialog &d)
+{
+  u8 type;
+  quint64 begin, duration;
+  s >> type >> begin >> duration >> d.words;
+  d.type = type == Dialog::Placeholder ? Dialog::Placeholder : Dialog::Real;
+  d.begin = begin;
+  d.duration = duration;
+  d.UpdatedWidth();
+  d.textDirty = true;
+  return s;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <QString>
+#include <QVector>
+#include <rint.h>
+
+class QDataStream;
+
+struct DiscreteWord
+{
+  QString text;
+  QChar delim;
+  f64 _cachedBlockWidthPx;
+};
+
+struct Dialog
+{
+  enum { Real, Placeholder } type;
+  u64 begin, duration;
+  QVector<DiscreteWord> words;
+  mutable QString completeText; ///< Cache, use CompleteText() unless you know it's clean
+  u64 end() const { return begin + duration; };
+
+  f64 width; ///< Kept up to date by the word editing methods below
+  mutable bool textDirty;
+
+  f64 UpdatedWidth()
+  {
+    f64 ret = 0.0;
+    for(auto &i : words)
+      ret += i._cachedBlockWidthPx;
+    return (width = ret);
+  }
+
+  QString& UpdatedCompleteText() const
+  {
+    completeText.clear();
+    for(auto &j : words)
+    {
+      completeText += j.text;
+      if(j.delim.cell())
+        completeText += j.delim;
+    }
+    textDirty = false;
+    return completeText;
+  }
+
+  const QString& CompleteText() const
+  {
+    return textDirty ? UpdatedCompleteText() : completeText;
+  }
+
+  /// Write the text word by word into anything that accepts `<< QString` and `<< QChar`
+  template<typename Sink> void StreamText(Sink &sink) const
+  {
+    for(auto &j : words)
+    {
+      sink << j.text;
+      if(j.delim.cell())
+        sink << j.delim;
+    }
+  }
+
+  // Word editing. These apply width deltas and only mark the text as dirty.
+  void SpliceWords(i32 at, Dialog &src, i32 srcPos, i32 count); ///< Move words over from src
+  void InsertWords(i32 at, QVector<DiscreteWord> insertion);
+  void RemoveWords(i32 at, i32 count);
+  void SetWord(i32 i, const DiscreteWord &word);
+  void SetDelim(i32 i, QChar delim);
+};
+
+/// Move words [srcPos, srcPos + count) out of src and insert them into dst before dstPos.
+/// Linear in the size of both vectors, no matter how many words are moved.
+void SpliceWords(QVector<DiscreteWord> &dst, i32 dstPos, QVector<DiscreteWord> &src, i32 srcPos, i32 count);
+
+// Binary form for the edit journal. Widths are stored too, so a replay does not depend on fonts.
+QDataStream &operator<<(QDataStream &s, const DiscreteWord &w);
+QDataStream &operator>>(QDataStream &s, DiscreteWord &w);
+QDataStream &operator<<(QDataStream &s, const Dialog &d);
+QDataStream &operator>>(QDataStream &s, Dialog &d);
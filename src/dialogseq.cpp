@@ -0,0 +1,430 @@
+#include <dialogseq.h>
+#include <QDataStream>
+#include <atomic>
+#include <math.h>
+
+u64 TimeMap::Map(u64 ms) const
+{
+  auto ret = llround(ms * scale + offset);
+  return ret < 0 ? 0 : ret;
+}
+
+void TimeMap::Apply(Dialog &d) const
+{
+  // Map both ends, so that lines next to each other stay next to each other after rounding
+  auto end = Map(d.end());
+  d.begin = Map(d.begin);
+  d.duration = end - d.begin;
+}
+
+DialogSeq::DialogSeq() : mSeed(2463534242u), mVersion(0), mListener(nullptr) { }
+
+DialogSeq &DialogSeq::operator=(const DialogSeq &o)
+{
+  // Whoever listens to us now hears about everything being replaced
+  mRoot = o.mRoot;
+  mSeed = o.mSeed;
+  mVersion = o.mVersion;
+  if(mListener)
+  {
+    mListener->Cleared();
+    i32 i = 0;
+    for(const auto &d : *this)
+      mListener->Inserted(i++, d);
+  }
+  return *this;
+}
+
+void DialogSeq::clear()
+{
+  mRoot.reset();
+  mVersion++;
+  if(mListener)
+    mListener->Cleared();
+}
+
+DialogSnapshot DialogSeq::Snapshot() const
+{
+  return DialogSnapshot(*this);
+}
+
+Dialog &DialogSeq::operator[](i32 i)
+{
+  // Past the end would walk into a null child, after detaching the whole path to it
+  Q_ASSERT(i >= 0 && i < size());
+  NodePtr *p = &mRoot;
+  while(true)
+  {
+    Detach(*p);
+    auto n = p->get();
+    Push(n);
+    auto lc = Count(n->left);
+    if(i < lc)
+      p = &n->left;
+    else if(i == lc)
+      return n->value;
+    else
+    {
+      i -= lc + 1;
+      p = &n->right;
+    }
+  }
+}
+
+Dialog DialogSeq::at(i32 i) const
+{
+  Q_ASSERT(i >= 0 && i < size());
+  const Node *n = mRoot.get();
+  auto pending = TimeMap::Identity();
+  while(true)
+  {
+    auto lc = Count(n->left);
+    if(i == lc)
+      break;
+    pending = n->lazy.Then(pending);
+    if(i < lc)
+      n = n->left.get();
+    else
+    {
+      i -= lc + 1;
+      n = n->right.get();
+    }
+  }
+  auto ret = n->value;
+  if(!pending.IsIdentity())
+    pending.Apply(ret);
+  return ret;
+}
+
+void DialogSeq::insert(i32 i, const Dialog &d)
+{
+  NodePtr l, r;
+  auto n = std::make_shared<Node>();
+  n->value = d;
+  n->priority = NextPriority();
+  Pull(n.get());
+  Split(std::move(mRoot), i, l, r);
+  mRoot = Merge(Merge(std::move(l), std::move(n)), std::move(r));
+  mVersion++;
+  if(mListener)
+    mListener->Inserted(i, d);
+}
+
+void DialogSeq::removeAt(i32 i)
+{
+  NodePtr l, m, r;
+  Split(std::move(mRoot), i, l, m);
+  Split(std::move(m), 1, m, r);
+  mRoot = Merge(std::move(l), std::move(r));
+  mVersion++;
+  if(mListener)
+    mListener->Removed(i);
+}
+
+void DialogSeq::Touch(i32 i)
+{
+  const auto touched = i;
+  std::vector<Node*> path;
+  NodePtr *p = &mRoot;
+  while(true)
+  {
+    Detach(*p);
+    auto n = p->get();
+    Push(n);
+    auto lc = Count(n->left);
+    path.push_back(n);
+    if(i < lc)
+      p = &n->left;
+    else if(i == lc)
+      break;
+    else
+    {
+      i -= lc + 1;
+      p = &n->right;
+    }
+  }
+  for(auto it = path.rbegin(); it != path.rend(); ++it)
+    Pull(*it);
+  mVersion++;
+  if(mListener)
+    mListener->Changed(touched, path.back()->value);
+}
+
+DialogSeq::Subtree DialogSeq::TransformRange(i32 from, i32 to, const TimeMap &map)
+{
+  Subtree ret;
+  NodePtr l, m, r;
+  Split(std::move(mRoot), to, m, r);
+  Split(std::move(m), from, l, m);
+  ret.mRoot = m;
+  ApplyTime(m, map);
+  mRoot = Merge(Merge(std::move(l), std::move(m)), std::move(r));
+  mVersion++;
+  return ret;
+}
+
+void DialogSeq::RestoreRange(i32 from, i32 to, const Subtree &orig)
+{
+  NodePtr l, m, r;
+  Split(std::move(mRoot), to, m, r);
+  Split(std::move(m), from, l, m);
+  mRoot = Merge(Merge(std::move(l), orig.mRoot), std::move(r));
+  mVersion++;
+}
+
+void DialogSeq::Subtree::Write(QDataStream &s) const
+{
+  mKept.clear();
+  WriteOwn(s, mRoot, mKept);
+}
+
+bool DialogSeq::Subtree::Read(QDataStream &s)
+{
+  NodePtr root;
+  if(!ReadOwn(s, root, mKept, 0))
+    return false;
+  mRoot = std::move(root);
+  mKept.clear();
+  return true;
+}
+
+i64 DialogSeq::OwnBytes(const NodePtr &n)
+{
+  // Below a shared node everything is reachable from its other owner as well
+  if(!n || n.use_count() > 1)
+    return 0;
+  return sizeof(Node) + OwnBytes(n->left) + OwnBytes(n->right);
+}
+
+// Every node is a tag, then a node only we hold is followed by its fields and both children
+enum SubtreeTag : u8 { NoNode, OwnNode, KeptNode };
+
+void DialogSeq::WriteOwn(QDataStream &s, const NodePtr &n, std::vector<NodePtr> &kept)
+{
+  if(!n)
+    s << (u8)NoNode;
+  else if(n.use_count() > 1)
+  {
+    s << (u8)KeptNode << (i32)kept.size();
+    kept.push_back(n);
+  }
+  else
+  {
+    s << (u8)OwnNode << n->value << n->priority << n->lazy.scale << n->lazy.offset;
+    WriteOwn(s, n->left, kept);
+    WriteOwn(s, n->right, kept);
+  }
+}
+
+bool DialogSeq::ReadOwn(QDataStream &s, NodePtr &n, const std::vector<NodePtr> &kept, i32 depth)
+{
+  // Far deeper than any treap we build, only a damaged file gets there
+  static constexpr i32 MaxDepth = 256;
+  u8 tag;
+  s >> tag;
+  if(s.status() != QDataStream::Ok || depth > MaxDepth)
+    return false;
+  switch(tag)
+  {
+    case NoNode:
+      n.reset();
+      return true;
+
+    case KeptNode:
+    {
+      i32 index;
+      s >> index;
+      if(s.status() != QDataStream::Ok || index < 0 || index >= (i32)kept.size())
+        return false;
+      n = kept[index];
+      return true;
+    }
+
+    case OwnNode:
+    {
+      n = std::make_shared<Node>();
+      s >> n->value >> n->priority >> n->lazy.scale >> n->lazy.offset;
+      if(s.status() != QDataStream::Ok || !ReadOwn(s, n->left, kept, depth + 1) ||
+         !ReadOwn(s, n->right, kept, depth + 1))
+        return false;
+      Pull(n.get());
+      return true;
+    }
+
+    default:
+      return false;
+  }
+}
+
+DialogSeq::iterator DialogSeq::begin()
+{
+  iterator ret;
+  ret.PushLeft(&mRoot);
+  return ret;
+}
+
+DialogSeq::const_iterator DialogSeq::begin() const
+{
+  const_iterator ret;
+  ret.PushLeft(mRoot.get(), TimeMap::Identity());
+  return ret;
+}
+
+DialogSeq::const_iterator DialogSeq::IteratorAt(i32 i) const
+{
+  // Rebuild the stack an in-order walk would have when it reaches dialog i: the nodes we
+  // turned left at are still to be visited, the ones we turned right at are done
+  const_iterator ret;
+  const Node *n = mRoot.get();
+  auto pending = TimeMap::Identity();
+  while(n)
+  {
+    auto lc = Count(n->left);
+    if(i <= lc)
+      ret.mStack.push_back({ n, pending });
+    if(i == lc)
+      break;
+    pending = n->lazy.Then(pending);
+    if(i < lc)
+      n = n->left.get();
+    else
+    {
+      i -= lc + 1;
+      n = n->right.get();
+    }
+  }
+  return ret;
+}
+
+void DialogSeq::Detach(NodePtr &n)
+{
+  if(n.use_count() > 1)
+    n = std::make_shared<Node>(*n);
+  else
+    // A snapshot on another thread may have just let go of this node, make sure its reads
+    // are done before we start writing (use_count() is a relaxed load)
+    std::atomic_thread_fence(std::memory_order_acquire);
+}
+
+void DialogSeq::ApplyTime(NodePtr &n, const TimeMap &map)
+{
+  if(!n)
+    return;
+  Detach(n);
+  map.Apply(n->value);
+  n->lazy = n->lazy.Then(map);
+}
+
+void DialogSeq::Push(Node *n)
+{
+  if(n->lazy.IsIdentity())
+    return;
+  ApplyTime(n->left, n->lazy);
+  ApplyTime(n->right, n->lazy);
+  n->lazy = TimeMap::Identity();
+}
+
+void DialogSeq::Split(NodePtr t, i32 k, NodePtr &l, NodePtr &r)
+{
+  if(!t)
+  {
+    l.reset();
+    r.reset();
+    return;
+  }
+  Detach(t);
+  Push(t.get());
+  if(Count(t->left) < k)
+  {
+    Split(std::move(t->right), k - Count(t->left) - 1, t->right, r);
+    Pull(t.get());
+    l = std::move(t);
+  }
+  else
+  {
+    Split(std::move(t->left), k, l, t->left);
+    Pull(t.get());
+    r = std::move(t);
+  }
+}
+
+DialogSeq::NodePtr DialogSeq::Merge(NodePtr l, NodePtr r)
+{
+  if(!l) return r;
+  if(!r) return l;
+  if(l->priority > r->priority)
+  {
+    Detach(l);
+    Push(l.get());
+    l->right = Merge(std::move(l->right), std::move(r));
+    Pull(l.get());
+    return l;
+  }
+  else
+  {
+    Detach(r);
+    Push(r.get());
+    r->left = Merge(std::move(l), std::move(r->left));
+    Pull(r.get());
+    return r;
+  }
+}
+
+u32 DialogSeq::NextPriority()
+{
+  // xorshift32, the tree only needs the priorities to look random
+  mSeed ^= mSeed << 13;
+  mSeed ^= mSeed >> 17;
+  mSeed ^= mSeed << 5;
+  return mSeed;
+}
+
+//
+// Iterators
+//
+
+void DialogSeq::iterator::PushLeft(NodePtr *n)
+{
+  while(*n)
+  {
+    Detach(*n);
+    Push(n->get());
+    mStack.push_back(n->get());
+    n = &(*n)->left;
+  }
+}
+
+DialogSeq::iterator &DialogSeq::iterator::operator++()
+{
+  auto n = mStack.back();
+  mStack.pop_back();
+  PushLeft(&n->right);
+  return *this;
+}
+
+Dialog DialogSeq::const_iterator::operator*() const
+{
+  auto &top = mStack.back();
+  auto ret = top.first->value;
+  if(!top.second.IsIdentity())
+    top.second.Apply(ret);
+  return ret;
+}
+
+void DialogSeq::const_iterator::PushLeft(const Node *n, TimeMap pending)
+{
+  while(n)
+  {
+    mStack.push_back({ n, pending });
+    pending = n->lazy.Then(pending);
+    n = n->left.get();
+  }
+}
+
+DialogSeq::const_iterator &DialogSeq::const_iterator::operator++()
+{
+  auto top = mStack.back();
+  mStack.pop_back();
+  PushLeft(top.first->right.get(), top.first->lazy.Then(top.second));
+  return *this;
+}
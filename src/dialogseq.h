@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include <dialog.h>
+#include <rint.h>
+
+/// Affine retiming: begin' = begin * scale + offset, and the end is mapped the same way.
+struct TimeMap
+{
+  f64 scale, offset;
+
+  static TimeMap Identity() { return TimeMap { 1.0, 0.0 }; }
+  static TimeMap Shift(f64 ms) { return TimeMap { 1.0, ms }; }
+  static TimeMap Stretch(f64 factor, f64 pivotMs) { return TimeMap { factor, pivotMs * (1.0 - factor) }; }
+
+  bool IsIdentity() const { return scale == 1.0 && offset == 0.0; }
+  TimeMap Then(const TimeMap &o) const { return TimeMap { scale * o.scale, offset * o.scale + o.offset }; }
+  TimeMap Inverse() const { return TimeMap { 1.0 / scale, -offset / scale }; }
+  u64 Map(u64 ms) const;
+  void Apply(Dialog &d) const;
+};
+
+class DialogSnapshot;
+class QDataStream;
+
+/// Told about every change to the words of a DialogSeq, for indexes kept alongside it.
+/// Retiming is not reported, it leaves the words alone.
+class DialogSeqListener
+{
+  public:
+    virtual ~DialogSeqListener() { }
+    virtual void Inserted(i32 i, const Dialog &d) = 0;
+    virtual void Removed(i32 i) = 0;
+    virtual void Changed(i32 i, const Dialog &d) = 0; ///< Through Touch(), the words may be the same
+    virtual void Cleared() = 0;
+};
+
+/// Ordered sequence of dialogs with O(log n) index, insert and erase.
+///
+/// Backed by an implicit treap (a rope with one dialog per node): a node's position is given by
+/// the sizes of the subtrees on its left, so inserting a line never moves the dialogs after it.
+/// Nodes are reference counted and copied on write, copying a whole sequence only shares its root.
+///
+/// Every node also keeps the widest Dialog::width of its subtree. Insert and erase keep it right
+/// by themselves; after changing a dialog in place through operator[], call Touch() on its index.
+///
+/// Retiming a range only tags the root of that range. The tags are pushed down to the dialogs
+/// when they are reached through the non-const interface, const readers get materialized copies.
+///
+/// Threading: the const interface never writes to a node, and every write goes through Detach()
+/// from the root down, which copies any node still reachable from another copy of the sequence.
+/// So a DialogSnapshot can be read on any thread while the sequence it came from keeps changing.
+class DialogSeq
+{
+    struct Node;
+    typedef std::shared_ptr<Node> NodePtr;
+
+    struct Node
+    {
+      Dialog value;
+      NodePtr left, right;
+      u32 priority;
+      i32 count;
+      f64 maxWidth;
+      TimeMap lazy = TimeMap::Identity(); ///< Already applied to value, still pending for both children
+    };
+
+  public:
+    class iterator
+    {
+      public:
+        Dialog &operator*() const { return mStack.back()->value; }
+        Dialog *operator->() const { return &mStack.back()->value; }
+        iterator &operator++();
+        bool operator==(const iterator &o) const { return Top() == o.Top(); }
+        bool operator!=(const iterator &o) const { return Top() != o.Top(); }
+      private:
+        friend class DialogSeq;
+        void PushLeft(NodePtr *n);
+        Node *Top() const { return mStack.empty() ? nullptr : mStack.back(); }
+        std::vector<Node*> mStack;
+    };
+
+    /// Yields materialized copies, tags on the way are applied without touching the tree
+    class const_iterator
+    {
+      public:
+        Dialog operator*() const;
+        const_iterator &operator++();
+        bool operator==(const const_iterator &o) const { return Top() == o.Top(); }
+        bool operator!=(const const_iterator &o) const { return Top() != o.Top(); }
+      private:
+        friend class DialogSeq;
+        void PushLeft(const Node *n, TimeMap pending);
+        const Node *Top() const { return mStack.empty() ? nullptr : mStack.back().first; }
+        std::vector<std::pair<const Node*, TimeMap>> mStack;
+    };
+
+    /// A detached piece of the tree, returned by TransformRange() to make it exactly undoable.
+    ///
+    /// Most of its nodes are still shared with the sequence. Only the ones nobody else holds
+    /// cost memory, and only those are written out by Write(), the shared ones are kept aside
+    /// until Read() puts the piece back together.
+    class Subtree
+    {
+      public:
+        i32 size() const { return Count(mRoot); }
+        i64 Bytes() const { return OwnBytes(mRoot); } ///< Of the nodes only we hold, not their words
+        void Write(QDataStream &s) const;
+        void Release() { mRoot.reset(); } ///< After Write(), free what it wrote
+        bool Read(QDataStream &s); ///< After Release(), false if the data is unusable
+      private:
+        friend class DialogSeq;
+        NodePtr mRoot;
+        mutable std::vector<NodePtr> mKept; ///< Shared nodes met by Write(), in that order
+    };
+
+    DialogSeq();
+    // Copies, snapshots among them, are not listened to
+    DialogSeq(const DialogSeq &o) : mRoot(o.mRoot), mSeed(o.mSeed), mVersion(o.mVersion), mListener(nullptr) { }
+    DialogSeq &operator=(const DialogSeq &o);
+
+    void SetListener(DialogSeqListener *listener) { mListener = listener; } ///< One at a time, nullptr for none
+
+    i32 size() const { return Count(mRoot); }
+    bool isEmpty() const { return !mRoot; }
+    void clear();
+
+    DialogSnapshot Snapshot() const; ///< O(1), shares every node until one of us writes to it
+    u64 Version() const { return mVersion; } ///< Bumped by every change reported to the sequence
+
+    Dialog &operator[](i32 i);
+    Dialog at(i32 i) const; ///< Materialized copy of dialog i
+    Dialog &back() { return (*this)[size() - 1]; }
+
+    void insert(i32 i, const Dialog &d);
+    void append(const Dialog &d) { insert(size(), d); }
+    void removeAt(i32 i);
+
+    void Touch(i32 i); ///< Refresh the aggregates after dialog i has been edited in place
+    f64 MaxWidth() const { return mRoot ? mRoot->maxWidth : 0.0; }
+
+    /// Retime dialogs [from, to) in O(log n). Returns the range as it was before.
+    Subtree TransformRange(i32 from, i32 to, const TimeMap &map);
+    /// Put back a range returned by TransformRange(), to must be the same as when it was taken
+    void RestoreRange(i32 from, i32 to, const Subtree &orig);
+
+    iterator begin();
+    iterator end() { return iterator(); }
+    const_iterator begin() const;
+    const_iterator end() const { return const_iterator(); }
+    const_iterator IteratorAt(i32 i) const; ///< O(log n), for scanning a range of a snapshot
+
+  private:
+    static i32 Count(const NodePtr &n) { return n ? n->count : 0; }
+    static f64 SubtreeWidth(const NodePtr &n) { return n ? n->maxWidth : 0.0; }
+    static void Pull(Node *n)
+    {
+      n->count = Count(n->left) + Count(n->right) + 1;
+      n->maxWidth = std::max({ n->value.width, SubtreeWidth(n->left), SubtreeWidth(n->right) });
+    }
+    static void Detach(NodePtr &n); ///< Make sure nobody else is sharing this node before writing
+    static void ApplyTime(NodePtr &n, const TimeMap &map);
+    static void Push(Node *n); ///< Hand pending retiming down to the children, n must be detached
+    static void Split(NodePtr t, i32 k, NodePtr &l, NodePtr &r); ///< First k dialogs go to l
+    static NodePtr Merge(NodePtr l, NodePtr r);
+    // Subtree storage, only down to the first nodes someone else also holds
+    static i64 OwnBytes(const NodePtr &n);
+    static void WriteOwn(QDataStream &s, const NodePtr &n, std::vector<NodePtr> &kept);
+    static bool ReadOwn(QDataStream &s, NodePtr &n, const std::vector<NodePtr> &kept, i32 depth);
+
+    u32 NextPriority();
+
+    NodePtr mRoot;
+    u32 mSeed;
+    u64 mVersion;
+    DialogSeqListener *mListener;
+};
+
+/// Read-only version of the model, for worker threads.
+class DialogSnapshot
+{
+  public:
+    DialogSnapshot() { }
+
+    i32 size() const { return mSeq.size(); }
+    bool isEmpty() const { return mSeq.isEmpty(); }
+    u64 Version() const { return mSeq.Version(); }
+    f64 MaxWidth() const { return mSeq.MaxWidth(); }
+
+    Dialog at(i32 i) const { return mSeq.at(i); }
+    DialogSeq::const_iterator begin() const { return mSeq.begin(); }
+    DialogSeq::const_iterator end() const { return mSeq.end(); }
+    DialogSeq::const_iterator IteratorAt(i32 i) const { return mSeq.IteratorAt(i); }
+
+  private:
+    friend class DialogSeq;
+    explicit DialogSnapshot(const DialogSeq &seq) : mSeq(seq) { }
+    DialogSeq mSeq;
+};
@@ -0,0 +1,73 @@
+#include <envelope.h>
+#include <algorithm>
+#include <math.h>
+
+void Envelope::clear()
+{
+  mRms.clear();
+  mPauses.clear();
+}
+
+void Envelope::SetRms(QVector<f32> rms)
+{
+  mRms = std::move(rms);
+  Reindex(mParams);
+}
+
+f32 Envelope::RmsAt(u64 ms) const
+{
+  auto i = ms / WindowMs;
+  return i < (u64)mRms.size() ? mRms[i] : 0.0f;
+}
+
+void Envelope::Reindex(const SilenceParams &params)
+{
+  mParams = params;
+  mPauses.clear();
+  const f32 threshold = powf(10.0f, params.thresholdDb / 20.0f);
+  i32 quietFrom = -1;
+  for(i32 i = 0; i <= mRms.size(); i++)
+  {
+    // One past the end closes a pause the audio ends in
+    bool quiet = i < mRms.size() && mRms[i] < threshold;
+    if(quiet && quietFrom < 0)
+      quietFrom = i;
+    else if(!quiet && quietFrom >= 0)
+    {
+      Pause p { (u64)quietFrom * WindowMs, (u64)i * WindowMs };
+      if(p.length() >= params.minLengthMs)
+        mPauses.append(p);
+      quietFrom = -1;
+    }
+  }
+}
+
+i32 Envelope::NearestPause(u64 ms) const
+{
+  if(mPauses.isEmpty())
+    return -1;
+  // First pause that ends after ms, ms is either in it or between it and the one before
+  auto it = std::upper_bound(mPauses.begin(), mPauses.end(), ms, [](u64 t, const Pause &p)
+  {
+    return t < p.end;
+  });
+  i32 i = it - mPauses.begin();
+  if(i == mPauses.size())
+    return i - 1;
+  if(mPauses[i].begin <= ms || i == 0)
+    return i;
+  return mPauses[i].begin - ms < ms - mPauses[i - 1].end ? i : i - 1;
+}
+
+QPair<i32, i32> Envelope::PausesIn(u64 begin, u64 end) const
+{
+  auto first = std::upper_bound(mPauses.begin(), mPauses.end(), begin, [](u64 t, const Pause &p)
+  {
+    return t < p.end;
+  });
+  auto last = std::lower_bound(first, mPauses.end(), end, [](const Pause &p, u64 t)
+  {
+    return p.begin < t;
+  });
+  return { i32(first - mPauses.begin()), i32(last - mPauses.begin()) };
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <QPair>
+#include <QVector>
+#include <rint.h>
+
+/// A quiet stretch of the audio, in milliseconds
+struct Pause
+{
+  u64 begin, end;
+  u64 length() const { return end - begin; }
+};
+
+/// What counts as a pause
+struct SilenceParams
+{
+  f32 thresholdDb; ///< RMS below this, relative to full scale
+  u64 minLengthMs;
+
+  static SilenceParams Default() { return { -40.0f, 150 }; }
+};
+
+/// Short-window RMS of the audio and the pauses found in it.
+///
+/// The pauses are sorted and don't overlap, so every query is a binary search.
+class Envelope
+{
+  public:
+    static constexpr i32 WindowMs = 10;
+
+    Envelope() : mParams(SilenceParams::Default()) { }
+
+    void clear();
+    bool isEmpty() const { return mRms.isEmpty(); }
+
+    /// Take the RMS of every window, 0 to 1 of full scale, and find the pauses in it
+    void SetRms(QVector<f32> rms);
+    const QVector<f32> &Rms() const { return mRms; }
+    f32 RmsAt(u64 ms) const; ///< 0 past the end
+
+    /// Find the pauses again with other params, linear in the number of windows
+    void Reindex(const SilenceParams &params);
+    const SilenceParams &Params() const { return mParams; }
+
+    const QVector<Pause> &Pauses() const { return mPauses; }
+    i32 NearestPause(u64 ms) const; ///< Index of the pause ms is in or closest to, -1 if none
+    QPair<i32, i32> PausesIn(u64 begin, u64 end) const; ///< [first, last) of those overlapping
+
+  private:
+    QVector<f32> mRms;
+    QVector<Pause> mPauses;
+    SilenceParams mParams;
+};
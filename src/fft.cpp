@@ -0,0 +1,46 @@
+#include <fft.h>
+#include <math.h>
+
+Fft::Fft(i32 size) : mSize(size)
+{
+  mTwiddles.resize(size / 2);
+  for(i32 i = 0; i < size / 2; i++)
+    mTwiddles[i] = std::polar(1.0f, (f32)(-2.0 * M_PI * i / size));
+
+  i32 bits = 0;
+  while((1 << bits) < size)
+    bits++;
+  for(i32 i = 0; i < size; i++)
+  {
+    i32 r = 0;
+    for(i32 b = 0; b < bits; b++)
+      r |= ((i >> b) & 1) << (bits - 1 - b);
+    if(i < r)
+    {
+      mSwaps.push_back(i);
+      mSwaps.push_back(r);
+    }
+  }
+}
+
+void Fft::Transform(std::complex<f32> *data) const
+{
+  for(size_t i = 0; i < mSwaps.size(); i += 2)
+    std::swap(data[mSwaps[i]], data[mSwaps[i + 1]]);
+  for(i32 len = 2; len <= mSize; len <<= 1)
+  {
+    const i32 half = len / 2, step = mSize / len;
+    for(i32 i = 0; i < mSize; i += len)
+    {
+      for(i32 j = 0; j < half; j++)
+      {
+        // Multiplied out by hand, std::complex checks for infinities on every product
+        auto w = mTwiddles[j * step], b = data[i + j + half], a = data[i + j];
+        std::complex<f32> t(w.real() * b.real() - w.imag() * b.imag(),
+                            w.real() * b.imag() + w.imag() * b.real());
+        data[i + j] = a + t;
+        data[i + j + half] = a - t;
+      }
+    }
+  }
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <complex>
+#include <vector>
+#include <rint.h>
+
+/// In-place radix-2 FFT of one fixed size, twiddles and bit reversal worked out up front.
+/// Transform() only reads the tables, one Fft can be shared by any number of threads.
+class Fft
+{
+  public:
+    explicit Fft(i32 size); ///< A power of two
+    i32 size() const { return mSize; }
+
+    void Transform(std::complex<f32> *data) const;
+
+  private:
+    i32 mSize;
+    std::vector<std::complex<f32>> mTwiddles;
+    std::vector<i32> mSwaps; ///< Pairs to exchange for the bit reversed order
+};
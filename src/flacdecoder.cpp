@@ -0,0 +1,702 @@
+#include <flacdecoder.h>
+#include <QThread>
+#include <QtAlgorithms>
+#include <QtConcurrent>
+#include <qendian.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+namespace
+{
+  // MSB first. Reads past the end as zeros and tells it did.
+  class BitReader
+  {
+    public:
+      BitReader(const u8 *at, const u8 *end) : mAt(at), mEnd(end), mCache(0), mBits(0), mLoaded(0), mPadding(0) { }
+
+      u32 Read(i32 n) ///< Up to 32 bits
+      {
+        if(!n)
+          return 0;
+        if(mBits < n)
+          Refill();
+        u32 ret = mCache >> (64 - n);
+        mCache <<= n;
+        mBits -= n;
+        return ret;
+      }
+
+      i32 ReadSigned(i32 n)
+      {
+        if(!n)
+          return 0;
+        u32 v = Read(n);
+        return n == 32 ? (i32)v : (i32)(v << (32 - n)) >> (32 - n);
+      }
+
+      u32 Unary() ///< Zeros before the next one
+      {
+        u32 ret = 0;
+        while(true)
+        {
+          // Bits below the valid ones are always zero
+          if(mCache)
+          {
+            i32 zeros = qCountLeadingZeroBits((quint64)mCache);
+            mCache <<= zeros;
+            mCache <<= 1;
+            mBits -= zeros + 1;
+            return ret + zeros;
+          }
+          ret += mBits;
+          mBits = 0;
+          if(mPadding)
+            return ret;
+          Refill();
+        }
+      }
+
+      i32 Rice(i32 param)
+      {
+        u32 v = Unary() << param;
+        v |= Read(param);
+        return (i32)(v >> 1) ^ -(i32)(v & 1);
+      }
+
+      void AlignToByte()
+      {
+        auto drop = mBits % 8;
+        mCache <<= drop;
+        mBits -= drop;
+      }
+
+      i64 BytePos() const { return mLoaded - mBits / 8; } ///< Once aligned
+      bool Over() const { return mBits < mPadding * 8; } ///< The padding is always last in the cache
+
+    private:
+      void Refill()
+      {
+        while(mBits <= 56)
+        {
+          u64 byte = 0;
+          if(mAt < mEnd)
+            byte = *mAt++;
+          else
+            mPadding++;
+          mCache |= byte << (56 - mBits);
+          mBits += 8;
+          mLoaded++;
+        }
+      }
+
+      const u8 *mAt, *mEnd;
+      u64 mCache; ///< Left aligned
+      i32 mBits;
+      i64 mLoaded;
+      i32 mPadding; ///< Zero bytes loaded past the end
+  };
+
+  struct CrcTables
+  {
+    u8 crc8[256];
+    u16 crc16[256];
+
+    CrcTables()
+    {
+      for(u32 i = 0; i < 256; i++)
+      {
+        u32 c8 = i, c16 = i << 8;
+        for(i32 b = 0; b < 8; b++)
+        {
+          c8 = (c8 << 1) ^ (c8 & 0x80 ? 0x07 : 0);
+          c16 = (c16 << 1) ^ (c16 & 0x8000 ? 0x8005 : 0);
+        }
+        crc8[i] = c8;
+        crc16[i] = c16;
+      }
+    }
+  };
+
+  const CrcTables &Crc()
+  {
+    static const CrcTables tables;
+    return tables;
+  }
+
+  u8 Crc8(const u8 *d, i64 n)
+  {
+    auto &t = Crc();
+    u8 c = 0;
+    for(i64 i = 0; i < n; i++)
+      c = t.crc8[c ^ d[i]];
+    return c;
+  }
+
+  u16 Crc16(const u8 *d, i64 n)
+  {
+    auto &t = Crc();
+    u16 c = 0;
+    for(i64 i = 0; i < n; i++)
+      c = (c << 8) ^ t.crc16[(c >> 8) ^ d[i]];
+    return c;
+  }
+
+  u64 BigEndian(const u8 *d, i32 bytes)
+  {
+    u64 ret = 0;
+    for(i32 i = 0; i < bytes; i++)
+      ret = ret << 8 | d[i];
+    return ret;
+  }
+
+  struct FrameHeader
+  {
+    i64 first;      ///< First sample
+    i32 block;
+    i32 channels;
+    i32 assignment; ///< 0-7 independent, 8 left and side, 9 side and right, 10 mid and side
+    i32 length;     ///< Bytes, with the CRC
+  };
+
+  bool ParseHeader(const u8 *at, const u8 *end, const FlacDecoder::StreamInfo &info, FrameHeader &h)
+  {
+    // Long enough for any header, zero padded at the end of the stream
+    static constexpr i32 MaxLength = 16;
+    u8 d[MaxLength] = { };
+    memcpy(d, at, std::min<i64>(MaxLength, end - at));
+
+    if(d[0] != 0xFF || (d[1] & 0xFE) != 0xF8)
+      return false;
+    const bool variable = d[1] & 1;
+    const i32 blockCode = d[2] >> 4, rateCode = d[2] & 15, chanCode = d[3] >> 4, bitsCode = d[3] >> 1 & 7;
+    if(!blockCode || rateCode == 15 || chanCode > 10 || bitsCode == 3 || d[3] & 1)
+      return false;
+
+    // Frame or sample number, coded like UTF-8
+    auto p = d + 4;
+    u64 number = *p++;
+    i32 extra = 0;
+    if(number >= 0x80)
+    {
+      while(extra < 7 && number & (0x40 >> extra))
+        extra++;
+      if(!extra || extra > 6)
+        return false;
+      number &= 0x3F >> extra;
+      for(i32 i = 0; i < extra; i++, p++)
+      {
+        if((*p & 0xC0) != 0x80)
+          return false;
+        number = number << 6 | (*p & 0x3F);
+      }
+    }
+
+    i32 block;
+    if(blockCode == 1)
+      block = 192;
+    else if(blockCode <= 5)
+      block = 576 << (blockCode - 2);
+    else if(blockCode == 6)
+      block = *p++ + 1;
+    else if(blockCode == 7)
+    {
+      block = (p[0] << 8 | p[1]) + 1;
+      p += 2;
+    }
+    else
+      block = 256 << (blockCode - 8);
+
+    static const i32 Rates[] = { 0, 88200, 176400, 192000, 8000, 16000, 22050, 24000,
+                                 32000, 44100, 48000, 96000 };
+    i32 rate;
+    if(rateCode == 0)
+      rate = info.sampleRate;
+    else if(rateCode < 12)
+      rate = Rates[rateCode];
+    else if(rateCode == 12)
+      rate = *p++ * 1000;
+    else
+    {
+      rate = (p[0] << 8 | p[1]) * (rateCode == 14 ? 10 : 1);
+      p += 2;
+    }
+
+    static const i32 Bits[] = { 0, 8, 12, 0, 16, 20, 24, 32 };
+    const i32 bits = bitsCode ? Bits[bitsCode] : info.bits,
+              channels = chanCode < 8 ? chanCode + 1 : 2;
+    // The stream has to stay the same, which also weeds out most false syncs
+    if(rate != info.sampleRate || bits != info.bits || channels != info.channels || block > info.maxBlock)
+      return false;
+    if(p - d >= end - at || Crc8(d, p - d) != *p)
+      return false;
+
+    h.first = variable ? (i64)number : (i64)number * info.maxBlock;
+    h.block = block;
+    h.channels = channels;
+    h.assignment = chanCode;
+    h.length = p - d + 1;
+    return true;
+  }
+
+  bool DecodeResidual(BitReader &in, i32 block, i32 order, i32 *out)
+  {
+    const auto method = in.Read(2);
+    if(method > 1)
+      return false;
+    const i32 paramBits = method ? 5 : 4, escape = (1 << paramBits) - 1,
+              partitions = 1 << in.Read(4), perPartition = block / partitions;
+    if(block % partitions || perPartition < order)
+      return false;
+    i32 i = order;
+    for(i32 p = 0; p < partitions; p++)
+    {
+      const i32 end = (p + 1) * perPartition;
+      const i32 param = in.Read(paramBits);
+      if(param == escape)
+      {
+        const i32 raw = in.Read(5);
+        for(; i < end; i++)
+          out[i] = in.ReadSigned(raw);
+      }
+      else
+      {
+        for(; i < end; i++)
+          out[i] = in.Rice(param);
+      }
+    }
+    return !in.Over();
+  }
+
+  bool DecodeSubframe(BitReader &in, i32 block, i32 bits, i32 *out)
+  {
+    if(in.Read(1))
+      return false;
+    const u32 type = in.Read(6);
+    i32 wasted = 0;
+    if(in.Read(1))
+      wasted = in.Unary() + 1;
+    bits -= wasted;
+    if(bits <= 0)
+      return false;
+
+    if(type == 0)
+      std::fill(out, out + block, in.ReadSigned(bits));
+    else if(type == 1)
+    {
+      for(i32 i = 0; i < block; i++)
+        out[i] = in.ReadSigned(bits);
+    }
+    else if(type >= 8 && type <= 12)
+    {
+      const i32 order = type - 8;
+      if(order > block)
+        return false;
+      for(i32 i = 0; i < order; i++)
+        out[i] = in.ReadSigned(bits);
+      if(!DecodeResidual(in, block, order, out))
+        return false;
+      // In 64 bits, a damaged frame may overflow before its CRC turns it down
+      switch(order)
+      {
+        case 1:
+          for(i32 i = 1; i < block; i++)
+            out[i] = (i32)((i64)out[i] + out[i - 1]);
+          break;
+        case 2:
+          for(i32 i = 2; i < block; i++)
+            out[i] = (i32)(out[i] + 2ll * out[i - 1] - out[i - 2]);
+          break;
+        case 3:
+          for(i32 i = 3; i < block; i++)
+            out[i] = (i32)(out[i] + 3ll * out[i - 1] - 3ll * out[i - 2] + out[i - 3]);
+          break;
+        case 4:
+          for(i32 i = 4; i < block; i++)
+            out[i] = (i32)(out[i] + 4ll * out[i - 1] - 6ll * out[i - 2] + 4ll * out[i - 3] - out[i - 4]);
+          break;
+        default:
+          break;
+      }
+    }
+    else if(type >= 32)
+    {
+      const i32 order = type - 31;
+      if(order > block)
+        return false;
+      for(i32 i = 0; i < order; i++)
+        out[i] = in.ReadSigned(bits);
+      const i32 precision = in.Read(4) + 1, shift = in.ReadSigned(5);
+      if(precision == 16 || shift < 0)
+        return false;
+      i32 coefs[32];
+      for(i32 i = 0; i < order; i++)
+        coefs[i] = in.ReadSigned(precision);
+      if(!DecodeResidual(in, block, order, out))
+        return false;
+      for(i32 i = order; i < block; i++)
+      {
+        i64 sum = 0;
+        for(i32 j = 0; j < order; j++)
+          sum += (i64)coefs[j] * out[i - 1 - j];
+        out[i] = (i32)(out[i] + (sum >> shift));
+      }
+    }
+    else
+      return false;
+
+    if(wasted)
+    {
+      for(i32 i = 0; i < block; i++)
+        out[i] = (i32)((u32)out[i] << wasted);
+    }
+    return !in.Over();
+  }
+
+  /// The frame at `at` into pcm, a block of info.maxBlock per channel.
+  /// @return its size in bytes, 0 if there is no intact frame there
+  i64 DecodeFrame(const u8 *at, const u8 *end, const FlacDecoder::StreamInfo &info, FrameHeader &h, i32 *pcm)
+  {
+    if(!ParseHeader(at, end, info, h))
+      return 0;
+    BitReader in(at + h.length, end);
+    for(i32 c = 0; c < h.channels; c++)
+    {
+      // The side channel takes a bit more
+      const bool side = (h.assignment == 8 && c == 1) || (h.assignment == 9 && c == 0) || (h.assignment == 10 && c == 1);
+      if(!DecodeSubframe(in, h.block, info.bits + side, pcm + c * info.maxBlock))
+        return 0;
+    }
+    in.AlignToByte();
+    const i64 body = h.length + in.BytePos();
+    const u16 crc = in.Read(16);
+    if(in.Over() || Crc16(at, body) != crc)
+      return 0;
+
+    auto l = pcm, r = pcm + info.maxBlock;
+    switch(h.assignment)
+    {
+      case 8:
+        for(i32 i = 0; i < h.block; i++)
+          r[i] = (i32)((i64)l[i] - r[i]);
+        break;
+      case 9:
+        for(i32 i = 0; i < h.block; i++)
+          l[i] = (i32)((i64)l[i] + r[i]);
+        break;
+      case 10:
+        for(i32 i = 0; i < h.block; i++)
+        {
+          i64 side = r[i], mid = (i64)l[i] * 2 | (side & 1);
+          l[i] = (i32)((mid + side) >> 1);
+          r[i] = (i32)((mid - side) >> 1);
+        }
+        break;
+      default:
+        break;
+    }
+    return body + 2;
+  }
+
+  // Frames [from, to) of a decoded block, interleaved the way the cache keeps them
+  void Store(const i32 *pcm, i32 stride, i32 channels, i32 bits, i64 from, i64 to, u8 *out)
+  {
+    if(bits <= 16)
+    {
+      const i32 up = 16 - bits;
+      for(auto i = from; i < to; i++)
+      {
+        for(i32 c = 0; c < channels; c++, out += 2)
+          qToLittleEndian<qint16>((i16)((u32)pcm[c * stride + i] << up), out);
+      }
+    }
+    else
+    {
+      const f32 scale = 1.0f / (1 << (bits - 1));
+      for(auto i = from; i < to; i++)
+      {
+        for(i32 c = 0; c < channels; c++, out += 4)
+        {
+          f32 v = pcm[c * stride + i] * scale;
+          memcpy(out, &v, 4);
+        }
+      }
+    }
+  }
+}
+
+FlacDecoder::FlacDecoder(QObject *parent) : WavDecoder(parent), mInfo()
+{
+
+}
+
+bool FlacDecoder::cacheAll(QIODevice *_dev)
+{
+  static constexpr i64 TailBytes = 4 << 20, MinSegmentBytes = 256 << 10;
+
+  dev = _dev;
+  mSeek.clear();
+  mData.clear();
+  mPager.reset();
+  mSource = std::make_shared<Source>();
+  auto file = qobject_cast<QFileDevice*>(dev);
+  const bool compact = mCompact && file && !file->fileName().isEmpty();
+  if(compact)
+  {
+    // The system pages the stream in and out, it is only read for what is played
+    auto mapped = std::make_shared<QFile>(file->fileName());
+    uchar *map = nullptr;
+    if(mapped->open(QFile::ReadOnly) && (map = mapped->map(0, mapped->size())))
+    {
+      mSource->mapped = mapped;
+      mSource->data = map;
+      mSource->size = mapped->size();
+    }
+  }
+  if(!mSource->mapped)
+  {
+    if(!dev->isSequential())
+      dev->reset();
+    mSource->read = dev->readAll();
+    mSource->data = reinterpret_cast<const u8*>(mSource->read.constData());
+    mSource->size = mSource->read.size();
+  }
+  auto d = mSource->data;
+  const i64 size = mSource->size;
+
+  // Some taggers put ID3 in front
+  i64 pos = 0;
+  if(size >= 10 && !memcmp(d, "ID3", 3))
+    pos = 10 + (d[6] << 21 | d[7] << 14 | d[8] << 7 | d[9]) + (d[5] & 0x10 ? 10 : 0);
+  if(pos + 4 > size || memcmp(d + pos, "fLaC", 4))
+    return false;
+  pos += 4;
+
+  bool last = false, haveInfo = false;
+  QVector<i64> cuts;
+  while(!last)
+  {
+    if(pos + 4 > size)
+      return false;
+    last = d[pos] & 0x80;
+    const i32 type = d[pos] & 0x7F;
+    const i64 length = BigEndian(d + pos + 1, 3);
+    pos += 4;
+    if(pos + length > size)
+      return false;
+    if(type == 0 && length >= 34)
+    {
+      BitReader in(d + pos, d + pos + length);
+      mInfo.minBlock = in.Read(16);
+      mInfo.maxBlock = in.Read(16);
+      in.Read(24);
+      in.Read(24);
+      mInfo.sampleRate = in.Read(20);
+      mInfo.channels = in.Read(3) + 1;
+      mInfo.bits = in.Read(5) + 1;
+      mInfo.samples = (i64)in.Read(4) << 32;
+      mInfo.samples |= in.Read(32);
+      haveInfo = true;
+    }
+    else if(type == 3)
+    {
+      for(i64 p = pos; p + 18 <= pos + length; p += 18)
+      {
+        if(BigEndian(d + p, 8) != ~0ull) // Placeholder
+          cuts.append(BigEndian(d + p + 8, 8));
+      }
+    }
+    pos += length;
+  }
+  if(!haveInfo || mInfo.sampleRate <= 0 || mInfo.bits < 4 || mInfo.bits > 24 ||
+     mInfo.maxBlock < 16 || mInfo.minBlock > mInfo.maxBlock)
+    return false;
+  mSource->firstFrame = pos;
+  const i64 bytes = size - pos;
+
+  fmt.channelCount = mInfo.channels;
+  fmt.sampleRate = mInfo.sampleRate;
+  fmt.sampleSize = mInfo.bits <= 16 ? 16 : 32;
+  fmt.sampleType = mInfo.bits <= 16 ? WavFormat::Int16 : WavFormat::Float32;
+  fmt.byteOrder = WavFormat::LittleEndian;
+  fmt.bytesPerFrame = fmt.sampleSize / 8 * fmt.channelCount;
+
+  auto total = mInfo.samples;
+  if(!total)
+  {
+    // The encoder did not know, the last frame does
+    Segment tail { std::max<i64>(0, bytes - TailBytes), bytes, { }, 0 };
+    DecodeSegment(tail, nullptr, 0);
+    total = tail.last;
+  }
+  if(total <= 0 || (!compact && total > std::numeric_limits<decltype(mData.size())>::max() / fmt.bytesPerFrame))
+    return false;
+
+  // Cut at the seek table, then evenly wherever it leaves too much between cuts
+  const i64 target = std::max<i64>(bytes / (std::max(QThread::idealThreadCount(), 1) * 8), MinSegmentBytes);
+  cuts.append(0);
+  std::sort(cuts.begin(), cuts.end());
+  QVector<i64> kept;
+  for(auto c : cuts)
+  {
+    if(c < bytes && (kept.isEmpty() || c - kept.last() >= target / 4))
+      kept.append(c);
+  }
+  kept.append(bytes);
+  QVector<Segment> segments;
+  for(i32 i = 0; i + 1 < kept.size(); i++)
+  {
+    const i64 from = kept[i], span = kept[i + 1] - from, n = (span + target - 1) / target;
+    for(i64 k = 0; k < n; k++)
+      segments.append(Segment { from + span * k / n, from + span * (k + 1) / n, { }, 0 });
+  }
+
+  mFrames = total;
+  u8 *out = nullptr;
+  if(!compact)
+  {
+    mData = QByteArray(total * fmt.bytesPerFrame, '\0');
+    out = reinterpret_cast<u8*>(mData.data());
+  }
+  BeginIngest(total);
+  QtConcurrent::blockingMap(segments, [=](Segment &s)
+  {
+    DecodeSegment(s, out, total);
+  });
+  EndIngest();
+  for(auto &s : segments)
+    mSeek += s.points;
+  if(mSeek.isEmpty())
+    return false;
+
+  if(compact)
+  {
+    auto source = mSource;
+    auto info = mInfo;
+    auto seek = mSeek;
+    const i32 frameBytes = fmt.bytesPerFrame;
+    SetPager([=](i64 frame, i64 count)
+    {
+      return DecodeRange(*source, info, seek, frameBytes, frame, count);
+    });
+  }
+  else
+    mSource.reset();
+  return true;
+}
+
+i64 FlacDecoder::ResidentBytes() const
+{
+  return WavDecoder::ResidentBytes() + mSeek.size() * (i64)sizeof(SeekPoint) +
+         (mSource ? mSource->read.size() : 0);
+}
+
+void FlacDecoder::DecodeSegment(Segment &s, u8 *out, i64 total)
+{
+  static constexpr i64 BatchFrames = 1 << 16;
+  auto base = mSource->data + mSource->firstFrame;
+  auto end = mSource->data + mSource->size;
+  const i64 frameBytes = fmt.bytesPerFrame;
+  std::vector<i32> pcm(mInfo.channels * mInfo.maxBlock);
+  std::vector<u8> batch(out || !total ? 0 : BatchFrames * frameBytes);
+  FrameHeader h;
+  i64 at = s.begin, nextPoint = std::numeric_limits<i64>::min();
+  s.last = 0;
+
+  // Contiguous frames decoded and not ingested yet
+  i64 runFirst = 0, runEnd = 0;
+  auto flush = [&]()
+  {
+    if(runEnd > runFirst)
+      Ingest(reinterpret_cast<const char*>(out ? out + runFirst * frameBytes : batch.data()), runFirst, runEnd - runFirst);
+    runFirst = runEnd;
+  };
+
+  while(at < s.end)
+  {
+    // Sync to the next intact frame
+    i64 length = 0;
+    while(at < s.end)
+    {
+      auto sync = static_cast<const u8*>(memchr(base + at, 0xFF, s.end - at));
+      if(!sync)
+      {
+        at = s.end;
+        break;
+      }
+      at = sync - base;
+      if((length = DecodeFrame(base + at, end, mInfo, h, pcm.data())))
+        break;
+      at++;
+    }
+
+    // Then one after the other
+    while(length)
+    {
+      if(h.first >= nextPoint)
+      {
+        s.points.append(SeekPoint { h.first, at });
+        nextPoint = h.first + mInfo.sampleRate;
+      }
+      if(h.first < total)
+      {
+        const i64 n = std::min<i64>(h.block, total - h.first);
+        if(h.first != runEnd || (!out && runEnd + n - runFirst > BatchFrames))
+        {
+          flush();
+          runFirst = runEnd = h.first;
+        }
+        Store(pcm.data(), mInfo.maxBlock, mInfo.channels, mInfo.bits, 0, n,
+              out ? out + h.first * frameBytes : batch.data() + (h.first - runFirst) * frameBytes);
+        runEnd += n;
+      }
+      s.last = std::max(s.last, h.first + h.block);
+      at += length;
+      length = at < s.end ? DecodeFrame(base + at, end, mInfo, h, pcm.data()) : 0;
+    }
+  }
+  flush();
+}
+
+QByteArray FlacDecoder::DecodeRange(const Source &source, const StreamInfo &info, const QVector<SeekPoint> &seek,
+                                    i32 frameBytes, i64 frame, i64 count)
+{
+  QByteArray ret(std::max<i64>(count, 0) * frameBytes, '\0');
+  if(seek.isEmpty() || count <= 0)
+    return ret;
+
+  // From the last point at or before the frame
+  auto point = std::upper_bound(seek.begin(), seek.end(), frame, [](i64 f, const SeekPoint &p)
+  {
+    return f < p.sample;
+  });
+  if(point != seek.begin())
+    point--;
+
+  auto base = source.data + source.firstFrame;
+  auto end = source.data + source.size;
+  auto out = reinterpret_cast<u8*>(ret.data());
+  std::vector<i32> pcm(info.channels * info.maxBlock);
+  FrameHeader h;
+  for(i64 at = point->offset; base + at < end; )
+  {
+    auto length = DecodeFrame(base + at, end, info, h, pcm.data());
+    if(!length)
+    {
+      // Damaged, on to the next one in sync
+      auto sync = static_cast<const u8*>(memchr(base + at + 1, 0xFF, end - (base + at + 1)));
+      if(!sync)
+        break;
+      at = sync - base;
+      continue;
+    }
+    if(h.first >= frame + count)
+      break;
+    auto from = std::max(frame, h.first), to = std::min(frame + count, h.first + h.block);
+    if(from < to)
+      Store(pcm.data(), info.maxBlock, info.channels, info.bits, from - h.first, to - h.first,
+            out + (from - frame) * frameBytes);
+    at += length;
+  }
+  return ret;
+}
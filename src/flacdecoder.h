@@ -0,0 +1,66 @@
+#pragma once
+
+#include <QFile>
+#include <QVector>
+#include <memory>
+#include <wavdecoder.h>
+
+/// FLAC into the same PCM cache WavDecoder keeps, 16 bit for streams up to 16 bits and float
+/// for deeper ones. Streams of up to 24 bits and 8 channels are read.
+///
+/// FLAC frames carry no length, the next one starts where decoding this one ends. The stream is
+/// cut at the offsets of its SEEKTABLE, and evenly where those are missing or sparse, and every
+/// cut is decoded front to back on a thread of its own, syncing to the first frame after it.
+/// Damaged frames are left silent. Seek points at about every second of audio are kept, so when
+/// compact the pager only decodes from the nearest one before the block it asks for.
+class FlacDecoder : public WavDecoder
+{
+    Q_OBJECT
+
+  public:
+    struct StreamInfo
+    {
+      i32 minBlock, maxBlock, sampleRate, channels, bits;
+      i64 samples; ///< 0 if the encoder did not know
+    };
+
+    struct SeekPoint
+    {
+      i64 sample, offset; ///< Offset from the first frame
+    };
+
+    explicit FlacDecoder(QObject *parent);
+
+    bool cacheAll(QIODevice *dev) override;
+    i64 ResidentBytes() const override;
+
+    const QVector<SeekPoint> &SeekPoints() const { return mSeek; }
+
+  private:
+    struct Segment
+    {
+      i64 begin, end; ///< Frames beginning in here, in bytes from the first frame
+      QVector<SeekPoint> points;
+      i64 last; ///< One past the last sample decoded
+    };
+
+    /// The stream, mapped when compact and read whole otherwise. Shared with the pager.
+    struct Source
+    {
+      std::shared_ptr<QFile> mapped;
+      QByteArray read;
+      const u8 *data;
+      i64 size, firstFrame;
+    };
+
+    /// Decodes and ingests the frames of total, into out or, when it is null, through a batch
+    /// buffer of its own. Only walks them if total is 0.
+    void DecodeSegment(Segment &s, u8 *out, i64 total);
+
+    static QByteArray DecodeRange(const Source &source, const StreamInfo &info, const QVector<SeekPoint> &seek,
+                                  i32 frameBytes, i64 frame, i64 count);
+
+    std::shared_ptr<Source> mSource; ///< Only kept when compact
+    StreamInfo mInfo;
+    QVector<SeekPoint> mSeek;
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <QFontMetricsF>
+#include <textmeasurer.h>
+
+/// Measures with the font the editor draws in
+class FontMeasurer : public TextMeasurer
+{
+  public:
+    FontMeasurer(const QFontMetricsF &met, f64 padding) : mMet(met), mPadding(padding) { }
+    f64 WordWidth(const QString &word) const override { return mMet.width(word) + mPadding; }
+
+  private:
+    QFontMetricsF mMet;
+    f64 mPadding;
+};
@@ -0,0 +1,123 @@
+// Seeded generator for SRT and WAV files of any size, the same seed gives the same files
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+#include <QSaveFile>
+#include <algorithm>
+#include <stdio.h>
+#include <gen/synth.h>
+
+namespace
+{
+  bool ParseFormat(const QString &name, Synth::SampleFormat &format)
+  {
+    static const QPair<QString, Synth::SampleFormat> names[] = {
+      { "u8", Synth::U8 }, { "s16", Synth::S16 }, { "s24", Synth::S24 }, { "s32", Synth::S32 }, { "f32", Synth::F32 }
+    };
+    for(auto &i : names)
+      if(i.first == name)
+      {
+        format = i.second;
+        return true;
+      }
+    return false;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  QCoreApplication app(argc, argv);
+  QCoreApplication::setApplicationName("lrgen");
+
+  auto srtDefaults = Synth::SrtSpec::Default();
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Generate SRT and matching WAV files for benchmarks and scale tests.");
+  parser.addHelpOption();
+  QList<QCommandLineOption> options = {
+    { "srt", "Write subtitles to <file>.", "file" },
+    { "wav", "Write audio to <file>, speaking while the cues are on.", "file" },
+    { "seed", "Seed for everything.", "n", QString::number(srtDefaults.seed) },
+    { "cues", "Number of cues.", "n", QString::number(srtDefaults.cues) },
+    { "min-words", "Fewest words in a cue.", "n", QString::number(srtDefaults.minWords) },
+    { "max-words", "Most words in a cue.", "n", QString::number(srtDefaults.maxWords) },
+    { "latin", "Weight of Latin script cues.", "w", QString::number(srtDefaults.latin) },
+    { "cjk", "Weight of CJK cues.", "w", QString::number(srtDefaults.cjk) },
+    { "rtl", "Weight of Hebrew and Arabic cues.", "w", QString::number(srtDefaults.rtl) },
+    { "overlaps", "Share of cues overlapping the one before.", "rate", QString::number(srtDefaults.overlapRate) },
+    { "gaps", "Share of cues after a long pause.", "rate", QString::number(srtDefaults.gapRate) },
+    { "max-gap", "Longest pause in milliseconds.", "ms", QString::number(srtDefaults.maxGapMs) },
+    { "seconds", "Audio length, by default until 2 s after the last cue.", "s" },
+    { "sample-rate", "Audio sample rate.", "hz", "48000" },
+    { "channels", "Audio channels.", "n", "1" },
+    { "format", "Sample format: u8, s16, s24, s32 or f32.", "name", "s16" },
+    { "rf64", "Write an RF64 header even below 4 GiB." }
+  };
+  parser.addOptions(options);
+  parser.process(app);
+
+  bool ok[12];
+  Synth::SrtSpec spec;
+  spec.seed = parser.value("seed").toUInt(&ok[0]);
+  spec.cues = parser.value("cues").toInt(&ok[1]);
+  spec.minWords = parser.value("min-words").toInt(&ok[2]);
+  spec.maxWords = parser.value("max-words").toInt(&ok[3]);
+  spec.latin = parser.value("latin").toDouble(&ok[4]);
+  spec.cjk = parser.value("cjk").toDouble(&ok[5]);
+  spec.rtl = parser.value("rtl").toDouble(&ok[6]);
+  spec.overlapRate = parser.value("overlaps").toDouble(&ok[7]);
+  spec.gapRate = parser.value("gaps").toDouble(&ok[8]);
+  spec.maxGapMs = parser.value("max-gap").toULongLong(&ok[9]);
+
+  Synth::WavSpec wav;
+  wav.sampleRate = parser.value("sample-rate").toInt(&ok[10]);
+  wav.channels = parser.value("channels").toInt(&ok[11]);
+  wav.forceRf64 = parser.isSet("rf64");
+  wav.seed = spec.seed + 1;
+  if(std::find(ok, ok + 12, false) != ok + 12 || spec.cues < 0 || spec.minWords < 1 ||
+     spec.maxWords < spec.minWords || spec.latin < 0 || spec.cjk < 0 || spec.rtl < 0 ||
+     wav.sampleRate <= 0 || wav.channels <= 0 || wav.channels > 64 ||
+     !ParseFormat(parser.value("format"), wav.format))
+  {
+    fputs("Invalid options.\n", stderr);
+    return 2;
+  }
+  if(!parser.isSet("srt") && !parser.isSet("wav"))
+    parser.showHelp(2);
+
+  // The audio follows the cues, so they are made even when only the WAV is wanted
+  auto cues = Synth::GenerateCues(spec);
+  if(parser.isSet("srt"))
+  {
+    QSaveFile f(parser.value("srt"));
+    if(!f.open(QFile::WriteOnly) || f.write(Synth::FormatSrt(cues)) < 0 || !f.commit())
+    {
+      fprintf(stderr, "Cannot write %s: %s\n", qPrintable(f.fileName()), qPrintable(f.errorString()));
+      return 1;
+    }
+  }
+
+  if(parser.isSet("wav"))
+  {
+    f64 seconds = (cues.isEmpty() ? 0 : cues.last().end) / 1000.0 + 2.0;
+    if(parser.isSet("seconds"))
+    {
+      seconds = parser.value("seconds").toDouble(&ok[0]);
+      if(!ok[0] || seconds < 0)
+      {
+        fputs("Invalid options.\n", stderr);
+        return 2;
+      }
+    }
+    wav.frames = (u64)(seconds * wav.sampleRate);
+    // Several GiB, QSaveFile would keep a second copy around until it is done
+    QFile f(parser.value("wav"));
+    if(!f.open(QFile::WriteOnly | QFile::Truncate) || !Synth::WriteWav(&f, wav, cues))
+    {
+      fprintf(stderr, "Cannot write %s: %s\n", qPrintable(f.fileName()), qPrintable(f.errorString()));
+      return 1;
+    }
+    printf("%s: %llu bytes%s\n", qPrintable(f.fileName()), (unsigned long long)Synth::WavBytes(wav),
+           Synth::IsRf64(wav) ? ", RF64" : "");
+  }
+  return 0;
+}
@@ -0,0 +1,253 @@
+#include <gen/synth.h>
+#include <algorithm>
+#include <string.h>
+#include <random>
+#include <dialog.h>
+#include <srtwriter.h>
+
+namespace
+{
+  class Rng
+  {
+    public:
+      explicit Rng(u32 seed) : mGen(seed) { }
+      u32 Next() { return mGen(); }
+      i32 Range(i32 lo, i32 hi) { return lo + (i32)(Next() % (u32)(hi - lo + 1)); } ///< Both ends included
+      f64 Unit() { return Next() / 4294967296.0; } ///< [0, 1), exact
+      bool Chance(f64 p) { return Unit() < p; }
+
+    private:
+      std::mt19937 mGen;
+  };
+
+  const char Consonants[] = "bcdfghjklmnprstvwz", Vowels[] = "aeiou";
+
+  QString LatinWord(Rng &rng, bool capital)
+  {
+    QString ret;
+    for(i32 i = rng.Range(1, 3); i > 0; i--)
+    {
+      ret += Consonants[rng.Range(0, sizeof(Consonants) - 2)];
+      ret += Vowels[rng.Range(0, sizeof(Vowels) - 2)];
+      if(rng.Chance(0.3))
+        ret += Consonants[rng.Range(0, sizeof(Consonants) - 2)];
+    }
+    if(capital)
+      ret[0] = ret[0].toUpper();
+    return ret;
+  }
+
+  QString CjkWord(Rng &rng)
+  {
+    QString ret;
+    for(i32 i = rng.Range(1, 3); i > 0; i--)
+      ret += QChar(rng.Range(0x4E00, 0x62FF)); // The most common ideographs are in here
+    return ret;
+  }
+
+  QString RtlWord(Rng &rng, bool arabic)
+  {
+    QString ret;
+    for(i32 i = rng.Range(2, 7); i > 0; i--)
+      ret += QChar(arabic ? rng.Range(0x0628, 0x064A) : rng.Range(0x05D0, 0x05EA));
+    return ret;
+  }
+
+  QString CueText(Rng &rng, Script script, i32 words)
+  {
+    const bool arabic = script == Rtl && rng.Chance(0.5);
+    const QString space = script == Cjk ? QString() : QString(" "),
+                  comma = script == Cjk ? QString::fromUtf8("，") : arabic ? QString::fromUtf8("،") : QString(","),
+                  stop = script == Cjk ? QString::fromUtf8("。") : QString(".");
+    QString ret;
+    for(i32 i = 0; i < words; i++)
+    {
+      if(i)
+        ret += i == (words + 1) / 2 && words > 7 ? QString("\n") : space;
+      ret += script == Latin ? LatinWord(rng, i == 0) : script == Cjk ? CjkWord(rng) : RtlWord(rng, arabic);
+      if(i + 1 < words && rng.Chance(0.1))
+        ret += comma;
+    }
+    auto end = rng.Next() % 10;
+    ret += end < 7 ? stop : end < 9 ? QString(script == Cjk ? QString::fromUtf8("？") : arabic ? QString::fromUtf8("؟") : QString("?"))
+                                     : QString(script == Cjk ? QString::fromUtf8("！") : QString("!"));
+    return ret;
+  }
+
+  // Little endian, one sample
+  char *Put(char *at, i32 sample, Synth::SampleFormat format)
+  {
+    u32 v;
+    switch(format)
+    {
+      case Synth::U8:
+        *at = (char)((sample >> 8) + 128);
+        return at + 1;
+      case Synth::S16:
+        v = (u32)sample;
+        at[0] = (char)v; at[1] = (char)(v >> 8);
+        return at + 2;
+      case Synth::S24:
+        v = (u32)sample << 8;
+        at[0] = (char)v; at[1] = (char)(v >> 8); at[2] = (char)(v >> 16);
+        return at + 3;
+      case Synth::S32:
+        v = (u32)sample << 16;
+        break;
+      case Synth::F32:
+      {
+        f32 f = sample / 32768.0f; // Exact, every 16-bit value is a float
+        memcpy(&v, &f, 4);
+        break;
+      }
+    }
+    at[0] = (char)v; at[1] = (char)(v >> 8); at[2] = (char)(v >> 16); at[3] = (char)(v >> 24);
+    return at + 4;
+  }
+
+  void PutLE(QByteArray &out, u64 v, i32 bytes)
+  {
+    for(i32 i = 0; i < bytes; i++)
+      out.append((char)(v >> (8 * i)));
+  }
+}
+
+QVector<Synth::Cue> Synth::GenerateCues(const SrtSpec &spec)
+{
+  Rng rng(spec.seed);
+  QVector<Cue> ret;
+  ret.reserve(std::max(spec.cues, 0));
+  const f64 total = spec.latin + spec.cjk + spec.rtl;
+  u64 t = 1000;
+  for(i32 i = 0; i < spec.cues; i++)
+  {
+    auto pick = rng.Unit() * total;
+    auto script = pick < spec.latin || total <= 0 ? Latin : pick < spec.latin + spec.cjk ? Cjk : Rtl;
+    auto words = rng.Range(std::max(spec.minWords, 1), std::max(spec.maxWords, spec.minWords));
+    u64 duration = std::max(700, words * 300 + rng.Range(0, 1000));
+
+    u64 begin = t;
+    if(!ret.isEmpty())
+    {
+      auto &prev = ret.last();
+      if(rng.Chance(spec.overlapRate))
+        begin = std::max(prev.begin + 1, prev.end - rng.Range(1, std::min<i32>((prev.end - prev.begin) / 2, 1000)));
+      else if(rng.Chance(spec.gapRate))
+        begin = prev.end + rng.Range(1, std::max<i32>(spec.maxGapMs, 1));
+      else
+        begin = prev.end + rng.Range(0, 120);
+    }
+    ret.append(Cue { begin, begin + duration, CueText(rng, script, words) });
+    t = begin + duration;
+  }
+  return ret;
+}
+
+QByteArray Synth::FormatSrt(const QVector<Cue> &cues)
+{
+  SrtWriter w(cues.size());
+  for(auto &i : cues)
+  {
+    Dialog d { };
+    d.begin = i.begin;
+    d.duration = i.end - i.begin;
+    d.words.append(DiscreteWord { .text = i.text, .delim = '\0' });
+    w.Append(d);
+  }
+  return w.Data();
+}
+
+i32 Synth::BytesPerSample(SampleFormat format)
+{
+  static const i32 bytes[] = { 1, 2, 3, 4, 4 };
+  return bytes[format];
+}
+
+static u64 DataBytes(const Synth::WavSpec &spec)
+{
+  return spec.frames * spec.channels * Synth::BytesPerSample(spec.format);
+}
+
+bool Synth::IsRf64(const WavSpec &spec)
+{
+  return spec.forceRf64 || DataBytes(spec) > 0xFFFFFFFFull - 36 - 1;
+}
+
+u64 Synth::WavBytes(const WavSpec &spec)
+{
+  auto data = DataBytes(spec);
+  return (IsRf64(spec) ? 12 + 36 : 12) + 24 + 8 + data + (data & 1);
+}
+
+bool Synth::WriteWav(QIODevice *dev, const WavSpec &spec, const QVector<Cue> &speech)
+{
+  if(spec.channels <= 0 || spec.sampleRate <= 0)
+    return false;
+  const i32 bytesPerSample = BytesPerSample(spec.format), frameBytes = bytesPerSample * spec.channels;
+  const u64 data = DataBytes(spec), total = WavBytes(spec);
+  const bool rf64 = IsRf64(spec);
+
+  QByteArray header;
+  header.append(rf64 ? "RF64" : "RIFF", 4);
+  PutLE(header, rf64 ? 0xFFFFFFFFu : total - 8, 4);
+  header.append("WAVE", 4);
+  if(rf64)
+  {
+    // Real sizes go in here, the 32-bit ones say to look
+    header.append("ds64", 4);
+    PutLE(header, 28, 4);
+    PutLE(header, total - 8, 8);
+    PutLE(header, data, 8);
+    PutLE(header, spec.frames, 8);
+    PutLE(header, 0, 4);
+  }
+  header.append("fmt ", 4);
+  PutLE(header, 16, 4);
+  PutLE(header, spec.format == F32 ? 3 : 1, 2);
+  PutLE(header, spec.channels, 2);
+  PutLE(header, spec.sampleRate, 4);
+  PutLE(header, (u64)spec.sampleRate * frameBytes, 4);
+  PutLE(header, frameBytes, 2);
+  PutLE(header, bytesPerSample * 8, 2);
+  header.append("data", 4);
+  PutLE(header, rf64 ? 0xFFFFFFFFu : data, 4);
+  if(dev->write(header) != header.size())
+    return false;
+
+  // Cues overlap, so track the latest end among those begun
+  Rng rng(spec.seed);
+  i32 next = 0;
+  u64 speechEnd = 0;
+  QByteArray block;
+  static constexpr u64 BlockFrames = 1 << 16;
+  for(u64 frame = 0; frame < spec.frames; frame += BlockFrames)
+  {
+    auto count = std::min(BlockFrames, spec.frames - frame);
+    block.resize(count * frameBytes);
+    auto at = block.data();
+    for(u64 f = frame; f < frame + count; f++)
+    {
+      auto ms = f * 1000 / spec.sampleRate;
+      while(next < speech.size() && speech[next].begin <= ms)
+        speechEnd = std::max(speechEnd, speech[next++].end);
+      i32 amp = 300;
+      if(speech.isEmpty() || ms < speechEnd)
+      {
+        // Syllables at 4 per second, a triangle between 4000 and 24000
+        u32 phase = (u32)(f * 4 * 131072 / spec.sampleRate) & 0x1FFFF,
+            tri = phase < 65536 ? phase : 131071 - phase;
+        amp = 4000 + (i32)(tri * 20000 / 65535);
+      }
+      for(i32 c = 0; c < spec.channels; c++)
+      {
+        i32 noise = (i32)(rng.Next() >> 16) - 32768;
+        at = Put(at, noise * amp / 32768, spec.format);
+      }
+    }
+    if(dev->write(block) != block.size())
+      return false;
+  }
+  if(data & 1)
+    return dev->write("\0", 1) == 1;
+  return true;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <QByteArray>
+#include <QIODevice>
+#include <QString>
+#include <QVector>
+#include <rint.h>
+
+/// Generators for SRT and WAV files that look like production material, for benchmarks and
+/// scale tests.
+///
+/// A seed gives the same bytes everywhere: only the raw std::mt19937 stream is used, which the
+/// standard pins down (the std distributions are not), and the samples are made with integer
+/// arithmetic.
+namespace Synth
+{
+  enum Script : u8 { Latin, Cjk, Rtl };
+
+  struct SrtSpec
+  {
+    i32 cues;
+    i32 minWords, maxWords;
+    f64 latin, cjk, rtl; ///< Relative weight of each script, every cue is in one of them
+    f64 overlapRate;     ///< Share of cues beginning before the one before them ends
+    f64 gapRate;         ///< Share of cues after a pause of up to maxGapMs, the rest follow closely
+    u64 maxGapMs;
+    u32 seed;
+
+    static SrtSpec Default() { return SrtSpec { 1000, 2, 14, 0.85, 0.1, 0.05, 0.02, 0.15, 5000, 1 }; }
+  };
+
+  struct Cue
+  {
+    u64 begin, end;
+    QString text; ///< Longer cues are on two lines
+  };
+
+  QVector<Cue> GenerateCues(const SrtSpec &spec); ///< Sorted by begin
+  QByteArray FormatSrt(const QVector<Cue> &cues);
+
+  enum SampleFormat : u8 { U8, S16, S24, S32, F32 };
+
+  struct WavSpec
+  {
+    u64 frames;
+    i32 sampleRate, channels;
+    SampleFormat format;
+    bool forceRf64; ///< RF64 is used anyway once the data passes 4 GiB
+    u32 seed;
+  };
+
+  i32 BytesPerSample(SampleFormat format);
+  u64 WavBytes(const WavSpec &spec); ///< Size of the whole file WriteWav() makes
+  bool IsRf64(const WavSpec &spec);
+
+  /// Noise shaped like speech while a cue is on and quiet noise otherwise, speech throughout if
+  /// there are no cues. Written in blocks, any size works.
+  bool WriteWav(QIODevice *dev, const WavSpec &spec, const QVector<Cue> &speech);
+}
@@ -0,0 +1,325 @@
+#include <journal.h>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QUndoStack>
+#include <commands.h>
+#include <dialogseq.h>
+
+static const char Magic[4] = { 'L', 'R', 'J', 1 };
+
+Journal::Journal() : mRecords(0), mKnownBegin(0), mKnownEnd(0), mMacroDepth(0), mClean(false), mFailed(false) { }
+
+Journal::~Journal()
+{
+  if(IsActive() && mClean)
+    Stop();
+}
+
+bool Journal::Start(const QString &srtName, const QUndoStack &undo, const DialogSeq *model)
+{
+  // Logs with edits in them are left behind for another file, they may never have been saved
+  if(IsActive() && mClean)
+    Stop();
+  mSrtName = srtName;
+  mMacroDepth = 0;
+  if(model)
+  {
+    Checkpoint(undo, *model);
+    // The caller reports this one itself
+    mFailed = false;
+    return IsActive();
+  }
+  mRecords = 0;
+  mKnownBegin = mKnownEnd = undo.index();
+  mClean = true;
+  return Rewrite(RecBase, Fingerprint(srtName));
+}
+
+bool Journal::TakeFailure()
+{
+  bool ret = mFailed;
+  mFailed = false;
+  return ret;
+}
+
+void Journal::Stop()
+{
+  mFile.close();
+  if(!mSrtName.isEmpty())
+    QFile::remove(PathFor(mSrtName));
+  mSrtName.clear();
+}
+
+QByteArray Journal::Encode(const LRCmd::CmdBase *cmd)
+{
+  QByteArray ret;
+  QDataStream s(&ret, QIODevice::WriteOnly);
+  cmd->Write(s);
+  return ret;
+}
+
+void Journal::RecordPush(const QByteArray &cmd, i32 indexBefore, const QUndoStack &undo, const DialogSeq &model)
+{
+  if(!IsActive())
+    return;
+  if(mMacroDepth > 0)
+  {
+    Append(RecPush, cmd);
+    return;
+  }
+  Append(RecPush, cmd);
+  // Merged into a command from before the log started. A replay pushes it on its own, which
+  // leaves the model the same but not the command, so undoing it must still checkpoint.
+  if(undo.index() <= indexBefore && indexBefore - 1 < mKnownBegin)
+    mKnownBegin = undo.index();
+  mKnownEnd = undo.index();
+  CheckpointIfDue(undo, model);
+}
+
+void Journal::RecordUndo(const QUndoStack &undo, const DialogSeq &model)
+{
+  if(!IsActive())
+    return;
+  if(undo.index() < mKnownBegin)
+    return Checkpoint(undo, model);
+  Append(RecUndo);
+  CheckpointIfDue(undo, model);
+}
+
+void Journal::RecordRedo(const QUndoStack &undo, const DialogSeq &model)
+{
+  if(!IsActive())
+    return;
+  if(undo.index() - 1 < mKnownBegin || undo.index() > mKnownEnd)
+    return Checkpoint(undo, model);
+  Append(RecRedo);
+  CheckpointIfDue(undo, model);
+}
+
+void Journal::RecordBeginMacro(const QString &text)
+{
+  if(!IsActive())
+    return;
+  QByteArray payload;
+  QDataStream s(&payload, QIODevice::WriteOnly);
+  s << text;
+  Append(RecBeginMacro, payload);
+  mMacroDepth++;
+}
+
+void Journal::RecordEndMacro(const QUndoStack &undo, const DialogSeq &model)
+{
+  if(!IsActive())
+    return;
+  Append(RecEndMacro);
+  if(--mMacroDepth == 0)
+  {
+    mKnownEnd = undo.index();
+    CheckpointIfDue(undo, model);
+  }
+}
+
+bool Journal::HasRecoverable(const QString &srtName)
+{
+  QFile f;
+  u8 kind;
+  QByteArray payload;
+  if(!OpenForReading(f, srtName, kind, payload))
+    return false;
+  return kind == RecCheckpoint || ReadFrame(f, kind, payload);
+}
+
+i32 Journal::Replay(const QString &srtName, DialogSeq &model, QUndoStack &undo)
+{
+  QFile f;
+  u8 kind;
+  QByteArray payload;
+  if(!OpenForReading(f, srtName, kind, payload))
+    return -1;
+
+  undo.clear();
+  i32 edits = 0, depth = 0;
+  bool ok = true;
+  do
+  {
+    QDataStream s(payload);
+    switch(kind)
+    {
+      case RecBase:
+        break;
+
+      case RecCheckpoint:
+      {
+        i32 count;
+        s >> count;
+        QVector<Dialog> loaded(std::max(count, 0));
+        for(auto &d : loaded)
+          s >> d;
+        if(s.status() != QDataStream::Ok)
+          return -1;
+        model.clear();
+        for(auto &d : loaded)
+          model.append(d);
+        break;
+      }
+
+      case RecPush:
+        if(auto cmd = LRCmd::CmdBase::Read(s, model))
+        {
+          undo.push(cmd);
+          edits++;
+        }
+        else
+          ok = false;
+        break;
+
+      case RecUndo:
+        undo.undo();
+        edits++;
+        break;
+
+      case RecRedo:
+        undo.redo();
+        edits++;
+        break;
+
+      case RecBeginMacro:
+      {
+        QString text;
+        s >> text;
+        undo.beginMacro(text);
+        depth++;
+        break;
+      }
+
+      case RecEndMacro:
+        if(depth > 0)
+        {
+          undo.endMacro();
+          depth--;
+        }
+        break;
+
+      default:
+        ok = false;
+    }
+  } while(ok && ReadFrame(f, kind, payload));
+
+  // Crashed in the middle of a macro, keep what made it into the log
+  while(depth-- > 0)
+    undo.endMacro();
+  return edits;
+}
+
+void Journal::Append(RecordKind kind, const QByteArray &payload)
+{
+  // No fsync, the OS has it once write() returns, which is enough to survive the app crashing
+  auto frame = Frame(kind, payload);
+  if(mFile.write(frame) != frame.size() || !mFile.flush())
+    return Fail();
+  mRecords++;
+  mClean = false;
+}
+
+void Journal::Checkpoint(const QUndoStack &undo, const DialogSeq &model)
+{
+  mRecords = 0;
+  mKnownBegin = mKnownEnd = undo.index();
+  mClean = false;
+  if(!Rewrite(RecCheckpoint, EncodeModel(model)))
+    Fail();
+}
+
+void Journal::CheckpointIfDue(const QUndoStack &undo, const DialogSeq &model)
+{
+  if(IsActive() && mRecords >= CheckpointInterval && mMacroDepth == 0)
+    Checkpoint(undo, model);
+}
+
+bool Journal::Rewrite(RecordKind kind, const QByteArray &payload)
+{
+  // Replace the log atomically, the old one stays valid until the new one is complete
+  mFile.close();
+  QSaveFile f(PathFor(mSrtName));
+  if(!f.open(QIODevice::WriteOnly))
+    return false;
+  f.write(Magic, sizeof(Magic));
+  f.write(Frame(kind, payload));
+  if(!f.commit())
+    return false;
+  mFile.setFileName(PathFor(mSrtName));
+  return mFile.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+void Journal::Fail()
+{
+  // A torn frame at the end is dropped on replay, so the log stays good up to the last edit
+  // written in full
+  mFile.close();
+  mFailed = true;
+}
+
+QByteArray Journal::Fingerprint(const QString &srtName)
+{
+  QFileInfo fi(srtName);
+  QByteArray ret;
+  QDataStream s(&ret, QIODevice::WriteOnly);
+  s << (qint64)fi.size() << (qint64)fi.lastModified().toMSecsSinceEpoch();
+  return ret;
+}
+
+QByteArray Journal::EncodeModel(const DialogSeq &model)
+{
+  QByteArray ret;
+  QDataStream s(&ret, QIODevice::WriteOnly);
+  s << model.size();
+  for(const auto &d : model)
+    s << d;
+  return ret;
+}
+
+QByteArray Journal::Frame(RecordKind kind, const QByteArray &payload)
+{
+  // [u32 size][u8 kind][payload][u16 checksum of kind and payload]
+  QByteArray body;
+  body.reserve(payload.size() + 1);
+  body.append((char)kind);
+  body.append(payload);
+  QByteArray ret;
+  QDataStream s(&ret, QIODevice::WriteOnly);
+  s << (quint32)body.size();
+  s.writeRawData(body.constData(), body.size());
+  s << qChecksum(body.constData(), body.size());
+  return ret;
+}
+
+bool Journal::ReadFrame(QFile &f, u8 &kind, QByteArray &payload)
+{
+  QDataStream s(&f);
+  quint32 size;
+  quint16 checksum;
+  s >> size;
+  if(s.status() != QDataStream::Ok || size == 0 || size > f.bytesAvailable())
+    return false;
+  auto body = f.read(size);
+  s >> checksum;
+  if(s.status() != QDataStream::Ok || (u32)body.size() != size ||
+     checksum != qChecksum(body.constData(), body.size()))
+    return false;
+  kind = body[0];
+  payload = body.mid(1);
+  return true;
+}
+
+bool Journal::OpenForReading(QFile &f, const QString &srtName, u8 &kind, QByteArray &payload)
+{
+  f.setFileName(PathFor(srtName));
+  if(!f.open(QIODevice::ReadOnly) || f.read(sizeof(Magic)) != QByteArray(Magic, sizeof(Magic)))
+    return false;
+  if(!ReadFrame(f, kind, payload))
+    return false;
+  // A log that starts from the file only applies to that exact file
+  return kind == RecCheckpoint || (kind == RecBase && payload == Fingerprint(srtName));
+}
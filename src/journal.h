@@ -0,0 +1,85 @@
+#pragma once
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+#include <rint.h>
+
+class QUndoStack;
+class DialogSeq;
+namespace LRCmd { class CmdBase; }
+
+/// Append-only log of the edits made since the SRT file was written, kept next to it as
+/// <name>.lrj so that a crash loses nothing.
+///
+/// A log starts from either the SRT file itself (recognized by its size and mtime) or a
+/// checkpoint holding the whole model, followed by one small record per undo stack change.
+/// Every record is length prefixed and checksummed, a torn write at the end is dropped on replay.
+/// Every CheckpointInterval records the log is rewritten as a single checkpoint.
+class Journal
+{
+  public:
+    Journal();
+    ~Journal(); ///< Removes the log if nothing happened since it was started from the file
+
+    static QString PathFor(const QString &srtName) { return srtName + ".lrj"; }
+
+    /// Start a new log for srtName, replacing any old one. Without a model the log starts
+    /// from the file itself, which must then match the model as it is now.
+    bool Start(const QString &srtName, const QUndoStack &undo, const DialogSeq *model = nullptr);
+    void Stop(); ///< Close and remove the log
+    bool IsActive() const { return mFile.isOpen(); }
+    /// Whether a failed write has stopped the log since the last call, the edits up to it stay
+    /// in the log but nothing after is recorded
+    bool TakeFailure();
+
+    /// Serialize a command before it is pushed, the undo stack may delete it when merging
+    static QByteArray Encode(const LRCmd::CmdBase *cmd);
+
+    // Call these right after the undo stack has changed
+    void RecordPush(const QByteArray &cmd, i32 indexBefore, const QUndoStack &undo, const DialogSeq &model);
+    void RecordUndo(const QUndoStack &undo, const DialogSeq &model);
+    void RecordRedo(const QUndoStack &undo, const DialogSeq &model);
+    void RecordBeginMacro(const QString &text);
+    void RecordEndMacro(const QUndoStack &undo, const DialogSeq &model);
+
+    /// Whether srtName has edits left over in a log that still applies to it
+    static bool HasRecoverable(const QString &srtName);
+    /// Replay a left-over log onto a model just loaded from srtName, rebuilding the undo stack.
+    /// Returns the number of records applied, or -1 if the log does not apply to the file.
+    static i32 Replay(const QString &srtName, DialogSeq &model, QUndoStack &undo);
+
+  private:
+    enum RecordKind : u8
+    {
+      RecBase = 1,    ///< Size and mtime of the SRT file the log starts from
+      RecCheckpoint,  ///< Whole model, the log starts from here
+      RecPush,
+      RecUndo,
+      RecRedo,
+      RecBeginMacro,
+      RecEndMacro
+    };
+
+    void Append(RecordKind kind, const QByteArray &payload = QByteArray());
+    void Checkpoint(const QUndoStack &undo, const DialogSeq &model);
+    void CheckpointIfDue(const QUndoStack &undo, const DialogSeq &model);
+    bool Rewrite(RecordKind kind, const QByteArray &payload);
+    void Fail();
+
+    static QByteArray Fingerprint(const QString &srtName);
+    static QByteArray EncodeModel(const DialogSeq &model);
+    static QByteArray Frame(RecordKind kind, const QByteArray &payload);
+    static bool ReadFrame(QFile &f, u8 &kind, QByteArray &payload);
+    static bool OpenForReading(QFile &f, const QString &srtName, u8 &kind, QByteArray &payload);
+
+    QFile mFile;
+    QString mSrtName;
+    i32 mRecords; ///< Since the last checkpoint
+    i32 mKnownBegin, mKnownEnd; ///< Undo stack entries a replay of the log can rebuild
+    i32 mMacroDepth;
+    bool mClean; ///< Started from the file and nothing recorded since
+    bool mFailed;
+
+    static constexpr i32 CheckpointInterval = 2000;
+};
@@ -1,6 +1,10 @@
 #include "mainwindow.h"
 #include "./ui_mainwindow.h"
+#include "replacedialog.h"
+#include "timestretch.h"
 #include <QFileDialog>
+#include <QInputDialog>
+#include <QLineEdit>
 #include <QAudioDeviceInfo>
 
 MainWindow::MainWindow(QWidget *parent)
@@ -35,6 +39,19 @@ void MainWindow::InitUi()
   ui->statusbar->addWidget(mNotif);
   connect(ui->reorg, &Reorganizer::SendNotify,
           mNotif, &StatusNotify::Activate);
+  mHistoryUsage = new QLabel;
+  ui->statusbar->addPermanentWidget(mHistoryUsage);
+  connect(ui->reorg, &Reorganizer::HistoryUsage,
+          this, &MainWindow::UpdateHistoryUsage);
+  mSpeed = new QDoubleSpinBox;
+  mSpeed->setRange(TimeStretch::MinSpeed, TimeStretch::MaxSpeed);
+  mSpeed->setSingleStep(0.1);
+  mSpeed->setValue(1.0);
+  mSpeed->setSuffix(tr("x"));
+  mSpeed->setToolTip(tr("Playback speed, the pitch stays"));
+  ui->statusbar->addPermanentWidget(mSpeed);
+  connect(mSpeed, QOverload<double>::of(&QDoubleSpinBox::valueChanged),
+          ui->reorg, &Reorganizer::SetPlaybackSpeed);
 
   ui->widNewDialog->setVisible(false);
 }
@@ -62,9 +79,9 @@ void MainWindow::on_btnSaveSrt_clicked()
 void MainWindow::on_btnLoadWav_clicked()
 {
   auto f = QFileDialog::getOpenFileName(this,
-                                        tr("Open WAV file"),
+                                        tr("Open audio file"),
                                         qApp->applicationDirPath(),
-                                        tr("Wave file (*.wav);;All files (*.*)"));
+                                        tr("Audio file (*.wav *.flac);;All files (*.*)"));
   ui->reorg->OpenWave(f);
 }
 
@@ -74,3 +91,115 @@ void MainWindow::on_actInsertDialog_triggered()
 
 }
 
+void MainWindow::on_actShiftTiming_triggered()
+{
+  bool ok;
+  auto ms = QInputDialog::getInt(this,
+                                 tr("Shift timing"),
+                                 tr("Shift the active line and all lines after it by (ms):"),
+                                 0, -36000000, 36000000, 100, &ok);
+  if(ok && ms)
+    ui->reorg->ShiftTiming(ms);
+}
+
+void MainWindow::on_actStretchTiming_triggered()
+{
+  bool ok;
+  auto factor = QInputDialog::getDouble(this,
+                                        tr("Stretch timing"),
+                                        tr("Stretch the active line and all lines after it by factor\n"
+                                           "(e.g. 25 / 23.976 = 1.042709 for frame rate conversion):"),
+                                        1.0, 0.01, 100.0, 6, &ok);
+  if(ok && factor != 1.0)
+    ui->reorg->StretchTiming(factor);
+}
+
+void MainWindow::on_actRebalanceLines_triggered()
+{
+  ui->reorg->RebalanceLines(true);
+}
+
+void MainWindow::on_actRebalanceActive_triggered()
+{
+  ui->reorg->RebalanceLines(false);
+}
+
+void MainWindow::on_actFind_triggered()
+{
+  bool ok;
+  auto text = QInputDialog::getText(this, tr("Find"), tr("Find text in all lines:"),
+                                    QLineEdit::Normal, mLastFind, &ok);
+  if(!ok || text.isEmpty())
+    return;
+  mLastFind = text;
+  ui->reorg->Find(text, ui->actFindWholeWords->isChecked());
+}
+
+void MainWindow::on_actFindNext_triggered()
+{
+  ui->reorg->FindNext();
+}
+
+void MainWindow::on_actFindPrev_triggered()
+{
+  ui->reorg->FindNext(true);
+}
+
+void MainWindow::on_actReplace_triggered()
+{
+  ReplaceDialog dlg(ui->reorg, mLastFind, this);
+  dlg.exec();
+  if(!dlg.FindText().isEmpty())
+    mLastFind = dlg.FindText();
+}
+
+void MainWindow::on_actPauseDetection_triggered()
+{
+  auto params = ui->reorg->AudioEnvelope().Params();
+  bool ok;
+  params.thresholdDb = QInputDialog::getDouble(this,
+                                               tr("Pause detection"),
+                                               tr("Audio quieter than this is a pause (dBFS):"),
+                                               params.thresholdDb, -90.0, 0.0, 1, &ok);
+  if(!ok)
+    return;
+  params.minLengthMs = QInputDialog::getInt(this,
+                                            tr("Pause detection"),
+                                            tr("Shortest pause (ms):"),
+                                            params.minLengthMs, 0, 10000, 10, &ok);
+  if(ok)
+    ui->reorg->SetSilenceParams(params);
+}
+
+void MainWindow::on_actWordList_triggered()
+{
+  auto f = QFileDialog::getOpenFileName(this,
+                                        tr("Open word list"),
+                                        qApp->applicationDirPath(),
+                                        tr("Word list (*.txt *.dic);;All files (*.*)"));
+  if(!f.isEmpty())
+    ui->reorg->LoadWordList(f);
+}
+
+void MainWindow::on_actShowSpectrogram_toggled(bool checked)
+{
+  ui->reorg->SetSpectrogramVisible(checked);
+}
+
+void MainWindow::on_actCompactAudio_toggled(bool checked)
+{
+  ui->reorg->SetCompactAudio(checked);
+}
+
+void MainWindow::on_actFollowPlayhead_toggled(bool checked)
+{
+  ui->reorg->SetFollowPlayhead(checked);
+}
+
+void MainWindow::UpdateHistoryUsage(qint64 inMemory, qint64 onDisk)
+{
+  auto text = tr("Undo history: %1").arg(locale().formattedDataSize(inMemory));
+  if(onDisk)
+    text += tr(" (%1 on disk)").arg(locale().formattedDataSize(onDisk));
+  mHistoryUsage->setText(text);
+}
@@ -2,6 +2,8 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QDoubleSpinBox>
+#include <QLabel>
 #include "statusnotify.h"
 
 QT_BEGIN_NAMESPACE
@@ -30,9 +32,27 @@ class MainWindow : public QMainWindow
     void on_btnLoadWav_clicked();
 
     void on_actInsertDialog_triggered();
+    void on_actShiftTiming_triggered();
+    void on_actStretchTiming_triggered();
+    void on_actRebalanceLines_triggered();
+    void on_actRebalanceActive_triggered();
+    void on_actFind_triggered();
+    void on_actFindNext_triggered();
+    void on_actFindPrev_triggered();
+    void on_actReplace_triggered();
+    void on_actPauseDetection_triggered();
+    void on_actWordList_triggered();
+    void on_actShowSpectrogram_toggled(bool checked);
+    void on_actCompactAudio_toggled(bool checked);
+    void on_actFollowPlayhead_toggled(bool checked);
+
+    void UpdateHistoryUsage(qint64 inMemory, qint64 onDisk);
 
   private:
     Ui::MainWindow *ui;
     StatusNotify *mNotif;
+    QLabel *mHistoryUsage;
+    QDoubleSpinBox *mSpeed;
+    QString mLastFind;
 };
 #endif // MAINWINDOW_H
@@ -0,0 +1,60 @@
+#include <peaks.h>
+#include <algorithm>
+#include <math.h>
+
+Peak Peak::Quantize(f32 min, f32 max)
+{
+  auto q = [](f32 v) { return (i8)std::min(std::max(v, -127.0f), 127.0f); };
+  return Peak { q(floorf(min * 127.0f)), q(ceilf(max * 127.0f)) };
+}
+
+void PeakPyramid::Reset(i64 frames)
+{
+  mLevels.clear();
+  mLevels.append(QVector<Peak>((frames + BucketFrames - 1) / BucketFrames, Peak { 0, 0 }));
+}
+
+void PeakPyramid::Build()
+{
+  if(mLevels.isEmpty())
+    return;
+  mLevels.resize(1);
+  while(mLevels.last().size() > 1)
+  {
+    const auto &below = mLevels.last();
+    QVector<Peak> level((below.size() + 1) / 2);
+    for(i32 i = 0; i < level.size(); i++)
+    {
+      auto a = below[2 * i], b = 2 * i + 1 < below.size() ? below[2 * i + 1] : a;
+      level[i] = Peak { std::min(a.min, b.min), std::max(a.max, b.max) };
+    }
+    mLevels.append(std::move(level));
+  }
+}
+
+QPair<f32, f32> PeakPyramid::Range(i64 begin, i64 end) const
+{
+  const i64 buckets = Buckets();
+  i64 first = std::max<i64>(begin, 0) / BucketFrames, last = std::min((end + BucketFrames - 1) / BucketFrames, buckets);
+  i8 min = 0, max = 0;
+  while(first < last)
+  {
+    // The biggest aligned run that starts here and stays in range
+    i32 level = 0;
+    while(level + 1 < mLevels.size() && !(first & ((2ll << level) - 1)) && first + (2ll << level) <= last)
+      level++;
+    auto &p = mLevels[level][first >> level];
+    min = std::min(min, p.min);
+    max = std::max(max, p.max);
+    first += 1ll << level;
+  }
+  return qMakePair(max / 127.0f, min / 127.0f);
+}
+
+i64 PeakPyramid::Bytes() const
+{
+  i64 ret = 0;
+  for(auto &i : mLevels)
+    ret += i.size() * sizeof(Peak);
+  return ret;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <QPair>
+#include <QVector>
+#include <rint.h>
+
+/// Lowest and highest sample of a stretch, in 127ths of full scale
+struct Peak
+{
+  i8 min, max;
+
+  static Peak Quantize(f32 min, f32 max); ///< Rounded outwards, so nothing is clipped
+};
+
+/// Peaks of all channels over every BucketFrames frames, and of every two of those above them
+/// up to one for the whole audio. About 4 bytes per 256 frames, whatever the sample format.
+///
+/// A range is answered from the few aligned power-of-two runs of buckets that cover it exactly,
+/// O(log n) entries for any zoom.
+class PeakPyramid
+{
+  public:
+    static constexpr i32 BucketFrames = 256;
+
+    void clear() { mLevels.clear(); }
+    bool isEmpty() const { return mLevels.isEmpty(); }
+
+    void Reset(i64 frames); ///< Silent buckets for that many frames, no levels above
+    i64 Buckets() const { return mLevels.isEmpty() ? 0 : mLevels[0].size(); }
+    Peak *Base() { return mLevels[0].data(); } ///< Filled in before Build()
+    void Build();
+
+    /// Highest and lowest sample in frames [begin, end), widened to whole buckets
+    QPair<f32, f32> Range(i64 begin, i64 end) const;
+
+    i64 Bytes() const;
+
+  private:
+    QVector<QVector<Peak>> mLevels;
+};
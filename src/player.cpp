@@ -0,0 +1,216 @@
+#include <player.h>
+#include <QAudioDeviceInfo>
+#include <qendian.h>
+#include <algorithm>
+#include <atomic>
+
+/// What the output pulls from, on whatever thread it runs its callback on
+class Player::Stream : public QIODevice
+{
+  public:
+    static constexpr i32 BlockFrames = 1024;
+
+    Stream(i32 channels, i32 sampleRate, i32 deviceChannels, QObject *parent) :
+      QIODevice(parent), mRing(channels, sampleRate), mStretch(channels, sampleRate),
+      mChannels(std::max(channels, 1)), mDeviceChannels(deviceChannels), mBlock(BlockFrames * mChannels),
+      mDrained(false), mPadded(0)
+    {
+
+    }
+
+    SampleRing &Ring() { return mRing; }
+    TimeStretch &Stretch() { return mStretch; }
+    bool Drained() const { return mDrained.load(std::memory_order_acquire); } ///< From any thread
+    i64 Padded() const { return mPadded.load(std::memory_order_relaxed); } ///< Frames of silence put in
+
+    bool isSequential() const override { return true; }
+    qint64 bytesAvailable() const override
+    {
+      return (Drained() ? 0 : BlockFrames * mDeviceChannels * 2) + QIODevice::bytesAvailable();
+    }
+
+  protected:
+    qint64 readData(char *data, qint64 maxlen) override
+    {
+      const i64 frames = maxlen / (mDeviceChannels * 2);
+      i64 done = 0;
+      while(done < frames)
+      {
+        const i32 want = std::min<i64>(frames - done, BlockFrames);
+        i32 got = mStretch.Process(mRing, mBlock.data(), want);
+        if(!got)
+        {
+          if(mStretch.Done())
+          {
+            mDrained.store(true, std::memory_order_release);
+            break;
+          }
+          // The feed is late, keep time with silence rather than let the output stall
+          std::fill(mBlock.begin(), mBlock.begin() + want * mChannels, 0.0f);
+          got = want;
+          mPadded.fetch_add(got, std::memory_order_relaxed);
+        }
+        Convert(got, data + done * mDeviceChannels * 2);
+        done += got;
+      }
+      return done * mDeviceChannels * 2;
+    }
+
+    qint64 writeData(const char *, qint64) override { return -1; }
+
+  private:
+    // 16 bit, mixed down to every channel if the output has other channels than the audio
+    void Convert(i32 frames, char *out)
+    {
+      auto sample = [](f32 v) { return (qint16)(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f); };
+      if(mDeviceChannels == mChannels)
+      {
+        for(i32 i = 0; i < frames * mChannels; i++)
+          qToLittleEndian<qint16>(sample(mBlock[i]), out + i * 2);
+        return;
+      }
+      const f32 scale = 1.0f / mChannels;
+      for(i32 i = 0; i < frames; i++)
+      {
+        f32 sum = 0;
+        for(i32 c = 0; c < mChannels; c++)
+          sum += mBlock[i * mChannels + c];
+        const auto v = sample(sum * scale);
+        for(i32 c = 0; c < mDeviceChannels; c++, out += 2)
+          qToLittleEndian<qint16>(v, out);
+      }
+    }
+
+    SampleRing mRing;
+    TimeStretch mStretch;
+    const i32 mChannels, mDeviceChannels;
+    std::vector<f32> mBlock;
+    std::atomic<bool> mDrained;
+    std::atomic<i64> mPadded;
+};
+
+Player::Player(QObject *parent) : QObject(parent), mAudio(nullptr), mBegin(0), mNext(0), mEnd(0), mBytes(0), mChannels(1), mRate(0),
+  mFloat(false), mSpeed(1.0), mOut(nullptr), mStream(nullptr)
+{
+  mFeedTimer.setInterval(20);
+  connect(&mFeedTimer, &QTimer::timeout, this, &Player::Feed);
+}
+
+Player::~Player()
+{
+  Stop();
+}
+
+bool Player::Play(const WavDecoder *audio, i64 begin, i64 end)
+{
+  static constexpr i32 FeedFrames = 4096;
+
+  Stop();
+  auto &fmt = audio->Format();
+  begin = std::max<i64>(begin, 0);
+  end = std::min(end, audio->Frames());
+  if(begin >= end || fmt.sampleRate <= 0)
+    return true;
+
+  QAudioFormat format;
+  format.setSampleRate(fmt.sampleRate);
+  format.setChannelCount(fmt.channelCount);
+  format.setSampleSize(16);
+  format.setCodec("audio/pcm");
+  format.setByteOrder(QAudioFormat::LittleEndian);
+  format.setSampleType(QAudioFormat::SignedInt);
+  auto device = QAudioDeviceInfo::defaultOutputDevice();
+  if(!device.isFormatSupported(format))
+  {
+    // Other channels are mixed down, other rates and sample formats are not converted
+    auto nearest = device.nearestFormat(format);
+    if(nearest.sampleRate() != format.sampleRate() || nearest.sampleSize() != 16 ||
+       nearest.sampleType() != QAudioFormat::SignedInt || nearest.byteOrder() != QAudioFormat::LittleEndian ||
+       nearest.channelCount() < 1)
+      return false;
+    format = nearest;
+  }
+
+  mAudio = audio;
+  mBegin = mNext = begin;
+  mEnd = end;
+  mBytes = fmt.sampleSize / 8;
+  mFloat = fmt.sampleType == WavFormat::Float32;
+  mChannels = std::max(fmt.channelCount, 1);
+  mRate = fmt.sampleRate;
+  mFeedBuffer.resize(FeedFrames * mChannels);
+
+  mOut = new QAudioOutput(device, format, this);
+  mStream = new Stream(mChannels, fmt.sampleRate, format.channelCount(), mOut);
+  mStream->Stretch().SetSpeed(mSpeed);
+  mStream->open(QIODevice::ReadOnly);
+  connect(mOut, &QAudioOutput::stateChanged, this, &Player::StateChanged);
+
+  // A second ahead before it starts pulling
+  Feed();
+  mFeedTimer.start();
+  mOut->start(mStream);
+  return true;
+}
+
+void Player::Stop()
+{
+  mFeedTimer.stop();
+  if(!mOut)
+    return;
+  // Stopping emits the state again, and this may be called from there
+  mOut->disconnect(this);
+  mOut->stop();
+  mOut->deleteLater();
+  mOut = nullptr;
+  mStream = nullptr;
+  mAudio = nullptr;
+  emit Stopped();
+}
+
+i64 Player::Position() const
+{
+  if(!mOut)
+    return -1;
+  // What went out of the device, less the silence that kept time for a late feed, went through
+  // the stretcher
+  const i64 out = mOut->processedUSecs() * mRate / 1000000 - mStream->Padded();
+  const i64 frame = mBegin + mStream->Stretch().SourceFrame(std::max<i64>(out, 0));
+  return std::min(std::max(frame, mBegin), mEnd);
+}
+
+void Player::SetSpeed(f64 speed)
+{
+  const f64 lo = TimeStretch::MinSpeed, hi = TimeStretch::MaxSpeed;
+  mSpeed = std::min(std::max(speed, lo), hi);
+  if(mStream)
+    mStream->Stretch().SetSpeed(mSpeed);
+}
+
+void Player::Feed()
+{
+  if(!mStream)
+    return;
+  auto &ring = mStream->Ring();
+  while(mNext < mEnd)
+  {
+    const i64 n = std::min<i64>(std::min<i64>(ring.Writable(), mEnd - mNext), mFeedBuffer.size() / mChannels);
+    if(n <= 0)
+      return;
+    auto pcm = mAudio->ReadFrames(mNext, n);
+    auto s = reinterpret_cast<const u8*>(pcm.constData());
+    for(i64 i = 0; i < n * mChannels; i++, s += mBytes)
+      mFeedBuffer[i] = DecodeSample(s, mBytes, mFloat);
+    ring.Write(mFeedBuffer.data(), n);
+    mNext += n;
+  }
+  ring.Finish();
+  mFeedTimer.stop();
+}
+
+void Player::StateChanged(QAudio::State state)
+{
+  if((state == QAudio::IdleState && mStream->Drained()) ||
+     (state == QAudio::StoppedState && mOut->error() != QAudio::NoError))
+    Stop();
+}
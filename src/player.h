@@ -0,0 +1,58 @@
+#ifndef PLAYER_H
+#define PLAYER_H
+
+#include <QAudioOutput>
+#include <QIODevice>
+#include <QObject>
+#include <QTimer>
+#include <rint.h>
+#include <timestretch.h>
+#include <wavdecoder.h>
+
+/// Plays frames of the decoded audio on the default output, at 0.5x to 2x without changing the
+/// pitch.
+///
+/// The output pulls from a stream that runs TimeStretch over a SampleRing, so nothing it does
+/// locks or allocates. The ring is kept a second ahead from the decoder on the thread of the
+/// player, which is the only place the decoder is read or samples are paged in.
+class Player : public QObject
+{
+    Q_OBJECT
+
+  public:
+    explicit Player(QObject *parent = nullptr);
+    ~Player();
+
+    /// Stop and play frames [begin, end) of audio, which has to outlive the playback
+    /// @return false if the output cannot play its format
+    bool Play(const WavDecoder *audio, i64 begin, i64 end);
+    void Stop();
+    bool IsPlaying() const { return mOut != nullptr; }
+    /// Frame of the audio the output is playing now, from what it has processed. -1 if stopped.
+    i64 Position() const;
+
+    void SetSpeed(f64 speed); ///< Also while playing
+    f64 Speed() const { return mSpeed; }
+
+  signals:
+    void Stopped(); ///< At the end of the region, or when stopped
+
+  private:
+    class Stream;
+
+    void Feed();
+    void StateChanged(QAudio::State state);
+
+    const WavDecoder *mAudio;
+    i64 mBegin, mNext, mEnd; ///< First frame, next frame to feed, one past the last
+    i32 mBytes, mChannels, mRate;
+    bool mFloat;
+    std::vector<f32> mFeedBuffer;
+    f64 mSpeed;
+
+    QAudioOutput *mOut;
+    Stream *mStream; ///< Owned by mOut, both go when it stops
+    QTimer mFeedTimer;
+};
+
+#endif // PLAYER_H
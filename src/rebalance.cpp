@@ -0,0 +1,199 @@
+#include <rebalance.h>
+#include <QtConcurrent>
+#include <algorithm>
+#include <limits>
+#include <commands.h>
+
+namespace
+{
+  // Cost weights, a line exactly maxChars long costs Balance
+  constexpr f64
+    Balance = 10.0,
+    Overflow = 2.0,      ///< Per character over maxChars, squared
+    Speed = 1.0,         ///< Per character per second over maxCps, squared
+    ClauseBreak = 1.5,   ///< Breaking after a comma or the like, after a full stop is free
+    WordBreak = 4.0,     ///< Breaking anywhere else
+    Move = 0.2;          ///< Per word moved, keeps ties where they are
+
+  enum BreakClass : u8 { AfterSentence, AfterClause, AfterWord };
+
+  struct Segment
+  {
+    i32 first;
+    QVector<i32> counts, result;
+    QVector<f64> chars, ms; ///< Prefix sums over the words
+    QVector<u8> breaks;     ///< Per word, what breaking after it is like
+  };
+
+  BreakClass ClassOf(const QString &word)
+  {
+    if(word.isEmpty())
+      return AfterWord;
+    switch(word.at(word.size() - 1).unicode())
+    {
+      case '.': case '!': case '?': case 0x2026: case 0x3002: case 0xFF01: case 0xFF1F:
+        return AfterSentence;
+      case ',': case ';': case ':': case 0x3001: case 0xFF0C: case 0xFF1B: case 0xFF1A:
+        return AfterClause;
+    }
+    return AfterWord;
+  }
+
+  void Solve(Segment &seg, const ReflowLimits &limits)
+  {
+    static constexpr f64 Inf = std::numeric_limits<f64>::infinity();
+    const i32 lines = seg.counts.size(), words = seg.breaks.size(), width = 2 * MaxBreakShift + 1;
+    auto lineCost = [&seg, &limits](i32 p, i32 q) -> f64
+    {
+      auto c = seg.chars[q] - seg.chars[p] - 1, d = seg.ms[q] - seg.ms[p];
+      auto over = std::max(0.0, c - limits.maxChars);
+      auto cost = Balance * (c / limits.maxChars) * (c / limits.maxChars) + Overflow * over * over;
+      if(d > 0)
+      {
+        auto fast = std::max(0.0, c * 1000.0 / d - limits.maxCps);
+        cost += Speed * fast * fast;
+      }
+      return cost;
+    };
+    auto breakCost = [&seg](i32 q) -> f64
+    {
+      return seg.breaks[q - 1] == AfterSentence ? 0.0 : seg.breaks[q - 1] == AfterClause ? ClauseBreak : WordBreak;
+    };
+
+    // Boundary b (the first word of line b) may go anywhere in [lo[b], lo[b] + width) that
+    // leaves every line at least one word
+    QVector<i32> orig(lines + 1), lo(lines + 1);
+    for(i32 b = 0; b < lines; b++)
+      orig[b + 1] = orig[b] + seg.counts[b];
+    for(i32 b = 0; b <= lines; b++)
+      lo[b] = b == 0 || b == lines ? orig[b] : orig[b] - MaxBreakShift;
+    auto valid = [&](i32 b, i32 q) -> bool
+    {
+      if(b == 0 || b == lines)
+        return q == orig[b];
+      return q >= b && q <= words - (lines - b);
+    };
+
+    QVector<f64> cost(width * (lines + 1), Inf);
+    QVector<i32> from(width * (lines + 1), -1);
+    cost[orig[0] - lo[0]] = 0.0;
+    for(i32 b = 1; b <= lines; b++)
+    {
+      for(i32 j = 0; j < width; j++)
+      {
+        auto q = lo[b] + j;
+        if(!valid(b, q))
+          continue;
+        auto own = b < lines ? breakCost(q) + Move * std::abs(q - orig[b]) : 0.0;
+        for(i32 k = 0; k < width; k++)
+        {
+          auto p = lo[b - 1] + k, at = (b - 1) * width + k;
+          if(p >= q || cost[at] == Inf)
+            continue;
+          auto total = cost[at] + lineCost(p, q) + own;
+          if(total < cost[b * width + j])
+          {
+            cost[b * width + j] = total;
+            from[b * width + j] = k;
+          }
+        }
+      }
+    }
+
+    // Walk back from the end, which is where it was
+    seg.result.resize(lines);
+    i32 j = orig[lines] - lo[lines];
+    for(i32 b = lines; b > 0; b--)
+    {
+      auto k = from[b * width + j];
+      seg.result[b - 1] = lo[b] + j - (lo[b - 1] + k);
+      j = k;
+    }
+  }
+}
+
+QVector<LineBreakPlan> PlanLineBreaks(const DialogSnapshot &model, i32 from, i32 to, const ReflowLimits &limits)
+{
+  from = std::max(from, 0);
+  to = std::min(to, model.size());
+
+  // Gather the segments in one pass, a line without words ends one as well
+  QVector<Segment> segments;
+  Segment *seg = nullptr;
+  u64 lastEnd = 0;
+  auto it = model.IteratorAt(from);
+  for(i32 i = from; i < to; i++, ++it)
+  {
+    auto d = *it;
+    if(d.words.isEmpty())
+    {
+      seg = nullptr;
+      continue;
+    }
+    if(!seg || d.begin < lastEnd || d.begin - lastEnd > limits.maxMergeGapMs)
+    {
+      segments.append(Segment { .first = i });
+      seg = &segments.last();
+      seg->chars.append(0.0);
+      seg->ms.append(0.0);
+    }
+    auto share = (f64)d.duration / d.words.size();
+    for(auto &w : d.words)
+    {
+      seg->chars.append(seg->chars.last() + w.text.size() + 1);
+      seg->ms.append(seg->ms.last() + share);
+      seg->breaks.append(ClassOf(w.text));
+    }
+    seg->counts.append(d.words.size());
+    lastEnd = d.end();
+  }
+
+  // Only runs of two lines or more have anything to balance
+  segments.erase(std::remove_if(segments.begin(), segments.end(), [](const Segment &s)
+  {
+    return s.counts.size() < 2;
+  }), segments.end());
+  QtConcurrent::blockingMap(segments, [&limits](Segment &s)
+  {
+    Solve(s, limits);
+  });
+
+  QVector<LineBreakPlan> ret;
+  for(auto &s : segments)
+    if(s.result != s.counts)
+      ret.append(LineBreakPlan { .first = s.first, .wordCounts = s.result });
+  return ret;
+}
+
+i32 ApplyLineBreaks(DialogSeq &model, const QVector<LineBreakPlan> &plans,
+                    const std::function<void(LRCmd::CmdBase*)> &push)
+{
+  i32 changed = 0;
+  for(auto &plan : plans)
+  {
+    const i32 lines = plan.wordCounts.size();
+    if(plan.first < 0 || plan.first + lines > model.size())
+      continue;
+    QVector<i32> now(lines + 1), want(lines + 1);
+    for(i32 b = 0; b < lines; b++)
+    {
+      now[b + 1] = now[b] + model.at(plan.first + b).words.size();
+      want[b + 1] = want[b] + plan.wordCounts[b];
+    }
+    if(now[lines] != want[lines])
+      continue;
+
+    // Boundaries going right first, from the right, then those going left, from the left.
+    // The line each command takes from keeps at least one word that way, so none disappears.
+    for(i32 b = lines - 1; b > 0; b--)
+      if(want[b] > now[b])
+        push(new LRCmd::MergeToPrevLine(model, plan.first + b, want[b] - now[b] - 1, plan.first + b - 1));
+    for(i32 b = 1; b < lines; b++)
+      if(want[b] < now[b])
+        push(new LRCmd::MergeToNextLine(model, plan.first + b - 1, want[b] - want[b - 1], plan.first + b));
+
+    for(i32 b = 0; b < lines; b++)
+      changed += plan.wordCounts[b] != now[b + 1] - now[b];
+  }
+  return changed;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QVector>
+#include <functional>
+#include <dialogseq.h>
+#include <reflow.h>
+#include <rint.h>
+
+namespace LRCmd { class CmdBase; }
+
+static constexpr i32 MaxBreakShift = 8; ///< Farthest a boundary moves, in words
+
+/// New word counts for a run of adjacent lines starting at line first
+struct LineBreakPlan
+{
+  i32 first;
+  QVector<i32> wordCounts;
+};
+
+/// Move the word boundaries between adjacent lines in [from, to) so line length, reading speed
+/// and breaking at punctuation are balanced. The number of lines stays the same.
+///
+/// Lines further apart than limits.maxMergeGapMs make independent segments. Each is solved by
+/// dynamic programming over its words, in time linear in its length since a boundary moves at
+/// most MaxBreakShift words. Segments are solved in parallel. Time moves along with the words,
+/// the way the merge commands share it. Only segments that change are returned.
+QVector<LineBreakPlan> PlanLineBreaks(const DialogSnapshot &model, i32 from, i32 to, const ReflowLimits &limits);
+
+/// Carry out plans with MergeToPrevLine and MergeToNextLine. Every command is handed to push,
+/// which must redo it before returning, as QUndoStack::push does. Plans that no longer match
+/// the model are skipped. Returns how many lines changed.
+i32 ApplyLineBreaks(DialogSeq &model, const QVector<LineBreakPlan> &plans,
+                    const std::function<void(LRCmd::CmdBase*)> &push);
@@ -0,0 +1,67 @@
+#include <reflow.h>
+#include <commands.h>
+#include <stdlib.h>
+
+i32 CharCount(const Dialog &d)
+{
+  i32 ret = 0;
+  for(auto &i : d.words)
+    ret += i.text.size() + (i.delim.unicode() ? 1 : 0);
+  return ret;
+}
+
+static f64 Cps(const Dialog &d)
+{
+  return d.duration ? CharCount(d) * 1000.0 / d.duration : 1e9;
+}
+
+// Word to start the second half at, so both halves have about as many characters
+static i32 BalancedSplit(const Dialog &d)
+{
+  auto total = CharCount(d);
+  i32 left = 0, best = 1, bestDiff = total;
+  for(i32 k = 1; k < d.words.size(); k++)
+  {
+    auto &w = d.words[k - 1];
+    left += w.text.size() + (w.delim.unicode() ? 1 : 0);
+    auto diff = abs(2 * left - total);
+    if(diff < bestDiff)
+    {
+      bestDiff = diff;
+      best = k;
+    }
+  }
+  return best;
+}
+
+ReflowStats Reflow(DialogSeq &model, const ReflowLimits &limits)
+{
+  ReflowStats ret { 0, 0 };
+  i32 i = 0;
+  // Splitting only makes lines that fit better, merging only makes lines that fit, so this ends
+  while(i < model.size())
+  {
+    auto &d = model[i];
+    auto chars = CharCount(d);
+    if(d.words.size() > 1 && (chars > limits.maxChars || d.duration > limits.maxDurationMs))
+    {
+      LRCmd::SplitToNextLine(model, i, BalancedSplit(d)).redo();
+      ret.splits++;
+      continue;
+    }
+    if(i + 1 < model.size() && (d.duration < limits.minDurationMs || Cps(d) > limits.maxCps))
+    {
+      auto &next = model[i + 1];
+      if(next.begin >= d.end() && next.begin - d.end() <= limits.maxMergeGapMs &&
+         chars + 1 + CharCount(next) <= limits.maxChars &&
+         next.end() - d.begin <= limits.maxDurationMs)
+      {
+        LRCmd::MergeToNextLine(model, i, 0, i + 1).redo();
+        ret.merges++;
+        continue;
+      }
+    }
+    i++;
+  }
+  return ret;
+}
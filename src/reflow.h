@@ -0,0 +1,28 @@
+#pragma once
+
+#include <dialogseq.h>
+#include <rint.h>
+
+/// Limits for Reflow(), in characters, milliseconds and characters per second
+struct ReflowLimits
+{
+  i32 maxChars;
+  u64 minDurationMs, maxDurationMs;
+  f64 maxCps;
+  u64 maxMergeGapMs; ///< Lines further apart than this are never merged
+
+  static ReflowLimits Default() { return ReflowLimits { 42, 1000, 7000, 21.0, 500 }; }
+};
+
+struct ReflowStats
+{
+  i32 merges, splits;
+};
+
+/// Greedy pass with the editor's own commands. A line that is too long or lasts too long is
+/// split in two at the word that best balances the halves (SplitToNextLine). A line that is
+/// too short or too fast to read is merged into the next one (MergeToNextLine), when the
+/// result stays within the limits. Runs in linear time, nothing is pushed to an undo stack.
+ReflowStats Reflow(DialogSeq &model, const ReflowLimits &limits);
+
+i32 CharCount(const Dialog &d); ///< Characters as displayed, delimiters included
@@ -5,24 +5,31 @@
 #include <QTextCodec>
 #include <QApplication>
 #include <QStyleHints>
-#include <QAudioDeviceInfo>
+#include <QtConcurrent>
 #include <math.h>
 
 #include <QDebug>
 
 #include <signal.h>
 #include <util.h>
+#include <srtreader.h>
+#include <srtwriter.h>
+#include <rebalance.h>
+#include <replace.h>
+#include <timing.h>
+#include <wordsplit.h>
 #include "commands.h"
 #include "reorganizer.h"
 #include <QLineEdit>
 
 Reorganizer::Reorganizer(QWidget *parent) :
   QWidget(parent),
+  mWav(new WavDecoder(this)),
+  mMouseDownPos(),
   mDispFont("sansserif", 10),
   mDispFontMet(mDispFont),
-  mMouseDownPos(),
-  mWav(this),
-  mAudioOut(QAudioDeviceInfo::defaultOutputDevice())
+  mMeasurer(mDispFontMet, 2 * HorizMargin),
+  mSplitter(mMeasurer)
 {
   mCurrentActiveLine = mCurrentLongestLine = mCurrentLine = mCurrentOperatingLine = -1;
   mLongestLineWidth = 0.0;
@@ -34,15 +41,38 @@ Reorganizer::Reorganizer(QWidget *parent) :
   mDesiredDragOp = NoDrag;
   mMouseDownTime = QTime::currentTime();
   mExpectingDblClk = false;
-  mWaveformPlaying = mNleDragging = false;
+  mWaveformPlaying = mNleDragging = mShowSpectrogram = mCompactAudio = false;
 
   mNleRangeMsBegin = mNleRangeMsEnd = mNleMaximumLengthMs = 0;
+  mSaveVersion = 0;
+  mMacroDepth = mMacroIndexBefore = 0;
+  mModel.SetListener(&mSearch);
+  mSearchWholeWords = false;
+  mSearchPos = -1;
+  mSearchVersion = 0;
   mAudioPlayRegionA = mAudioPlayRegionB = -1;
+  mNleCurrentOp = NoNle;
+  mPlayheadX = -1;
+  mFollowPlayhead = false;
+  mWaveTileSpp = 0;
+  mSpectroMsBegin = mSpectroMsEnd = mSpectroWidth = 0;
 
   mEdit = new QLineEdit(this);
   mEdit->setFixedWidth(250);
   mEdit->setVisible(false); // Hidden by default
   connect(mEdit, &QLineEdit::returnPressed, this, &Reorganizer::EditBlockTextInSitu_Commit);
+
+  connect(&mSaveWatcher, &QFutureWatcher<QString>::finished, this, &Reorganizer::SaveFinished);
+  connect(&mSpectro, &Spectrogram::TileReady, this, &Reorganizer::UpdateNLEArea);
+  connect(&mPlayer, &Player::Stopped, this, [this]() {
+    mWaveformPlaying = false;
+    mPlayheadTimer.stop();
+    if(mPlayheadX >= 0)
+      update(PlayheadStrip(mPlayheadX));
+    mPlayheadX = -1;
+  });
+  mPlayheadTimer.setInterval(PlayheadInterval);
+  connect(&mPlayheadTimer, &QTimer::timeout, this, &Reorganizer::MovePlayhead);
 }
 
 void Reorganizer::SetScrollBars(QScrollBar *horiz, QScrollBar *vert, QScrollBar *nleHoriz)
@@ -81,67 +111,43 @@ void Reorganizer::OpenFile(QString name)
   mCurrentLine = mCurrentOperatingLine = -1;
   mModel.clear();
   mUndo.clear();
+  mBudget.Clear();
+  HistoryChanged();
   // Disable updates
   mDoUpdateScrollBarOnChange = false;
-  // Crappy SRT read routine
-  QTextStream ts(&f);
-  QString line, currtext;
-  bool lastLineEmpty = false;
-  int h1 = 0, m1 = 0, s1 = 0, ms1 = 0, h2 = 0, m2 = 0, s2 = 0, ms2 = 0;
-  ts.setCodec("UTF-8");
-  while(!ts.atEnd())
-  { // Assume input is completely sane
-    line = ts.readLine(); // Sequence number
-    line = ts.readLine(); // Timecode
-    sscanf(line.toStdString().c_str(),
-           "%d:%d:%d,%d --> %d:%d:%d,%d",
-           &h1, &m1, &s1, &ms1, &h2, &m2, &s2, &ms2);
-    currtext = ts.readLine();
-    while(!ts.atEnd())
-    {
-      if((line = ts.readLine()) == "")
-        break;
-      else
-        currtext += '\n' + line;
-    };
-
-    // Add it into internal data model
-    AppendToModel(TCtoMS(h1, m1, s1, ms1),
-                  TCtoMS(h2, m2, s2, ms2),
-                  currtext);
-
-    // Cleanup
-    lastLineEmpty = false;
-    currtext.clear();
-    h1 = 0, m1 = 0, s1 = 0, ms1 = 0, h2 = 0, m2 = 0, s2 = 0, ms2 = 0;
-  }
+  ReadSrt(&f, mSplitter, mModel);
   mDoUpdateScrollBarOnChange = true;
   UpdateExternals(true);
   mCurrentLine = mModel.size() - 1;
   mBarVert->setValue(mCurrentLine + 1);
   emit SendNotify(tr("Loaded %1 lines").arg(mModel.size()), 0);
   f.close();
+
+  // Whatever was logged for the previous file stays on disk, in case it was not saved
+  mFileName = name;
+  RecoverJournal();
 }
 
 void Reorganizer::SaveFile(QString name)
 {
-  QFile f(name);
-  f.open(QFile::WriteOnly);
-  if(f.error())
+  if(mSaveWatcher.isRunning())
   {
-    emit SendNotify(tr("Cannot save SRT file. Error: %1").arg(f.errorString()), 2);
+    emit SendNotify(tr("Still saving the last file, try again in a moment."), 1);
     return;
   }
-  QTextStream ts(&f);
-  i32 count = 1;
-  for(auto &i : mModel)
+
+  // The worker thread formats this version while we keep editing the next one
+  auto snapshot = mModel.Snapshot();
+  mSaveFrom = mFileName;
+  mSaveTo = name;
+  mSaveVersion = snapshot.Version();
+  mSaveWatcher.setFuture(QtConcurrent::run([snapshot, name]() -> QString
   {
-    ts << count << '\n';
-    ts << MStoSrtTC(i.begin) << " --> " << MStoSrtTC(i.end()) << '\n';
-    ts << i.UpdatedCompleteText() << '\n';
-    ts << '\n';
-    count++;
-  }
+    SrtWriter w(snapshot.size());
+    for(const auto &i : snapshot)
+      w.Append(i);
+    return SaveSrt(name, w.Data());
+  }));
 }
 
 void Reorganizer::OpenWave(QString name)
@@ -150,22 +156,242 @@ void Reorganizer::OpenWave(QString name)
   f.open(QFile::ReadOnly);
   if(f.error())
   {
-    emit SendNotify(tr("Cannot open WAV file. Error: %1").arg(f.errorString()), 2);
+    emit SendNotify(tr("Cannot open audio file. Error: %1").arg(f.errorString()), 2);
     return;
   }
-  mWav.clear();
-  if(mWav.cacheAll(&f))
+  auto wav = WavDecoder::ForDevice(&f, this);
+  wav->SetCompact(mCompactAudio);
+  if(wav->cacheAll(&f))
   {
-    emit SendNotify(tr("WAV file successfully loaded."), 0);
+    emit SendNotify(tr("Audio file successfully loaded, %1 in memory.")
+                    .arg(locale().formattedDataSize(wav->ResidentBytes())), 0);
   }
   else
   {
-    QMessageBox::critical(this, tr("Cannot open WAV"), tr("WAV file unrecognized"));
+    delete wav;
+    QMessageBox::critical(this, tr("Cannot open audio"), tr("Audio file unrecognized"));
     return;
   }
-  mNleMaximumLengthMs = mWav.GetLengthMs();
+  mPlayer.Stop();
+  delete mWav;
+  mWav = wav;
+  mWavName = name;
+  mWaveTiles.clear();
+  mNleMaximumLengthMs = mWav->GetLengthMs();
   mNleRangeMsEnd = std::min(10000, mNleMaximumLengthMs);
   mBarNleHoriz->setMaximum(mNleMaximumLengthMs);
+  mSpectro.SetSource(mWav->Reader());
+}
+
+void Reorganizer::LoadWordList(QString name)
+{
+  QFile f(name);
+  f.open(QFile::ReadOnly);
+  if(f.error())
+  {
+    emit SendNotify(tr("Cannot open word list. Error: %1").arg(f.errorString()), 2);
+    return;
+  }
+  QTextStream ts(&f);
+  ts.setCodec("UTF-8");
+  QStringList words;
+  while(!ts.atEnd())
+    words.append(ts.readLine().section(' ', 0, 0));
+  auto dict = std::make_shared<WordListSegmenter>(words);
+  if(!dict->size())
+  {
+    emit SendNotify(tr("No words found in %1.").arg(name), 2);
+    return;
+  }
+  mSplitter.SetDictionary(dict);
+  emit SendNotify(tr("%1 words loaded, used for files opened from now on.").arg(dict->size()), 0);
+}
+
+void Reorganizer::SetSilenceParams(const SilenceParams &params)
+{
+  mWav->SetSilenceParams(params);
+  emit SendNotify(tr("%1 pauses found.").arg(mWav->GetEnvelope().Pauses().size()), 0);
+  UpdateNLEArea();
+}
+
+void Reorganizer::SetSpectrogramVisible(bool visible)
+{
+  mShowSpectrogram = visible;
+  if(mDirtyActionType == DblClkEditBlock)
+    EditBlockTextInSitu_Abort();
+  UpdateAll();
+}
+
+void Reorganizer::SetCompactAudio(bool compact)
+{
+  mCompactAudio = compact;
+  if(!mWavName.isEmpty() && mWav->IsCompact() != compact)
+  {
+    // Where the view is stays
+    auto begin = mNleRangeMsBegin, end = mNleRangeMsEnd;
+    OpenWave(mWavName);
+    mNleRangeMsBegin = begin;
+    mNleRangeMsEnd = end;
+    UpdateAll();
+  }
+}
+
+void Reorganizer::SetPlaybackSpeed(f64 speed)
+{
+  mPlayer.SetSpeed(speed);
+}
+
+void Reorganizer::SetFollowPlayhead(bool follow)
+{
+  mFollowPlayhead = follow;
+  MovePlayhead();
+}
+
+void Reorganizer::ShiftTiming(i32 ms)
+{
+  RetimeFromActiveLine(TimeMap::Shift(ms));
+}
+
+void Reorganizer::StretchTiming(f64 factor)
+{
+  if(mModel.isEmpty() || factor <= 0.0)
+    return;
+  SanitizeActiveSelection();
+  RetimeFromActiveLine(TimeMap::Stretch(factor, mModel.at(mCurrentActiveLine).begin));
+}
+
+void Reorganizer::RebalanceLines(bool wholeFile)
+{
+  if(mModel.isEmpty())
+    return;
+  SanitizeActiveSelection();
+  auto limits = ReflowLimits::Default();
+
+  // Otherwise the run of lines the active one is in, up to the first gap words can't cross
+  i32 from = 0, to = mModel.size();
+  if(!wholeFile)
+  {
+    from = mCurrentActiveLine;
+    to = mCurrentActiveLine + 1;
+    while(from > 0 && mModel.at(from).begin >= mModel.at(from - 1).end() &&
+          mModel.at(from).begin - mModel.at(from - 1).end() <= limits.maxMergeGapMs)
+      from--;
+    while(to < mModel.size() && mModel.at(to).begin >= mModel.at(to - 1).end() &&
+          mModel.at(to).begin - mModel.at(to - 1).end() <= limits.maxMergeGapMs)
+      to++;
+  }
+
+  auto plans = PlanLineBreaks(mModel.Snapshot(), from, to, limits);
+  if(plans.isEmpty())
+  {
+    emit SendNotify(tr("Line breaks are already balanced."), 0);
+    return;
+  }
+  BeginMacro(tr("Rebalance line breaks"));
+  auto changed = ApplyLineBreaks(mModel, plans, [this](LRCmd::CmdBase *cmd)
+  {
+    PushCommand(cmd);
+  });
+  EndMacro();
+  emit SendNotify(tr("Rebalanced %1 lines.").arg(changed), 0);
+  UpdateExternals();
+  UpdateAll();
+}
+
+i32 Reorganizer::Find(const QString &text, bool wholeWords)
+{
+  mSearchText = text;
+  mSearchWholeWords = wholeWords;
+  mSearchHits = mSearch.Find(text, wholeWords ? SearchIndex::WholeWords : SearchIndex::Substring);
+  mSearchVersion = mModel.Version();
+  mSearchPos = -1;
+  if(mSearchHits.isEmpty())
+  {
+    emit SendNotify(tr("\"%1\" not found.").arg(text), 1);
+    UpdateListArea();
+    return 0;
+  }
+  SanitizeActiveSelection();
+  auto first = std::lower_bound(mSearchHits.begin(), mSearchHits.end(), mCurrentActiveLine,
+                                [](const SearchHit &h, i32 line) { return h.dialog < line; });
+  JumpToSearchHit(first == mSearchHits.end() ? 0 : first - mSearchHits.begin());
+  return mSearchHits.size();
+}
+
+i32 Reorganizer::FindNext(bool backwards)
+{
+  if(mSearchText.isEmpty())
+    return 0;
+  // Lines have moved since, search again and go on from the active line
+  if(mSearchVersion != mModel.Version())
+  {
+    auto found = mSearch.Find(mSearchText, mSearchWholeWords ? SearchIndex::WholeWords : SearchIndex::Substring);
+    mSearchHits = found;
+    mSearchVersion = mModel.Version();
+    mSearchPos = -1;
+    if(mSearchHits.isEmpty())
+    {
+      emit SendNotify(tr("\"%1\" not found.").arg(mSearchText), 1);
+      return 0;
+    }
+    SanitizeActiveSelection();
+    auto at = std::lower_bound(mSearchHits.begin(), mSearchHits.end(), mCurrentActiveLine + !backwards,
+                               [](const SearchHit &h, i32 line) { return h.dialog < line; }) - mSearchHits.begin();
+    mSearchPos = backwards ? at : at - 1;
+  }
+  if(mSearchHits.isEmpty())
+    return 0;
+  auto n = mSearchHits.size();
+  JumpToSearchHit(((mSearchPos + (backwards ? -1 : 1)) % n + n) % n);
+  return n;
+}
+
+QVector<LineReplacement> Reorganizer::PreviewReplace(const ReplaceSpec &spec)
+{
+  auto pattern = ReplacePattern(spec);
+  if(!pattern.isValid())
+  {
+    emit SendNotify(tr("Invalid pattern: %1").arg(pattern.errorString()), 2);
+    return { };
+  }
+  return PlanReplace(mModel.Snapshot(), spec, mSplitter.Dictionary());
+}
+
+i32 Reorganizer::Replace(const ReplaceSpec &spec)
+{
+  auto lines = PreviewReplace(spec);
+  if(lines.isEmpty())
+  {
+    if(ReplacePattern(spec).isValid()) // Otherwise the preview said what's wrong
+      emit SendNotify(tr("\"%1\" not found.").arg(spec.find), 1);
+    return 0;
+  }
+  BeginMacro(tr("Replace \"%1\"").arg(spec.find));
+  auto replaced = ApplyReplace(mModel, lines, mMeasurer, [this](LRCmd::CmdBase *cmd)
+  {
+    PushCommand(cmd);
+  });
+  EndMacro();
+  emit SendNotify(tr("Replaced %1 times in %2 lines.").arg(replaced).arg(lines.size()), 0);
+  UpdateExternals();
+  UpdateAll();
+  return replaced;
+}
+
+void Reorganizer::JumpToSearchHit(i32 hit)
+{
+  mSearchPos = hit;
+  auto line = mSearchHits[hit].dialog;
+  mCurrentLine = line;
+  mVertScrollOffset = 0;
+  mBarVert->setValue(line);
+  SetCurrentActiveLine(line);
+
+  // Keep the zoom of the NLE, center it on the line
+  auto d = mModel.at(line);
+  NleShiftTimeMs((i32)(d.begin + d.duration / 2) - (mNleRangeMsBegin + mNleRangeMsEnd) / 2);
+  emit SendNotify(tr("Hit %1 of %2").arg(hit + 1).arg(mSearchHits.size()), 0);
+  UpdateAll();
 }
 
 void Reorganizer::paintEvent(QPaintEvent *e)
@@ -174,13 +400,16 @@ void Reorganizer::paintEvent(QPaintEvent *e)
   static constexpr QColor
     BgTile = QColor(255, 230, 200),
     BgEmpty = QColor(218, 192, 157),
+    BgFound = QColor(140, 200, 255),
+    BgPause = QColor(120, 140, 200, 90),
     DivLine = QColor(0, 0, 0),
     FgText = QColor(0, 0, 0),
-    FgGreyText = QColor(100, 100, 100);
+    FgGreyText = QColor(100, 100, 100),
+    FgPlayhead = QColor(220, 30, 30);
 
   QPainter p(this);
   i32 h = height(),
-      h_list = h - NleHeight,
+      h_list = h - NleAreaHeight(),
       w = width(),
       h_2 = h_list / 2,
       lines_2 = ceil((float)h_2 / LineHeight),
@@ -194,7 +423,8 @@ void Reorganizer::paintEvent(QPaintEvent *e)
   //  ====== List editor area ======
   //
 
-  if(mUpdateArea | ListArea && mModel.size())
+  // A moving playhead only asks for strips of the NLE editor
+  if(mUpdateArea | ListArea && mModel.size() && e->rect().top() < h_list)
   {
     mUpdateArea &= ~ListArea;
 
@@ -203,6 +433,7 @@ void Reorganizer::paintEvent(QPaintEvent *e)
     pt2 { FgGreyText };
     QBrush b1 { BgTile, Qt::SolidPattern },
     b2 { BgEmpty, Qt::SolidPattern },
+    bf { BgFound, Qt::SolidPattern },
     ba { FgText, Qt::Dense5Pattern };
 
     p.setFont(mDispFont);
@@ -224,9 +455,16 @@ void Reorganizer::paintEvent(QPaintEvent *e)
                       w, LineHeight));
     for(i32 i = fromLines; i <= toLines; i++)
     {
-      auto &entry = mModel[i];
+      const auto entry = mModel.at(i);
       {
         p.setBrush(b1); // Light brush
+        // Words of the current search hit stand out, as long as the hit is still valid
+        i32 foundBegin = -1, foundEnd = -1, iWord = 0;
+        if(mSearchPos >= 0 && mSearchVersion == mModel.Version() && mSearchHits[mSearchPos].dialog == i)
+        {
+          foundBegin = mSearchHits[mSearchPos].word;
+          foundEnd = foundBegin + mSearchHits[mSearchPos].words;
+        }
         // All the text blocks
         f64 left = ReservedSpace - mHorizScrollOffset;
         for(auto &i : entry.words)
@@ -235,6 +473,7 @@ void Reorganizer::paintEvent(QPaintEvent *e)
           if(left + i._cachedBlockWidthPx > ReservedSpace)
           {
             QRectF currWordRect = QRectF(left, top, i._cachedBlockWidthPx, LineHeight);
+            p.setBrush(iWord >= foundBegin && iWord < foundEnd ? bf : b1);
             p.drawRect(currWordRect);
             currWordRect.adjust(HorizMargin, 0, 0, 0);
             p.drawText(currWordRect,
@@ -243,6 +482,7 @@ void Reorganizer::paintEvent(QPaintEvent *e)
           }
 
           left += i._cachedBlockWidthPx;
+          iWord++;
         }
 
         // Reserved space, timestamp etc
@@ -292,7 +532,7 @@ void Reorganizer::paintEvent(QPaintEvent *e)
       p.setBrush(bw);
       p.setCompositionMode(QPainter::CompositionMode_Difference);
       QRectF fillArea;
-      auto &opWords = mModel[mCurrentOperatingLine].words;
+      const auto opWords = mModel.at(mCurrentOperatingLine).words;
       if(mDesiredDragOp == AtPlace) // Go nowhere
       {
         p.setClipRect(QRectF(ReservedSpace, 0, w - ReservedSpace, h_list)); // Clip at visible list area
@@ -333,6 +573,7 @@ void Reorganizer::paintEvent(QPaintEvent *e)
     p.setClipping(false);
 
     f32 pxPerMs = f32(w) / (mNleRangeMsEnd - mNleRangeMsBegin);
+    const QRectF dirty = QRectF(e->rect()).translated(0, -h_list);
 
     // NLE blockes
     p.setFont(QFont("sansserif", 15));
@@ -341,71 +582,120 @@ void Reorganizer::paintEvent(QPaintEvent *e)
       i32 beginDialog = FindDialogAt(mNleRangeMsBegin);
       if(beginDialog >= 0)
       {
-        f32 dialogTopLeft = (i32(mModel[beginDialog].begin) - mNleRangeMsBegin) * pxPerMs;
-        i32 i = beginDialog;
         p.setBrush(QBrush(BgTile));
-        while(dialogTopLeft < w)
+        for(i32 i = beginDialog; i < mModel.size(); i++)
         {
+          const auto d = mModel.at(i);
+          f32 dialogTopLeft = (i64(d.begin) - mNleRangeMsBegin) * pxPerMs;
+          if(dialogTopLeft >= w)
+            break;
+          if(!dirty.intersects(QRectF(dialogTopLeft, 0, d.duration * pxPerMs, BlockHeight)))
+            continue;
           p.drawRect(QRectF(dialogTopLeft, 0,
-                            mModel[i].duration * pxPerMs, BlockHeight));
+                            d.duration * pxPerMs, BlockHeight));
           // Text bounding box
 //          p.drawRect(QRectF(QPointF(std::max(dialogTopLeft, 0.0f) + NleBlockMargin,
 //                                    NleBlockMargin),
-//                            QPointF(std::min(dialogTopLeft + mModel[i].duration * pxPerMs - NleBlockMargin, f32(w) - NleBlockMargin),
+//                            QPointF(std::min(dialogTopLeft + d.duration * pxPerMs - NleBlockMargin, f32(w) - NleBlockMargin),
 //                                    BlockHeight - NleBlockMargin)));
           p.drawText(QRectF(QPointF(std::max(dialogTopLeft, 0.0f) + NleBlockMargin,
                                     NleBlockMargin),
-                            QPointF(std::min(dialogTopLeft + mModel[i].duration * pxPerMs - NleBlockMargin, f32(w) - NleBlockMargin),
+                            QPointF(std::min(dialogTopLeft + d.duration * pxPerMs - NleBlockMargin, f32(w) - NleBlockMargin),
                                     BlockHeight - NleBlockMargin)),
                      Qt::TextWordWrap | Qt::AlignLeft | Qt::AlignTop,
-                     mModel[i].completeText);
+                     d.CompleteText());
           // Debug text
 //          p.drawText(QPointF(dialogTopLeft, 0), QString::number(i) + ", " + QString::number(dialogTopLeft) + ", ");
-          i++;
-          dialogTopLeft = (mModel[i].begin - mNleRangeMsBegin) * pxPerMs;
         }
       }
       p.drawText(QPointF(0, 0), QString::number(beginDialog));
     }
 
-    // Paint waveform
-    if(mNleRangeMsBegin < mNleRangeMsEnd)
+    // Paint waveform, over the pauses in it
+    if(mNleRangeMsBegin < mNleRangeMsEnd && w > 0)
     {
-      f32 samplePerPx = (mNleRangeMsEnd - mNleRangeMsBegin) / 1000.0 * mWav.SampleRate() / w,
-          sampleBegin = mNleRangeMsBegin / 1000.0 * mWav.SampleRate(),
-          sampleEnd;
-      // Make sampleBegin always a multiply of samplePerPx
-      // Doesn't lose a lot of precision but brings huge stability to the waveforms
-      sampleBegin = floor(sampleBegin / samplePerPx) * samplePerPx;
-      sampleEnd = sampleBegin + samplePerPx;
-      for(i32 i = 0; i < w; i++)
+      auto &env = mWav->GetEnvelope();
+      auto pauses = env.PausesIn(mNleRangeMsBegin, mNleRangeMsEnd);
+      auto pen = p.pen();
+      p.setPen(Qt::NoPen);
+      p.setBrush(QBrush(BgPause));
+      for(i32 i = pauses.first; i < pauses.second; i++)
       {
-        auto peaks = mWav.GetWaveformPeaksForRange(floor(sampleBegin), floor(sampleEnd));
-        p.drawLine(QPointF(i, WaveformHeight / 2 * (1 - peaks.first)  + NleHeight - WaveformHeight),
-                   QPointF(i, WaveformHeight / 2 * (1 - peaks.second) + NleHeight - WaveformHeight));
-
-        sampleBegin = sampleEnd;
-        sampleEnd += samplePerPx;
+        auto &pause = env.Pauses()[i];
+        p.drawRect(QRectF((i64(pause.begin) - mNleRangeMsBegin) * pxPerMs, NleHeight - WaveformHeight,
+                          pause.length() * pxPerMs, WaveformHeight));
       }
+      p.setPen(pen);
 
-      QLinearGradient lg(0, 0, 0, WaveformHeight);
-
-      lg.setColorAt(0.0, QColor(255,255,255,170));
-      lg.setColorAt(0.5, QColor(255,255,255,64));
-      lg.setColorAt(1.0, QColor(255,255,255,170));
+      // Columns are whole multiples of samplePerPx from the start of the audio, so the same tiles
+      // fit wherever the view is scrolled to
+      const f64 samplePerPx = (mNleRangeMsEnd - mNleRangeMsBegin) / 1000.0 * mWav->SampleRate() / w;
+      const i64 firstColumn = floor(mNleRangeMsBegin / 1000.0 * mWav->SampleRate() / samplePerPx);
+      if(samplePerPx != mWaveTileSpp)
+      {
+        mWaveTiles.clear();
+        mWaveTileSpp = samplePerPx;
+      }
+      const i64 firstTile = firstColumn / WaveTileWidth, lastTile = (firstColumn + w - 1) / WaveTileWidth;
+      for(i64 t = firstTile; t <= lastTile; t++)
+      {
+        const QPoint at(t * WaveTileWidth - firstColumn, NleHeight - WaveformHeight);
+        if(dirty.intersects(QRectF(at, QSizeF(WaveTileWidth, WaveformHeight))))
+          p.drawPixmap(at, WaveTile(t, pen.color()));
+      }
+      if(mWaveTiles.size() > MaxWaveTiles)
+      {
+        for(auto it = mWaveTiles.begin(); it != mWaveTiles.end();)
+        {
+          if(it.key() < firstTile - 1 || it.key() > lastTile + 1)
+            it = mWaveTiles.erase(it);
+          else
+            ++it;
+        }
+      }
+    }
 
-      p.setPen(Qt::NoPen);
-      p.setBrush(QBrush(lg));
-      p.setCompositionMode(QPainter::CompositionMode_DestinationIn);
-//      p.drawRect(QRectF(0, NleHeight - WaveformHeight, w, WaveformHeight));
-      // I don't know why the fuck this doesn't work so I had to use transform method to move
-      // the entire painting area.
-      // Please, Qt, how the fuck does the gradients' coordinates work? Isn't it just supposed to
-      // be gradient-ing in my painted area?
-      p.translate(0,   NleHeight - WaveformHeight);
-      p.drawRect(QRectF(0, 0, w, WaveformHeight));
-      p.translate(0, -(NleHeight - WaveformHeight));
-      p.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    // Spectrogram lane, below the waveform
+    if(mShowSpectrogram && mNleRangeMsBegin < mNleRangeMsEnd && mWav->SampleRate() > 0)
+    {
+      const f64 samplesPerPx = (mNleRangeMsEnd - mNleRangeMsBegin) / 1000.0 * mWav->SampleRate() / w,
+                sampleBegin = mNleRangeMsBegin / 1000.0 * mWav->SampleRate(),
+                sampleEnd = sampleBegin + w * samplesPerPx;
+      const i32 level = Spectrogram::LevelFor(samplesPerPx);
+      const i64 tileSamples = (i64)Spectrogram::TileColumns << level;
+      // Only a moved view counts as a new frame, so repainting behind the playhead neither
+      // ages the tiles still queued nor asks for the ones outside the strip
+      if(mNleRangeMsBegin != mSpectroMsBegin || mNleRangeMsEnd != mSpectroMsEnd || w != mSpectroWidth)
+      {
+        mSpectro.NextFrame();
+        mSpectroMsBegin = mNleRangeMsBegin;
+        mSpectroMsEnd = mNleRangeMsEnd;
+        mSpectroWidth = w;
+      }
+      p.fillRect(QRectF(0, NleHeight, w, SpectrogramHeight), Qt::black);
+      for(i64 t = sampleBegin / tileSamples; t * tileSamples < sampleEnd; t++)
+      {
+        QRectF target((t * tileSamples - sampleBegin) / samplesPerPx, NleHeight,
+                      tileSamples / samplesPerPx, SpectrogramHeight);
+        if(!dirty.intersects(target))
+          continue;
+        auto tile = mSpectro.Tile(level, t);
+        if(!tile.isNull())
+        {
+          p.drawImage(target, tile);
+          continue;
+        }
+        // Stretch a part of a coarser tile until this one is in
+        for(i32 up = 1; up <= 3 && level + up <= Spectrogram::MaxLevel; up++)
+        {
+          auto coarse = mSpectro.CachedTile(level + up, t >> up);
+          if(coarse.isNull())
+            continue;
+          const f64 cols = (f64)Spectrogram::TileColumns / (1 << up);
+          p.drawImage(target, coarse, QRectF((t & ((1 << up) - 1)) * cols, 0, cols, coarse.height()));
+          break;
+        }
+      }
     }
 
     // paint time scale
@@ -444,6 +734,14 @@ void Reorganizer::paintEvent(QPaintEvent *e)
     }
   }
 
+  // Playhead, over everything
+  if(mPlayheadX >= 0)
+  {
+    p.resetTransform();
+    p.setPen(FgPlayhead);
+    p.drawLine(mPlayheadX, h_list, mPlayheadX, h);
+  }
+
   p.end();
 }
 
@@ -451,7 +749,7 @@ void Reorganizer::mousePressEvent(QMouseEvent *e)
 {
   // Determine where the mouse is at
   auto pos = e->pos();
-  auto h = height() - NleHeight,
+  auto h = height() - NleAreaHeight(),
        deltaY = pos.y() - h / 2,
        realX = pos.x() + mHorizScrollOffset;
   f64 endPos;
@@ -473,7 +771,7 @@ void Reorganizer::mousePressEvent(QMouseEvent *e)
     SetCurrentActiveLine(mCurrentOperatingLine = mCurrentActiveLine);
 
     // Figure out the word currently under the mouse
-    auto &opLine = mModel[mCurrentOperatingLine];
+    const auto opLine = mModel.at(mCurrentOperatingLine);
     auto &opWords = opLine.words;
     endPos = ReservedSpace;
     mCurrentEditingWord = opWords.size() - 1;
@@ -505,7 +803,7 @@ void Reorganizer::mousePressEvent(QMouseEvent *e)
   {
     if(mCurrentOperatingLine >= 0)
     {
-      auto &opWords = mModel[mCurrentOperatingLine].words;
+      const auto opWords = mModel.at(mCurrentOperatingLine).words;
       SetDirtyAction(DblClkEditBlock); // Identify as double click
       EditBlockTextInSitu_Start(
             QPointF(endPos - opWords[mCurrentEditingWord]._cachedBlockWidthPx,
@@ -537,7 +835,7 @@ void Reorganizer::mouseMoveEvent(QMouseEvent *e)
 {
   auto pos = e->pos();
 
-  if(e->pos().y() > height() - NleHeight)
+  if(e->pos().y() > height() - NleAreaHeight())
     return NleMouseMoveEvent(e);
 
   switch(mDirtyActionType)
@@ -581,6 +879,8 @@ void Reorganizer::mouseMoveEvent(QMouseEvent *e)
 
 void Reorganizer::mouseReleaseEvent(QMouseEvent *e)
 {
+  if(mNleDragging)
+    return NleMouseReleaseEvent(e);
 
   if(mDesiredDragOp)
   {
@@ -609,7 +909,7 @@ void Reorganizer::keyPressEvent(QKeyEvent *e)
 
 void Reorganizer::wheelEvent(QWheelEvent *e)
 {
-  if(e->position().y() > height() - NleHeight)
+  if(e->position().y() > height() - NleAreaHeight())
     return NleWheelEvent(e);
   i32 px = e->angleDelta().y() * ScrollCoeff;
   ScrollPixelDelta(px);
@@ -624,7 +924,7 @@ void Reorganizer::resizeEvent(QResizeEvent *e)
   if(mDirtyActionType == DblClkEditBlock)
     EditBlockTextInSitu_Placement(QPointF(mInSituEditorLeftMargin,
                                           mInSituEditorOffCenterMargin +
-                                            (e->size().height() - NleHeight) / 2));
+                                            (e->size().height() - NleAreaHeight()) / 2));
 }
 
 void Reorganizer::NleMousePressEvent(QMouseEvent *e)
@@ -645,6 +945,7 @@ void Reorganizer::NleMousePressEvent(QMouseEvent *e)
     {
       mAudioPlayRegionA = NleXtoMS(pos.x());
       mNleDragging = true;
+      mNleCurrentOp = DragWaveform;
     }
     else
     {
@@ -664,15 +965,19 @@ void Reorganizer::NleMouseReleaseEvent(QMouseEvent *e)
   switch(mNleCurrentOp)
   {
     case DragWaveform:
+      mAudioPlayRegionB = NleXtoMS(e->pos().x());
       if(mAudioPlayRegionA > mAudioPlayRegionB)
         std::swap(mAudioPlayRegionA, mAudioPlayRegionB);
+      // A click plays on to the end
+      if(mAudioPlayRegionB - mAudioPlayRegionA <= NleXtoMS(ClickSlop) - NleXtoMS(0))
+        mAudioPlayRegionB = mNleMaximumLengthMs;
       PlayAudioRegion(mAudioPlayRegionA, mAudioPlayRegionB);
-      mWaveformPlaying = true;
       break;
 
     default:
       break;
   }
+  mNleCurrentOp = NoNle;
 }
 
 void Reorganizer::NleWheelEvent(QWheelEvent *e)
@@ -685,14 +990,34 @@ void Reorganizer::NleWheelEvent(QWheelEvent *e)
 
 void Reorganizer::Redo()
 {
+  if(!mUndo.canRedo())
+    return;
+  if(!mBudget.Load(mUndo, mUndo.index()))
+  {
+    emit SendNotify(tr("Cannot read the undo history back from disk, this edit cannot be redone."), 2);
+    return;
+  }
   mUndo.redo();
+  mJournal.RecordRedo(mUndo, mModel);
+  CheckJournal();
+  HistoryChanged();
   UpdateExternals();
   UpdateListArea();
 }
 
 void Reorganizer::Undo()
 {
+  if(!mUndo.canUndo())
+    return;
+  if(!mBudget.Load(mUndo, mUndo.index() - 1))
+  {
+    emit SendNotify(tr("Cannot read the undo history back from disk, this edit cannot be undone."), 2);
+    return;
+  }
   mUndo.undo();
+  mJournal.RecordUndo(mUndo, mModel);
+  CheckJournal();
+  HistoryChanged();
   UpdateExternals();
   UpdateListArea();
 }
@@ -760,22 +1085,22 @@ void Reorganizer::EditBlockTextInSitu_Commit()
 {
   mEdit->setVisible(false);
   mEdit->setDisabled(true);
-  auto delta = SplitDialogByDelim(mEdit->text());
+  auto delta = mSplitter.Split(mEdit->text());
   switch(delta.size())
   {
     case 0:
-      mUndo.push(new LRCmd::RemoveWord(mModel, mCurrentActiveLine, mCurrentEditingWord));
+      PushCommand(new LRCmd::RemoveWord(mModel, mCurrentActiveLine, mCurrentEditingWord));
       break;
 
     case 1:
-      mUndo.push(new LRCmd::ChangeWord(mModel, mCurrentActiveLine, mCurrentEditingWord, delta[0]));
+      PushCommand(new LRCmd::ChangeWord(mModel, mCurrentActiveLine, mCurrentEditingWord, delta[0]));
       break;
 
     default:
-      mUndo.beginMacro(tr("Change word to multiple words"));
-      mUndo.push(new LRCmd::RemoveWord(mModel, mCurrentActiveLine, mCurrentEditingWord));
-      mUndo.push(new LRCmd::InsertWords(mModel, mCurrentActiveLine, mCurrentEditingWord, delta));
-      mUndo.endMacro();
+      BeginMacro(tr("Change word to multiple words"));
+      PushCommand(new LRCmd::RemoveWord(mModel, mCurrentActiveLine, mCurrentEditingWord));
+      PushCommand(new LRCmd::InsertWords(mModel, mCurrentActiveLine, mCurrentEditingWord, delta));
+      EndMacro();
       break;
   }
 
@@ -789,6 +1114,29 @@ void Reorganizer::AudioPlaybackStopped()
 
 }
 
+void Reorganizer::SaveFinished()
+{
+  auto err = mSaveWatcher.result();
+  if(!err.isEmpty())
+  {
+    emit SendNotify(tr("Cannot save SRT file. Error: %1").arg(err), 2);
+    return;
+  }
+  emit SendNotify(tr("SRT file saved."), 0);
+
+  // Another file was opened in the meantime, its log has nothing to do with this save
+  if(mSaveFrom != mFileName)
+    return;
+  if(mSaveTo != mFileName)
+  {
+    mJournal.Stop();
+    mFileName = mSaveTo;
+  }
+  // Start over from the saved file, or from a checkpoint if we kept editing while saving
+  if(!mJournal.Start(mFileName, mUndo, mModel.Version() == mSaveVersion ? nullptr : &mModel))
+    emit SendNotify(tr("Cannot write the edit journal, unsaved edits will be lost on a crash."), 1);
+}
+
 //
 // == Status Setters ==
 //
@@ -846,10 +1194,86 @@ i32 Reorganizer::NleXtoMS(i32 x)
 
 void Reorganizer::PlayAudioRegion(i32 beginMs, i32 endMs)
 {
-  i32 beginSample = beginMs / 1000.0 * mWav.SampleRate(),
-      endSample   = endMs   / 1000.0 * mWav.SampleRate();
+  i64 beginFrame = (i64)beginMs * mWav->SampleRate() / 1000,
+      endFrame   = (i64)endMs   * mWav->SampleRate() / 1000;
 
-//  mAudioOut.start(QBuffer())
+  if(!mPlayer.Play(mWav, beginFrame, endFrame))
+    emit SendNotify(tr("The audio output cannot play %1 Hz audio.").arg(mWav->SampleRate()), 2);
+  mWaveformPlaying = mPlayer.IsPlaying();
+  if(mWaveformPlaying)
+  {
+    mPlayheadTimer.start();
+    MovePlayhead();
+  }
+}
+
+void Reorganizer::MovePlayhead()
+{
+  const i64 frame = mPlayer.Position();
+  if(frame < 0 || mWav->SampleRate() <= 0 || mNleRangeMsBegin >= mNleRangeMsEnd)
+    return;
+  const f64 ms = frame * 1000.0 / mWav->SampleRate();
+  const i32 range = mNleRangeMsEnd - mNleRangeMsBegin;
+
+  // Page on when it is near the right edge or out of view. The range keeps its length, so the
+  // waveform is drawn from the tiles it already has.
+  if(mFollowPlayhead && (ms < mNleRangeMsBegin || ms > mNleRangeMsEnd - range / 10))
+  {
+    const i32 begin = mNleRangeMsBegin;
+    NleShiftTimeMs(i32(ms) - range / 10 - begin);
+    if(mNleRangeMsBegin != begin)
+    {
+      mPlayheadX = -1;
+      UpdateNLEArea();
+    }
+  }
+
+  i32 x = lround((ms - mNleRangeMsBegin) * width() / range);
+  if(x < 0 || x >= width())
+    x = -1;
+  if(x == mPlayheadX)
+    return;
+  if(mPlayheadX >= 0)
+    update(PlayheadStrip(mPlayheadX));
+  mPlayheadX = x;
+  if(x >= 0)
+    update(PlayheadStrip(x));
+}
+
+QRect Reorganizer::PlayheadStrip(i32 x) const
+{
+  return QRect(x - 1, height() - NleAreaHeight(), 3, NleAreaHeight());
+}
+
+const QPixmap &Reorganizer::WaveTile(i64 index, const QColor &color)
+{
+  auto it = mWaveTiles.find(index);
+  if(it != mWaveTiles.end())
+    return *it;
+
+  QPixmap tile(WaveTileWidth, WaveformHeight);
+  tile.fill(Qt::transparent);
+  QPainter p(&tile);
+  p.setPen(color);
+  for(i32 i = 0; i < WaveTileWidth; i++)
+  {
+    const i64 column = index * WaveTileWidth + i;
+    auto peaks = mWav->GetWaveformPeaksForRange(floor(column * mWaveTileSpp), floor((column + 1) * mWaveTileSpp));
+    p.drawLine(QPointF(i, WaveformHeight / 2 * (1 - peaks.first)),
+               QPointF(i, WaveformHeight / 2 * (1 - peaks.second)));
+  }
+
+  QLinearGradient lg(0, 0, 0, WaveformHeight);
+  lg.setColorAt(0.0, QColor(255,255,255,170));
+  lg.setColorAt(0.5, QColor(255,255,255,64));
+  lg.setColorAt(1.0, QColor(255,255,255,170));
+  p.setPen(Qt::NoPen);
+  p.setBrush(QBrush(lg));
+  p.setCompositionMode(QPainter::CompositionMode_DestinationIn);
+  p.drawRect(QRect(0, 0, WaveTileWidth, WaveformHeight));
+  p.end();
+
+  return *mWaveTiles.insert(index, tile);
 }
 
 //
@@ -858,20 +1282,9 @@ void Reorganizer::PlayAudioRegion(i32 beginMs, i32 endMs)
 
 Status Reorganizer::AppendToModel(u64 begin, u64 end, QString dialog)
 {
-  if(mModel.size())
-  {
-    auto lastEnd = mModel.back().end();
-    if(begin < lastEnd)
-      return FailOccupied;
-  }
-  mModel.append(Dialog { .type = Dialog::Real,
-                         .begin = begin,
-                         .duration = end - begin,
-                         .words = SplitDialogByDelim(dialog),
-                         .completeText = dialog });
-  mModel.back().UpdatedWidth();
+  auto ret = AppendDialog(mModel, begin, end, dialog, mSplitter.Split(dialog));
   UpdateExternals(false);
-  return Success;
+  return ret;
 }
 
 Status Reorganizer::AddToModel(u64 begin, u64 end, QString dialog)
@@ -888,30 +1301,112 @@ i32 Reorganizer::FindDialogAt(u64 at)
   while(A < B - 1)
   {
     i32 mid = (B - A) / 2 + A;
-    if(mModel[mid].begin > at)
+    if(mModel.at(mid).begin > at)
       B = mid;
-    else if(mModel[mid].begin < at)
+    else if(mModel.at(mid).begin < at)
       A = mid;
     else
       return mid;
   }
   // When this loop is over, we'd have `at` between A.begin and B.begin (except when you only have 2 elements)
   // Check if A's length covers `at`
-  if(mModel[A].end() > at)
+  if(mModel.at(A).end() > at)
     return A;
   // If A is not covering `at`, consider the edge case of 2 elements
-  else if (mModel[B].end() > at)
+  else if (mModel.at(B).end() > at)
     return B;
   else
     return -1;
 }
 
+void Reorganizer::PushCommand(LRCmd::CmdBase *cmd)
+{
+  // Encode first, the stack deletes the command if it merges it into another one
+  auto encoded = Journal::Encode(cmd);
+  auto indexBefore = mUndo.index();
+  mUndo.push(cmd);
+  mJournal.RecordPush(encoded, indexBefore, mUndo, mModel);
+  CheckJournal();
+  // A macro can hold thousands of commands, account for them once it is closed
+  if(mMacroDepth == 0)
+  {
+    mBudget.Pushed(mUndo, indexBefore);
+    HistoryChanged();
+  }
+}
+
+void Reorganizer::BeginMacro(const QString &text)
+{
+  if(mMacroDepth == 0)
+    mMacroIndexBefore = mUndo.index();
+  mUndo.beginMacro(text);
+  mJournal.RecordBeginMacro(text);
+  CheckJournal();
+  mMacroDepth++;
+}
+
+void Reorganizer::EndMacro()
+{
+  mUndo.endMacro();
+  mMacroDepth--;
+  mJournal.RecordEndMacro(mUndo, mModel);
+  CheckJournal();
+  if(mMacroDepth == 0)
+  {
+    mBudget.Pushed(mUndo, mMacroIndexBefore);
+    HistoryChanged();
+  }
+}
+
+void Reorganizer::CheckJournal()
+{
+  if(mJournal.TakeFailure())
+    emit SendNotify(tr("Cannot write the edit journal, unsaved edits will be lost on a crash."), 1);
+}
+
+void Reorganizer::HistoryChanged()
+{
+  mBudget.Enforce(mUndo);
+  emit HistoryUsage(mBudget.InMemory(), mBudget.OnDisk());
+}
+
+void Reorganizer::RecoverJournal()
+{
+  if(Journal::HasRecoverable(mFileName) &&
+     QMessageBox::question(this, tr("Recover edits"),
+                           tr("This file has edits from a previous session that were never saved. "
+                              "Recover them? Otherwise they will be discarded.")) == QMessageBox::Yes)
+  {
+    auto edits = Journal::Replay(mFileName, mModel, mUndo);
+    mBudget.Recount(mUndo);
+    HistoryChanged();
+    if(edits < 0)
+      emit SendNotify(tr("The edit journal is damaged and could not be recovered."), 2);
+    else
+    {
+      emit SendNotify(tr("Recovered %1 edits from the journal.").arg(edits), 0);
+      mCurrentLine = std::min(mCurrentLine, mModel.size() - 1);
+      UpdateExternals(true);
+      UpdateAll();
+      // The file no longer matches the model, start the new log from a checkpoint
+      if(!mJournal.Start(mFileName, mUndo, &mModel))
+        emit SendNotify(tr("Cannot write the edit journal, unsaved edits will be lost on a crash."), 1);
+      return;
+    }
+  }
+  if(!mJournal.Start(mFileName, mUndo))
+    emit SendNotify(tr("Cannot write the edit journal, unsaved edits will be lost on a crash."), 1);
+}
+
 Status Reorganizer::CommitCurrentOperation()
 {
   if(mCurrentOperatingLine < 0 || mDesiredDragOp == AtPlace)
     return FailNoAction;
-  if(mCurrentOperatingLine > mModel.size())
+  if(mCurrentOperatingLine >= mModel.size())
     return FailInvalidOp;
+  // The cut goes into a pause in the audio if there is one nearby
+  BoundaryTimer timer(&mWav->GetEnvelope());
+  auto curr = mModel.at(mCurrentOperatingLine);
   switch(mDesiredDragOp)
   {
     case MergePrev:
@@ -920,10 +1415,11 @@ Status Reorganizer::CommitCurrentOperation()
         emit SendNotify(tr("Can't merge to previous line, because this is already first line!"), 1);
         return FailNoTarget; // Can't do it
       }
-      mUndo.push(new LRCmd::MergeToPrevLine(mModel,
-                                            mCurrentOperatingLine,
-                                            mCurrentEditingWord,
-                                            mCurrentOperatingLine - 1));
+      PushCommand(new LRCmd::MergeToPrevLine(mModel,
+                                             mCurrentOperatingLine,
+                                             mCurrentEditingWord,
+                                             mCurrentOperatingLine - 1,
+                                             timer.SplitTime(curr, mCurrentEditingWord + 1)));
       mCurrentOperatingLine--;
       break;
 
@@ -933,10 +1429,11 @@ Status Reorganizer::CommitCurrentOperation()
         emit SendNotify(tr("Can't merge to next line, because this is already last line!"), 1);
         return FailNoTarget; // Can't do
       }
-      mUndo.push(new LRCmd::MergeToNextLine(mModel,
-                                            mCurrentOperatingLine,
-                                            mCurrentEditingWord,
-                                            mCurrentOperatingLine + 1));
+      PushCommand(new LRCmd::MergeToNextLine(mModel,
+                                             mCurrentOperatingLine,
+                                             mCurrentEditingWord,
+                                             mCurrentOperatingLine + 1,
+                                             timer.SplitTime(curr, mCurrentEditingWord)));
       break;
 
     case SplitPrev:
@@ -945,9 +1442,10 @@ Status Reorganizer::CommitCurrentOperation()
           emit SendNotify(tr("Can't split to previous line from the last word!"), 1);
           return FailNoTarget;
       }
-      mUndo.push(new LRCmd::SplitToPrevLine(mModel,
-                                            mCurrentOperatingLine,
-                                            mCurrentEditingWord));
+      PushCommand(new LRCmd::SplitToPrevLine(mModel,
+                                             mCurrentOperatingLine,
+                                             mCurrentEditingWord,
+                                             timer.SplitTime(curr, mCurrentEditingWord + 1)));
       break;
 
     case SplitNext:
@@ -956,9 +1454,10 @@ Status Reorganizer::CommitCurrentOperation()
         emit SendNotify(tr("Can't split to next line from the first word!"), 1);
         return FailNoTarget;
       }
-      mUndo.push(new LRCmd::SplitToNextLine(mModel,
-                                            mCurrentOperatingLine,
-                                            mCurrentEditingWord));
+      PushCommand(new LRCmd::SplitToNextLine(mModel,
+                                             mCurrentOperatingLine,
+                                             mCurrentEditingWord,
+                                             timer.SplitTime(curr, mCurrentEditingWord)));
       break;
 
     case NoDrag:
@@ -970,12 +1469,35 @@ Status Reorganizer::CommitCurrentOperation()
   return Success;
 }
 
+Status Reorganizer::RetimeFromActiveLine(const TimeMap &map)
+{
+  if(mModel.isEmpty())
+    return FailNoTarget;
+  SanitizeActiveSelection();
+
+  // Lines are sorted, checking the first one is enough
+  auto firstBegin = mModel.at(mCurrentActiveLine).begin;
+  if(firstBegin * map.scale + map.offset < 0)
+  {
+    emit SendNotify(tr("Can't move lines to before the beginning!"), 1);
+    return FailInvalidOp;
+  }
+  if(mCurrentActiveLine > 0 && map.Map(firstBegin) < mModel.at(mCurrentActiveLine - 1).end())
+    emit SendNotify(tr("Retimed lines now overlap with the line before them."), 1);
+
+  PushCommand(new LRCmd::RetimeRange(mModel, mCurrentActiveLine, mModel.size(), map));
+  UpdateExternals();
+  UpdateAll();
+  return Success;
+}
+
 void Reorganizer::UpdateTimecodeButtons()
 {
   // Set timecode button text
   if(mCurrentActiveLine < 0) return;
-  mBtnBegin->setText(MStoTC(mModel[mCurrentActiveLine].begin));
-  mBtnEnd->setText(MStoTC(mModel[mCurrentActiveLine].end()));
+  const auto line = mModel.at(mCurrentActiveLine);
+  mBtnBegin->setText(MStoTC(line.begin));
+  mBtnEnd->setText(MStoTC(line.end()));
 }
 
 void Reorganizer::UpdateListArea()
@@ -1002,12 +1524,7 @@ void Reorganizer::UpdateExternals(bool force)
   {
     mBarVert->setRange(0, mModel.size() - 1);
 
-    // Little room for improvements, honestly, otherwise just do verification in paintEvent
-    f64 maxWidth = 0.0;
-    for(auto &i : mModel)
-      if(i.width > maxWidth)
-        maxWidth = i.width;
-
+    f64 maxWidth = mModel.MaxWidth();
     mBarHoriz->setMaximum(std::max(maxWidth + ReservedSpace - width(), 0.0));
     mLongestLineWidth = maxWidth;
     UpdateTimecodeButtons();
@@ -1020,13 +1537,13 @@ void Reorganizer::EditBlockTextInSitu_Placement(QPointF bottomLeft)
   {
     // Only update these values when initiating editor, do not overwrite when resize event occurs
     mInSituEditorLeftMargin = bottomLeft.x();
-    mInSituEditorOffCenterMargin = bottomLeft.y() - (height() - NleHeight) / 2;
+    mInSituEditorOffCenterMargin = bottomLeft.y() - (height() - NleAreaHeight()) / 2;
   }
 
   // Sanitize display position
     auto h_w = mEdit->height();
     // Y
-    if(bottomLeft.y() + h_w > height() - NleHeight)
+    if(bottomLeft.y() + h_w > height() - NleAreaHeight())
       bottomLeft.ry() -= LineHeight + h_w;
     else if(bottomLeft.y() < 0)
       bottomLeft.setY(0);
@@ -1039,43 +1556,4 @@ void Reorganizer::EditBlockTextInSitu_Placement(QPointF bottomLeft)
   mEdit->setGeometry(bottomLeft.x(), bottomLeft.y(), LineEditorWidth, h_w);
 }
 
-QVector<DiscreteWord> Reorganizer::SplitDialogByDelim(QString dialog, QString delims)
-{
-  QVector<DiscreteWord> ret;
-
-  auto last = 0;
-  int i;
-
-  for(i = 0; i < dialog.size(); i++)
-  {
-    for(auto j : delims)
-    {
-      if(dialog[i] == j)
-      {
-        auto newstr = dialog.mid(last, i - last);
-        ret.append(DiscreteWord {
-                     .text = newstr,
-                     .delim = dialog[i],
-                     ._cachedBlockWidthPx = mDispFontMet.width(newstr) + 2 * HorizMargin
-                   });
-        last = i + 1;
-
-        break;
-      }
-    }
-  }
-  // If the string doesn't end with a delim, the last word is not put into ret.
-  // Detect this and add it in right here
-  if(dialog.size() && i != dialog.size() - 1)
-  {
-    auto newstr = dialog.mid(last);
-    ret.append(DiscreteWord {
-                 .text = newstr,
-                 .delim = '\0',
-                 ._cachedBlockWidthPx = mDispFontMet.width(newstr) + 2 * HorizMargin
-               });
-  }
-  return ret;
-}
-
 
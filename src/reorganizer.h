@@ -11,13 +11,24 @@
 #include <QFontMetricsF>
 #include <QUndoStack>
 #include <QTime>
-#include <QAudioOutput>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QPixmap>
+#include <QTimer>
 #include <rint.h>
 #include <common.h>
 #include <wavdecoder.h>
-
-struct Dialog;
-struct DiscreteWord;
+#include <dialogseq.h>
+#include <fontmeasurer.h>
+#include <journal.h>
+#include <player.h>
+#include <replace.h>
+#include <searchindex.h>
+#include <spectrogram.h>
+#include <undobudget.h>
+#include <wordsplit.h>
+
+namespace LRCmd { class CmdBase; }
 
 class Reorganizer : public QWidget
 {
@@ -31,6 +42,32 @@ class Reorganizer : public QWidget
     void OpenFile(QString name);
     void SaveFile(QString name);
     void OpenWave(QString name);
+    /// Words to segment Chinese and Japanese by, one per line, anything after a space is ignored
+    void LoadWordList(QString name);
+
+    /// Pauses in the audio are where lines are best split
+    const Envelope &AudioEnvelope() const { return mWav->GetEnvelope(); }
+    void SetSilenceParams(const SilenceParams &params);
+    void SetSpectrogramVisible(bool visible); ///< A lane under the waveform
+    /// Keep only the peaks and the envelope of the audio, reopens it
+    void SetCompactAudio(bool compact);
+    void SetPlaybackSpeed(f64 speed); ///< 0.5x to 2x, also while playing
+    void SetFollowPlayhead(bool follow); ///< Page the NLE along when the playhead nears its end
+
+    // Retiming, both act on the active line and every line after it
+    void ShiftTiming(i32 ms);
+    void StretchTiming(f64 factor); ///< Stretch around the begin of active line
+
+    /// Move words between adjacent lines to balance length and reading speed, as one undo step
+    void RebalanceLines(bool wholeFile); ///< Otherwise only the lines around the active one
+
+    // Search, case-insensitive. Both jump to the hit and return how many there are.
+    i32 Find(const QString &text, bool wholeWords); ///< First hit from the active line on
+    i32 FindNext(bool backwards = false);
+
+    /// Lines a replace would change, nothing is changed yet
+    QVector<LineReplacement> PreviewReplace(const ReplaceSpec &spec);
+    i32 Replace(const ReplaceSpec &spec); ///< Every hit, as one undo step. Returns how many.
 
   protected:
     virtual void paintEvent(QPaintEvent* e) override;
@@ -63,6 +100,8 @@ class Reorganizer : public QWidget
 
     void AudioPlaybackStopped();
 
+    void SaveFinished();
+
   private: // Methods
     // Status setters (with extra event processing inside)
     enum DirtyActionType { NoAction = 0, DragBlock, DragNleBlock, DragNleTiming, DblClkEditBlock };
@@ -75,6 +114,10 @@ class Reorganizer : public QWidget
     i32 NleXtoMS(i32);
 
     void PlayAudioRegion(i32 beginMs, i32 endMs);
+    void MovePlayhead(); ///< To where the output is, repainting only the strips it left and entered
+    QRect PlayheadStrip(i32 x) const;
+    /// Waveform columns [index, index + 1) * WaveTileWidth at mWaveTileSpp, made when first used
+    const QPixmap &WaveTile(i64 index, const QColor &color);
 
     // Model interface
     Status AppendToModel(u64 begin, u64 end, QString dialog);
@@ -82,27 +125,43 @@ class Reorganizer : public QWidget
 
     i32 FindDialogAt(u64 at); ///< Bisect model to find a dialog that goes through a time
 
+    // Every change to the undo stack goes through these, so it can be journaled
+    void PushCommand(LRCmd::CmdBase *cmd);
+    void BeginMacro(const QString &text);
+    void EndMacro();
+    void HistoryChanged(); ///< Keep the history under budget and report how much it holds
+
+    void RecoverJournal();
+    void CheckJournal(); ///< Tell the user if the journal stopped on a failed write
+
+    void JumpToSearchHit(i32 hit);
+
     Status CommitCurrentOperation();
+    Status RetimeFromActiveLine(const TimeMap &map);
 
     void UpdateTimecodeButtons();
     void UpdateListArea();
     void UpdateNLEArea();
     void UpdateAll();
+    i32 NleAreaHeight() const { return NleHeight + (mShowSpectrogram ? SpectrogramHeight : 0); }
 
     void UpdateExternals(bool force = false);
 
     void EditBlockTextInSitu_Placement(QPointF bottomLeft);
 
-  private: // Helper functions
-    QVector<DiscreteWord> SplitDialogByDelim(QString dialog, QString delims = " \n\t");
-
   private: // Properties
     // Model
-    QVector<Dialog> mModel;
-    WavDecoder mWav;
+    DialogSeq mModel;
+    SearchIndex mSearch; ///< Listens to mModel
+    QString mFileName; ///< SRT file the model was loaded from or last saved to
+    WavDecoder *mWav; ///< Or a decoder derived from it, for the audio opened last
+    QString mWavName;
+    Spectrogram mSpectro;
+    i32 mSpectroMsBegin, mSpectroMsEnd, mSpectroWidth; ///< View its tiles were last asked for
 
     // Status
-    bool mDoUpdateScrollBarOnChange, mExpectingDblClk, mWaveformPlaying, mNleDragging;
+    bool mDoUpdateScrollBarOnChange, mExpectingDblClk, mWaveformPlaying, mNleDragging,
+         mShowSpectrogram, mCompactAudio;
     DirtyActionType mDirtyActionType;
     i32 mCurrentLine, mCurrentOperatingLine, mCurrentEditingWord, mCurrentLongestLine,
         mCurrentActiveLine;
@@ -112,6 +171,13 @@ class Reorganizer : public QWidget
     QTime mMouseDownTime; ///< Only for double click detection
     enum { NoDrag = 0, AtPlace, MergeNext, MergePrev, SplitNext, SplitPrev } mDesiredDragOp;
 
+    // Last search, the hits are found again once the model has changed
+    QString mSearchText;
+    bool mSearchWholeWords;
+    QVector<SearchHit> mSearchHits;
+    i32 mSearchPos;
+    u64 mSearchVersion;
+
     // NLE Editor
     i32 mNleRangeMsBegin, mNleRangeMsEnd, mNleMaximumLengthMs;
     i32 mAudioPlayRegionA, mAudioPlayRegionB; ///< In milliseconds
@@ -121,18 +187,36 @@ class Reorganizer : public QWidget
     enum UpdateAreaFlag { NoUpd = 0, ListArea = 1, NleArea = 2 };
     i32 mUpdateArea;
 
-    // Undo stack
+    // Undo stack, and the log of everything done to it since the file was written
     QUndoStack mUndo;
+    UndoBudget mBudget;
+    Journal mJournal;
+    i32 mMacroDepth;
+    i32 mMacroIndexBefore; ///< Stack index from before the outermost macro was begun
+
+    // Background save, result is the error message
+    QFutureWatcher<QString> mSaveWatcher;
+    QString mSaveFrom, mSaveTo; ///< mFileName when the save started, and where it goes
+    u64 mSaveVersion;
 
     // Related components
     QScrollBar *mBarHoriz, *mBarVert, *mBarNleHoriz;
     QFont mDispFont;
     QFontMetricsF mDispFontMet;
+    FontMeasurer mMeasurer;
+    WordSplitter mSplitter; ///< Measures with mMeasurer
 
     QPushButton *mBtnBegin, *mBtnEnd;
 
     // Player
-    QAudioOutput mAudioOut;
+    Player mPlayer;
+    QTimer mPlayheadTimer; ///< Runs only while playing
+    i32 mPlayheadX; ///< -1 when not shown
+    bool mFollowPlayhead;
+
+    // Waveform tiles, for the samples per pixel they were drawn at
+    QHash<i64, QPixmap> mWaveTiles;
+    f64 mWaveTileSpp;
 
     // In-situ Editor related
     QLineEdit *mEdit;
@@ -155,7 +239,12 @@ class Reorganizer : public QWidget
       BlockHeight = 60,
       NleScaleHeight = 30,
       NleHeight = WaveformHeight + BlockHeight + NleScaleHeight,
-      NleBlockMargin = 5
+      SpectrogramHeight = 120,
+      NleBlockMargin = 5,
+      WaveTileWidth = 256,
+      MaxWaveTiles = 64,
+      PlayheadInterval = 16, // Milliseconds
+      ClickSlop = 3 // Pixels the mouse may move for a click on the waveform to still be one
     ;
     static constexpr f64
       ScrollCoeff = -0.9,
@@ -169,54 +258,7 @@ class Reorganizer : public QWidget
 
   signals:
     void SendNotify(QString msg, int severity);
-
-};
-
-struct DiscreteWord
-{
-  QString text;
-  QChar delim;
-  f64 _cachedBlockWidthPx;
-};
-
-struct Dialog
-{
-  enum { Real, Placeholder } type;
-  u64 begin, duration;
-  QVector<DiscreteWord> words;
-  QString completeText;
-  u64 end() { return begin + duration; };
-
-  f64 width;
-  f64 UpdatedWidth()
-  {
-    f64 ret = 0.0;
-    for(auto &i : words)
-      ret += i._cachedBlockWidthPx;
-    return (width = ret);
-  }
-
-  QString& UpdatedCompleteText()
-  {
-    completeText.clear();
-    for(auto &j : words)
-    {
-      completeText += j.text;
-      if(j.delim.cell())
-        completeText += j.delim;
-    }
-    return completeText;
-  }
-};
-class AudioDataFeeder : public QObject
-{
-    Q_OBJECT
-  public:
-    AudioDataFeeder(QObject* parent, WavDecoder* wav);
-    void SetInterval(i32 ms);
-    void Start(QIODevice*);
-
-  public slots:
+    void HistoryUsage(qint64 inMemory, qint64 onDisk);
 
 };
 
@@ -0,0 +1,180 @@
+#include <replace.h>
+#include <QtConcurrent>
+#include <algorithm>
+#include <commands.h>
+#include <wordsplit.h>
+
+namespace
+{
+  static constexpr i32 ChunkLines = 1024;
+
+  struct Chunk
+  {
+    i32 from, to;
+    QVector<LineReplacement> found;
+  };
+
+  bool SameWord(const DiscreteWord &a, const DiscreteWord &b)
+  {
+    return a.delim == b.delim && a.text == b.text;
+  }
+
+  i32 ReplaceLiteral(QString &text, const ReplaceSpec &spec)
+  {
+    auto cs = spec.caseSensitive ? Qt::CaseSensitive : Qt::CaseInsensitive;
+    auto at = text.indexOf(spec.find, 0, cs);
+    if(at < 0)
+      return 0;
+    QString out;
+    i32 hits = 0, last = 0;
+    for(; at >= 0; at = text.indexOf(spec.find, last, cs), hits++)
+    {
+      out.append(text.constData() + last, at - last);
+      out += spec.replacement;
+      last = at + spec.find.size();
+    }
+    out.append(text.constData() + last, text.size() - last);
+    text = out;
+    return hits;
+  }
+
+  // \0 to \9 are captures, \\ is a backslash, anything else is taken as it is
+  void Expand(QString &out, const QString &replacement, const QRegularExpressionMatch &m)
+  {
+    for(i32 i = 0; i < replacement.size(); i++)
+    {
+      auto c = replacement[i];
+      if(c == '\\' && i + 1 < replacement.size())
+      {
+        auto next = replacement[i + 1];
+        if(next.isDigit() && next.digitValue() <= m.lastCapturedIndex())
+        {
+          out += m.captured(next.digitValue());
+          i++;
+          continue;
+        }
+        if(next == '\\')
+          i++;
+      }
+      out += c;
+    }
+  }
+
+  i32 ReplaceRegex(QString &text, const QRegularExpression &re, const QString &replacement)
+  {
+    auto it = re.globalMatch(text);
+    if(!it.hasNext())
+      return 0;
+    QString out;
+    i32 hits = 0, last = 0;
+    while(it.hasNext())
+    {
+      auto m = it.next();
+      out.append(text.constData() + last, m.capturedStart() - last);
+      Expand(out, replacement, m);
+      last = m.capturedEnd();
+      hits++;
+    }
+    out.append(text.constData() + last, text.size() - last);
+    text = out;
+    return hits;
+  }
+}
+
+QRegularExpression ReplacePattern(const ReplaceSpec &spec)
+{
+  auto pattern = spec.regex ? spec.find : QRegularExpression::escape(spec.find);
+  // Lookarounds rather than \b, so a word may start or end with punctuation
+  if(spec.wholeWords)
+    pattern = "(?<!\\w)(?:" + pattern + ")(?!\\w)";
+  QRegularExpression::PatternOptions options = QRegularExpression::UseUnicodePropertiesOption;
+  if(!spec.caseSensitive)
+    options |= QRegularExpression::CaseInsensitiveOption;
+  return QRegularExpression(pattern, options);
+}
+
+QVector<LineReplacement> PlanReplace(const DialogSnapshot &model, const ReplaceSpec &spec,
+                                     const DictionarySegmenter *dict)
+{
+  auto pattern = ReplacePattern(spec);
+  if(spec.find.isEmpty() || !pattern.isValid())
+    return { };
+
+  QVector<Chunk> chunks;
+  for(i32 i = 0; i < model.size(); i += ChunkLines)
+    chunks.append(Chunk { .from = i, .to = std::min(i + ChunkLines, model.size()) });
+  const bool literal = !spec.regex && !spec.wholeWords;
+
+  QtConcurrent::blockingMap(chunks, [&model, &spec, &pattern, literal, dict](Chunk &c)
+  {
+    // QRegularExpression is only reentrant, every chunk gets its own
+    QRegularExpression re(pattern.pattern(), pattern.patternOptions());
+    NoMeasurer unmeasured;
+    auto it = model.IteratorAt(c.from);
+    for(i32 i = c.from; i < c.to; i++, ++it)
+    {
+      auto d = *it;
+      auto before = d.CompleteText();
+      auto after = before;
+      auto hits = literal ? ReplaceLiteral(after, spec) : ReplaceRegex(after, re, spec.replacement);
+      if(!hits || after == before)
+        continue;
+
+      // Keep the words both ends have in common, along with their widths
+      auto words = SplitDialog(after, unmeasured, dict);
+      i32 n = d.words.size(), m = words.size(), head = 0, tail = 0;
+      while(head < n && head < m && SameWord(d.words[head], words[head]))
+        head++;
+      while(tail < n - head && tail < m - head && SameWord(d.words[n - 1 - tail], words[m - 1 - tail]))
+        tail++;
+      if(head + tail == n && head + tail == m)
+        continue;
+      LineReplacement r {
+        .dialog = i,
+        .hits = hits,
+        .word = head,
+        .removed = n - head - tail,
+        .words = words.mid(head, m - head - tail),
+        .before = before,
+        .after = after
+      };
+      c.found.append(r);
+    }
+  });
+
+  QVector<LineReplacement> ret;
+  for(auto &c : chunks)
+    ret += c.found;
+  return ret;
+}
+
+i32 ApplyReplace(DialogSeq &model, const QVector<LineReplacement> &lines, const TextMeasurer &measurer,
+                 const std::function<void(LRCmd::CmdBase*)> &push)
+{
+  i32 replaced = 0;
+  for(auto &r : lines)
+  {
+    if(r.dialog < 0 || r.dialog >= model.size())
+      continue;
+    auto d = model.at(r.dialog);
+    if(r.word + r.removed > d.words.size() || d.CompleteText() != r.before)
+      continue;
+    auto words = r.words;
+    MeasureWords(words, measurer);
+
+    // ChangeWord keeps the delimiter, words whose delimiter changes are removed and inserted.
+    // Changes to one line merge into a single ChangeWord.
+    i32 k = 0;
+    for(; k < r.removed && k < words.size() && d.words[r.word + k].delim == words[k].delim; k++)
+      push(new LRCmd::ChangeWord(model, r.dialog, r.word + k, words[k]));
+    for(i32 j = k; j < r.removed; j++)
+      push(new LRCmd::RemoveWord(model, r.dialog, r.word + k));
+    if(k < words.size())
+    {
+      auto rest = words.mid(k);
+      push(new LRCmd::InsertWords(model, r.dialog, r.word + k, rest));
+    }
+    replaced += r.hits;
+  }
+  return replaced;
+}
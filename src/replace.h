@@ -0,0 +1,44 @@
+#pragma once
+
+#include <QRegularExpression>
+#include <QVector>
+#include <functional>
+#include <dialogseq.h>
+#include <textmeasurer.h>
+#include <wordsplit.h>
+#include <rint.h>
+
+namespace LRCmd { class CmdBase; }
+
+/// What to look for in the complete text of each line
+struct ReplaceSpec
+{
+  QString find;
+  QString replacement; ///< With regex, \1 to \9 are the captures
+  bool regex, caseSensitive, wholeWords;
+};
+
+/// The new words of one line. Only the words that differ are kept, they are measured when applied.
+struct LineReplacement
+{
+  i32 dialog, hits;
+  i32 word, removed; ///< Words [word, word + removed) of the line make way for words
+  QVector<DiscreteWord> words;
+  QString before, after; ///< Complete texts, for the preview
+};
+
+/// The pattern the spec describes, check isValid() before planning with it
+QRegularExpression ReplacePattern(const ReplaceSpec &spec);
+
+/// Find every line whose text changes and work out its new words, split as dict does. The model
+/// is scanned in chunks on the global thread pool, nothing is measured there.
+/// Lines come back in order. Nothing is returned for an invalid pattern.
+QVector<LineReplacement> PlanReplace(const DialogSnapshot &model, const ReplaceSpec &spec,
+                                     const DictionarySegmenter *dict = nullptr);
+
+/// Carry out the replacements with ChangeWord, RemoveWord and InsertWords, handing every
+/// command to push, which must redo it before returning. The new words are measured here, on
+/// the thread of the measurer. Lines that changed since planning are skipped. Returns how many
+/// hits were replaced.
+i32 ApplyReplace(DialogSeq &model, const QVector<LineReplacement> &lines, const TextMeasurer &measurer,
+                 const std::function<void(LRCmd::CmdBase*)> &push);
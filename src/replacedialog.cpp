@@ -0,0 +1,89 @@
+#include "replacedialog.h"
+#include <QDialogButtonBox>
+#include <QFormLayout>
+#include <QHeaderView>
+#include <QVBoxLayout>
+#include <replace.h>
+#include "reorganizer.h"
+
+ReplaceDialog::ReplaceDialog(Reorganizer *reorg, const QString &find, QWidget *parent) :
+  QDialog(parent),
+  mReorg(reorg)
+{
+  setWindowTitle(tr("Replace"));
+  mFind = new QLineEdit(find);
+  mReplacement = new QLineEdit;
+  mRegex = new QCheckBox(tr("Regular expression (\\1 to \\9 in the replacement are captures)"));
+  mCaseSensitive = new QCheckBox(tr("Match case"));
+  mWholeWords = new QCheckBox(tr("Match whole words"));
+
+  mPreview = new QTreeWidget;
+  mPreview->setHeaderLabels({ tr("Line"), tr("Before"), tr("After") });
+  mPreview->setRootIsDecorated(false);
+  mPreview->setUniformRowHeights(true);
+  mPreview->header()->setSectionResizeMode(QHeaderView::ResizeToContents);
+  mSummary = new QLabel;
+
+  auto buttons = new QDialogButtonBox(QDialogButtonBox::Close);
+  mBtnPreview = buttons->addButton(tr("Preview"), QDialogButtonBox::ActionRole);
+  mBtnReplace = buttons->addButton(tr("Replace all"), QDialogButtonBox::ApplyRole);
+
+  auto form = new QFormLayout;
+  form->addRow(tr("Find:"), mFind);
+  form->addRow(tr("Replace with:"), mReplacement);
+  auto layout = new QVBoxLayout(this);
+  layout->addLayout(form);
+  layout->addWidget(mRegex);
+  layout->addWidget(mCaseSensitive);
+  layout->addWidget(mWholeWords);
+  layout->addWidget(mPreview, 1);
+  layout->addWidget(mSummary);
+  layout->addWidget(buttons);
+  resize(800, 500);
+
+  connect(buttons, &QDialogButtonBox::rejected, this, &QDialog::reject);
+  connect(mBtnPreview, &QPushButton::clicked, this, &ReplaceDialog::Preview);
+  connect(mBtnReplace, &QPushButton::clicked, this, &ReplaceDialog::ReplaceAll);
+  connect(mFind, &QLineEdit::returnPressed, this, &ReplaceDialog::Preview);
+  auto enable = [this]()
+  {
+    mBtnPreview->setEnabled(!mFind->text().isEmpty());
+    mBtnReplace->setEnabled(!mFind->text().isEmpty());
+  };
+  connect(mFind, &QLineEdit::textChanged, enable);
+  enable();
+}
+
+ReplaceSpec ReplaceDialog::Spec() const
+{
+  return ReplaceSpec {
+    .find = mFind->text(),
+    .replacement = mReplacement->text(),
+    .regex = mRegex->isChecked(),
+    .caseSensitive = mCaseSensitive->isChecked(),
+    .wholeWords = mWholeWords->isChecked()
+  };
+}
+
+void ReplaceDialog::Preview()
+{
+  auto lines = mReorg->PreviewReplace(Spec());
+  mPreview->clear();
+  QList<QTreeWidgetItem*> items;
+  i32 hits = 0;
+  for(auto &i : lines)
+  {
+    hits += i.hits;
+    if(items.size() < MaxPreviewLines)
+      items.append(new QTreeWidgetItem({ QString::number(i.dialog + 1), i.before, i.after }));
+  }
+  mPreview->addTopLevelItems(items);
+  mSummary->setText(tr("%1 hits in %2 lines.").arg(hits).arg(lines.size()));
+}
+
+void ReplaceDialog::ReplaceAll()
+{
+  auto replaced = mReorg->Replace(Spec());
+  mPreview->clear();
+  mSummary->setText(tr("Replaced %1 times.").arg(replaced));
+}
@@ -0,0 +1,42 @@
+#ifndef REPLACEDIALOG_H
+#define REPLACEDIALOG_H
+
+#include <QDialog>
+#include <QCheckBox>
+#include <QLabel>
+#include <QLineEdit>
+#include <QPushButton>
+#include <QTreeWidget>
+#include <rint.h>
+
+class Reorganizer;
+struct ReplaceSpec;
+
+/// Find and replace over the whole file, with a preview of every line that would change
+class ReplaceDialog : public QDialog
+{
+    Q_OBJECT
+
+  public:
+    ReplaceDialog(Reorganizer *reorg, const QString &find, QWidget *parent = nullptr);
+
+    QString FindText() const { return mFind->text(); }
+
+  public:
+    constexpr static i32
+      MaxPreviewLines = 5000; ///< The count still covers all of them
+
+  private:
+    ReplaceSpec Spec() const;
+    void Preview();
+    void ReplaceAll();
+
+    Reorganizer *mReorg;
+    QLineEdit *mFind, *mReplacement;
+    QCheckBox *mRegex, *mCaseSensitive, *mWholeWords;
+    QTreeWidget *mPreview;
+    QLabel *mSummary;
+    QPushButton *mBtnPreview, *mBtnReplace;
+};
+
+#endif // REPLACEDIALOG_H
@@ -0,0 +1,312 @@
+#include <searchindex.h>
+#include <algorithm>
+#include <iterator>
+
+//
+// KeyOrder
+//
+
+SearchIndex::KeyOrder::KeyOrder() : mNodes(1, Node { 0, 0, 0, 0, 0 }), mRoot(0), mSeed(2463534242u) { }
+
+void SearchIndex::KeyOrder::Pull(u32 n)
+{
+  auto &node = mNodes[n];
+  node.size = 1 + mNodes[node.left].size + mNodes[node.right].size;
+  if(node.left)
+    mNodes[node.left].parent = n;
+  if(node.right)
+    mNodes[node.right].parent = n;
+}
+
+void SearchIndex::KeyOrder::Split(u32 t, i32 k, u32 &l, u32 &r)
+{
+  if(!t)
+  {
+    l = r = 0;
+    return;
+  }
+  mNodes[t].parent = 0;
+  i32 lc = mNodes[mNodes[t].left].size;
+  if(k <= lc)
+  {
+    u32 sub;
+    Split(mNodes[t].left, k, l, sub);
+    mNodes[t].left = sub;
+    r = t;
+  }
+  else
+  {
+    u32 sub;
+    Split(mNodes[t].right, k - lc - 1, sub, r);
+    mNodes[t].right = sub;
+    l = t;
+  }
+  Pull(t);
+}
+
+u32 SearchIndex::KeyOrder::Merge(u32 l, u32 r)
+{
+  if(!l || !r)
+    return l | r;
+  if(mNodes[l].priority > mNodes[r].priority)
+  {
+    mNodes[l].right = Merge(mNodes[l].right, r);
+    Pull(l);
+    return l;
+  }
+  mNodes[r].left = Merge(l, mNodes[r].left);
+  Pull(r);
+  return r;
+}
+
+u32 SearchIndex::KeyOrder::InsertAt(i32 pos)
+{
+  u32 key;
+  if(mFree.empty())
+  {
+    key = mNodes.size();
+    mNodes.push_back(Node { });
+  }
+  else
+  {
+    key = mFree.back();
+    mFree.pop_back();
+  }
+  // xorshift32, same as DialogSeq
+  mSeed ^= mSeed << 13;
+  mSeed ^= mSeed >> 17;
+  mSeed ^= mSeed << 5;
+  mNodes[key] = Node { 0, 0, 0, 1, mSeed };
+
+  u32 l, r;
+  Split(mRoot, pos, l, r);
+  mRoot = Merge(Merge(l, key), r);
+  mNodes[mRoot].parent = 0;
+  return key;
+}
+
+u32 SearchIndex::KeyOrder::RemoveAt(i32 pos)
+{
+  u32 l, m, r;
+  Split(mRoot, pos, l, m);
+  Split(m, 1, m, r);
+  mRoot = Merge(l, r);
+  mNodes[mRoot].parent = 0;
+  mFree.push_back(m);
+  return m;
+}
+
+u32 SearchIndex::KeyOrder::KeyAt(i32 pos) const
+{
+  auto n = mRoot;
+  while(true)
+  {
+    i32 lc = mNodes[mNodes[n].left].size;
+    if(pos < lc)
+      n = mNodes[n].left;
+    else if(pos == lc)
+      return n;
+    else
+    {
+      pos -= lc + 1;
+      n = mNodes[n].right;
+    }
+  }
+}
+
+i32 SearchIndex::KeyOrder::PositionOf(u32 key) const
+{
+  i32 pos = mNodes[mNodes[key].left].size;
+  for(auto n = key; n != mRoot; n = mNodes[n].parent)
+  {
+    auto p = mNodes[n].parent;
+    if(mNodes[p].right == n)
+      pos += mNodes[mNodes[p].left].size + 1;
+  }
+  return pos;
+}
+
+std::vector<u32> SearchIndex::KeyOrder::Keys() const
+{
+  std::vector<u32> ret, stack;
+  ret.reserve(size());
+  for(auto n = mRoot; n || !stack.empty(); )
+  {
+    if(n)
+    {
+      stack.push_back(n);
+      n = mNodes[n].left;
+      continue;
+    }
+    n = stack.back();
+    stack.pop_back();
+    ret.push_back(n);
+    n = mNodes[n].right;
+  }
+  return ret;
+}
+
+void SearchIndex::KeyOrder::Clear()
+{
+  mNodes.resize(1);
+  mFree.clear();
+  mRoot = 0;
+}
+
+//
+// SearchIndex
+//
+
+void SearchIndex::Inserted(i32 i, const Dialog &d)
+{
+  auto key = mOrder.InsertAt(i);
+  if(key >= mTexts.size())
+    mTexts.resize(key + 1);
+  Index(key, Fold(d));
+}
+
+void SearchIndex::Removed(i32 i)
+{
+  Unindex(mOrder.RemoveAt(i));
+}
+
+void SearchIndex::Changed(i32 i, const Dialog &d)
+{
+  auto key = mOrder.KeyAt(i);
+  auto text = Fold(d);
+  // Most touches are retiming or resizing, which leave the text alone
+  if(text == mTexts[key])
+    return;
+  Unindex(key);
+  Index(key, text);
+}
+
+void SearchIndex::Cleared()
+{
+  mOrder.Clear();
+  mTexts.clear();
+  mPostings.clear();
+}
+
+SearchIndex::Text SearchIndex::Fold(const Dialog &d)
+{
+  Text ret;
+  ret.starts.reserve(d.words.size());
+  for(i32 i = 0; i < d.words.size(); i++)
+  {
+    auto &w = d.words[i];
+    ret.starts.push_back(ret.text.size());
+    ret.text += w.text.toCaseFolded();
+    // Any delimiter is a space to the query, words without one run on
+    if(w.delim.unicode() && i + 1 < d.words.size())
+      ret.text += ' ';
+  }
+  return ret;
+}
+
+std::vector<u64> SearchIndex::Trigrams(const QString &text)
+{
+  std::vector<u64> ret;
+  auto c = text.constData();
+  for(i32 i = 0; i + 3 <= text.size(); i++)
+    ret.push_back((u64)c[i].unicode() << 32 | (u64)c[i + 1].unicode() << 16 | c[i + 2].unicode());
+  std::sort(ret.begin(), ret.end());
+  ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+  return ret;
+}
+
+void SearchIndex::Index(u32 key, const Text &text)
+{
+  mTexts[key] = text;
+  for(auto g : Trigrams(text.text))
+  {
+    auto &keys = mPostings[g];
+    keys.insert(std::lower_bound(keys.begin(), keys.end(), key), key);
+  }
+}
+
+void SearchIndex::Unindex(u32 key)
+{
+  for(auto g : Trigrams(mTexts[key].text))
+  {
+    auto it = mPostings.find(g);
+    if(it == mPostings.end())
+      continue;
+    auto &keys = it.value();
+    auto at = std::lower_bound(keys.begin(), keys.end(), key);
+    if(at != keys.end() && *at == key)
+      keys.erase(at);
+    if(keys.empty())
+      mPostings.erase(it);
+  }
+  mTexts[key] = Text { };
+}
+
+void SearchIndex::Match(u32 key, i32 dialog, const QString &query, Mode mode, QVector<SearchHit> &out) const
+{
+  auto &text = mTexts[key].text;
+  auto &starts = mTexts[key].starts;
+  // The word a position of the text is in
+  auto wordAt = [&starts](i32 at) -> i32
+  {
+    return std::upper_bound(starts.begin(), starts.end(), at) - starts.begin() - 1;
+  };
+  for(i32 at = text.indexOf(query); at >= 0; at = text.indexOf(query, at + 1))
+  {
+    auto end = at + query.size();
+    // As in replace, a whole word is not next to a letter or digit, so punctuation ends it too
+    if(mode == WholeWords && ((at > 0 && text[at - 1].isLetterOrNumber()) ||
+                              (end < text.size() && text[end].isLetterOrNumber())))
+      continue;
+    if(dialog < 0)
+      dialog = mOrder.PositionOf(key);
+    auto word = wordAt(at);
+    out.append(SearchHit { dialog, word, wordAt(end - 1) - word + 1 });
+  }
+}
+
+QVector<SearchHit> SearchIndex::Find(const QString &query, Mode mode) const
+{
+  QVector<SearchHit> ret;
+  auto q = query.simplified().toCaseFolded();
+  if(q.isEmpty())
+    return ret;
+
+  if(q.size() < 3)
+  {
+    i32 dialog = 0;
+    for(auto key : mOrder.Keys())
+      Match(key, dialog++, q, mode, ret);
+    return ret;
+  }
+
+  // Rarest trigram first, the intersection only gets smaller
+  std::vector<const std::vector<u32>*> lists;
+  for(auto g : Trigrams(q))
+  {
+    auto it = mPostings.constFind(g);
+    if(it == mPostings.constEnd())
+      return ret;
+    lists.push_back(&it.value());
+  }
+  std::sort(lists.begin(), lists.end(), [](const std::vector<u32> *a, const std::vector<u32> *b)
+  {
+    return a->size() < b->size();
+  });
+  auto candidates = *lists.front();
+  for(size_t i = 1; i < lists.size() && !candidates.empty(); i++)
+  {
+    std::vector<u32> kept;
+    std::set_intersection(candidates.begin(), candidates.end(), lists[i]->begin(), lists[i]->end(),
+                          std::back_inserter(kept));
+    candidates.swap(kept);
+  }
+
+  for(auto key : candidates)
+    Match(key, -1, q, mode, ret);
+  std::sort(ret.begin(), ret.end(), [](const SearchHit &a, const SearchHit &b)
+  {
+    return a.dialog != b.dialog ? a.dialog < b.dialog : a.word < b.word;
+  });
+  return ret;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include <vector>
+#include <dialogseq.h>
+#include <rint.h>
+
+/// Where a search matched: the first word it touches and how many words it spans
+struct SearchHit
+{
+  i32 dialog, word, words;
+};
+
+/// Full-text index over the words of a DialogSeq, kept up to date as a DialogSeqListener.
+///
+/// Every dialog is kept case folded, its words joined by a space where they have a delimiter and
+/// by nothing where they don't, and listed under each trigram in it. A query looks up the dialogs
+/// holding all of its trigrams and only checks those, queries under three characters check every
+/// dialog but never go back to the model.
+///
+/// Dialogs are filed under a key that stays the same while lines come and go around them,
+/// KeyOrder turns keys into positions in O(log n).
+class SearchIndex : public DialogSeqListener
+{
+  public:
+    enum Mode { Substring, WholeWords };
+
+    void Inserted(i32 i, const Dialog &d) override;
+    void Removed(i32 i) override;
+    void Changed(i32 i, const Dialog &d) override;
+    void Cleared() override;
+
+    /// Case-insensitive, runs of white space in the query match a word boundary. WholeWords hits
+    /// are not next to a letter or digit.
+    /// Hits are in model order.
+    QVector<SearchHit> Find(const QString &query, Mode mode) const;
+
+    i32 size() const { return mOrder.size(); }
+
+  private:
+    /// Keys in model order, a treap with parent links so a key finds its own position
+    class KeyOrder
+    {
+      public:
+        KeyOrder();
+        u32 InsertAt(i32 pos); ///< Returns the new key
+        u32 RemoveAt(i32 pos); ///< Returns the key that was there, which may be handed out again
+        u32 KeyAt(i32 pos) const;
+        i32 PositionOf(u32 key) const;
+        std::vector<u32> Keys() const; ///< All of them, in order
+        void Clear();
+        i32 size() const { return mNodes[mRoot].size; }
+
+      private:
+        struct Node
+        {
+          u32 left, right, parent, size, priority;
+        };
+        void Pull(u32 n);
+        void Split(u32 t, i32 k, u32 &l, u32 &r);
+        u32 Merge(u32 l, u32 r);
+
+        std::vector<Node> mNodes; ///< Indexed by key, 0 is the empty tree
+        std::vector<u32> mFree;
+        u32 mRoot, mSeed;
+    };
+
+    struct Text
+    {
+      QString text;
+      std::vector<i32> starts; ///< Where each word begins in text
+      bool operator==(const Text &o) const { return text == o.text && starts == o.starts; }
+    };
+
+    static Text Fold(const Dialog &d);
+    static std::vector<u64> Trigrams(const QString &text); ///< Sorted, no duplicates
+    void Index(u32 key, const Text &text);
+    void Unindex(u32 key);
+    /// Append the hits in one dialog, dialog is its position if known already
+    void Match(u32 key, i32 dialog, const QString &query, Mode mode, QVector<SearchHit> &out) const;
+
+    KeyOrder mOrder;
+    std::vector<Text> mTexts; ///< Indexed by key
+    QHash<u64, std::vector<u32>> mPostings; ///< Trigram to the sorted keys of the dialogs holding it
+};
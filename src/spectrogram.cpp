@@ -0,0 +1,193 @@
+#include <spectrogram.h>
+#include <QRunnable>
+#include <QThread>
+#include <functional>
+#include <math.h>
+
+namespace
+{
+  class Job : public QRunnable
+  {
+    public:
+      explicit Job(std::function<void()> work) : mWork(std::move(work)) { }
+      void run() override { mWork(); }
+
+    private:
+      std::function<void()> mWork;
+  };
+
+  // Magma, from silence to loud
+  QVector<QRgb> Palette()
+  {
+    static const QRgb Stops[] = { qRgb(0, 0, 4), qRgb(80, 18, 123), qRgb(182, 54, 121),
+                                  qRgb(251, 136, 97), qRgb(252, 253, 191) };
+    QVector<QRgb> ret(256);
+    for(i32 i = 0; i < 256; i++)
+    {
+      auto pos = i / 255.0 * 4;
+      i32 s = std::min((i32)pos, 3);
+      auto t = pos - s;
+      auto mix = [t](i32 a, i32 b) { return (i32)lround(a + (b - a) * t); };
+      ret[i] = qRgb(mix(qRed(Stops[s]), qRed(Stops[s + 1])),
+                    mix(qGreen(Stops[s]), qGreen(Stops[s + 1])),
+                    mix(qBlue(Stops[s]), qBlue(Stops[s + 1])));
+    }
+    return ret;
+  }
+
+  f64 Mel(f64 hz) { return 2595.0 * log10(1.0 + hz / 700.0); }
+  f64 Hz(f64 mel) { return 700.0 * (pow(10.0, mel / 2595.0) - 1.0); }
+}
+
+Spectrogram::Spectrogram(QObject *parent) :
+  QObject(parent), mFft(FftSize), mGeneration(0), mFrame(0)
+{
+  // Leave a core for the GUI thread
+  mPool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() - 1));
+}
+
+Spectrogram::~Spectrogram()
+{
+  mPool.clear();
+  mPool.waitForDone();
+}
+
+void Spectrogram::SetSource(const MonoReader &audio)
+{
+  mGeneration++;
+  mPool.clear();
+  mPending.clear();
+  mLevels.clear();
+  mAudio = audio;
+  mRowBins.clear();
+  if(audio.isEmpty() || audio.SampleRate() <= 0)
+    return;
+
+  // Row 0 is the top, bands are even in mel
+  const f64 top = Mel(std::min<f64>(MaxHz, audio.SampleRate() / 2.0)),
+            binHz = (f64)audio.SampleRate() / FftSize;
+  const i32 lastBin = FftSize / 2;
+  mRowBins.resize(Rows);
+  for(i32 r = 0; r < Rows; r++)
+  {
+    auto lo = Hz(top * (Rows - 1 - r) / Rows), hi = Hz(top * (Rows - r) / Rows);
+    i32 first = std::min((i32)floor(lo / binHz), lastBin - 1);
+    i32 last = std::min(std::max(first + 1, (i32)ceil(hi / binHz)), lastBin);
+    mRowBins[r] = qMakePair(first, last);
+  }
+}
+
+i32 Spectrogram::LevelFor(f64 samplesPerPx)
+{
+  i32 ret = MinLevel;
+  while(ret < MaxLevel && (f64)(2ll << ret) <= samplesPerPx)
+    ret++;
+  return ret;
+}
+
+QImage Spectrogram::CachedTile(i32 level, i64 index) const
+{
+  auto l = mLevels.constFind(level);
+  if(l == mLevels.constEnd())
+    return QImage();
+  auto t = l->tiles.constFind(index);
+  return t == l->tiles.constEnd() ? QImage() : t->first;
+}
+
+QImage Spectrogram::Tile(i32 level, i64 index)
+{
+  auto &l = mLevels[level];
+  auto t = l.tiles.find(index);
+  if(t != l.tiles.end())
+  {
+    l.order.splice(l.order.begin(), l.order, t->second);
+    return t->first;
+  }
+
+  auto key = Key(level, index);
+  if(mRowBins.isEmpty() || index < 0 || index * TileColumns << level >= mAudio.Frames() ||
+     mPending.contains(key))
+    return QImage();
+  mPending.insert(key);
+
+  // The newest frame goes first, a tile scrolled away before its turn is not computed at all
+  auto generation = mGeneration;
+  i32 frame = mFrame;
+  auto audio = mAudio;
+  auto bins = mRowBins;
+  auto fft = &mFft;
+  auto frameNow = &mFrame;
+  mPool.start(new Job([this, generation, frame, audio, bins, fft, frameNow, level, index]()
+  {
+    QImage tile;
+    if(*frameNow - frame <= 2)
+      tile = Compute(audio, *fft, bins, level, index);
+    QMetaObject::invokeMethod(this, [this, generation, level, index, tile]()
+    {
+      Insert(generation, level, index, tile);
+    }, Qt::QueuedConnection);
+  }), frame);
+  return QImage();
+}
+
+void Spectrogram::Insert(u32 generation, i32 level, i64 index, const QImage &tile)
+{
+  if(generation != mGeneration)
+    return;
+  mPending.remove(Key(level, index));
+  if(tile.isNull())
+    return;
+  auto &l = mLevels[level];
+  if(l.tiles.contains(index))
+    return;
+  l.order.push_front(index);
+  l.tiles.insert(index, qMakePair(tile, l.order.begin()));
+  if(l.tiles.size() > TilesPerLevel)
+  {
+    l.tiles.remove(l.order.back());
+    l.order.pop_back();
+  }
+  emit TileReady();
+}
+
+QImage Spectrogram::Compute(const MonoReader &audio, const Fft &fft, const QVector<QPair<i32, i32>> &bins,
+                            i32 level, i64 index)
+{
+  static const QVector<QRgb> Colors = Palette();
+  static const std::vector<f32> Window = []() -> std::vector<f32>
+  {
+    std::vector<f32> ret(FftSize);
+    for(i32 i = 0; i < FftSize; i++)
+      ret[i] = 0.5 - 0.5 * cos(2 * M_PI * i / FftSize);
+    return ret;
+  }();
+  // A full scale sine under the Hann window peaks at a quarter of the size
+  const f32 ref = (FftSize / 4.0f) * (FftSize / 4.0f), floorDb = FloorDb;
+
+  QImage ret(TileColumns, Rows, QImage::Format_Indexed8);
+  ret.setColorTable(Colors);
+  std::vector<f32> samples(FftSize), power(FftSize / 2);
+  std::vector<std::complex<f32>> buf(FftSize);
+  const i64 hop = 1ll << level;
+  for(i32 c = 0; c < TileColumns; c++)
+  {
+    auto center = (index * TileColumns + c) * hop + hop / 2;
+    audio.Read(center - FftSize / 2, FftSize, samples.data());
+    for(i32 i = 0; i < FftSize; i++)
+      buf[i] = std::complex<f32>(samples[i] * Window[i], 0.0f);
+    fft.Transform(buf.data());
+    for(i32 i = 0; i < FftSize / 2; i++)
+      power[i] = std::norm(buf[i]);
+
+    for(i32 r = 0; r < Rows; r++)
+    {
+      f32 p = 0;
+      for(i32 b = bins[r].first; b < bins[r].second; b++)
+        p = std::max(p, power[b]);
+      auto db = p > 0 ? 10.0f * log10f(p / ref) : floorDb;
+      auto loudness = (db - floorDb) / -floorDb;
+      ret.scanLine(r)[c] = (u8)std::min(std::max(loudness * 255.0f, 0.0f), 255.0f);
+    }
+  }
+  return ret;
+}
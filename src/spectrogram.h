@@ -0,0 +1,74 @@
+#pragma once
+
+#include <QHash>
+#include <QImage>
+#include <QObject>
+#include <QSet>
+#include <QThreadPool>
+#include <atomic>
+#include <list>
+#include <fft.h>
+#include <wavdecoder.h>
+#include <rint.h>
+
+/// STFT magnitudes of the audio as image tiles, computed on a thread pool of its own.
+///
+/// A tile is TileColumns columns of one zoom level, level l being 2^l samples per column, and
+/// Rows rows of mel spaced frequencies, highest on top. Tiles are Indexed8 images, so a level's
+/// LRU of TilesPerLevel costs 2 MB at most. Asking for a tile that is not there yet queues it,
+/// TileReady() is emitted on the GUI thread once it is in.
+class Spectrogram : public QObject
+{
+    Q_OBJECT
+
+  public:
+    static constexpr i32
+      FftSize = 512,
+      TileColumns = 256,
+      Rows = 128,
+      TilesPerLevel = 64,
+      MinLevel = 3,
+      MaxLevel = 20;
+    static constexpr f32
+      MaxHz = 11025.0f,
+      FloorDb = -100.0f;
+
+    explicit Spectrogram(QObject *parent = nullptr);
+    ~Spectrogram(); ///< Waits for the tiles being computed
+
+    /// Drop every tile and start over with this audio
+    void SetSource(const MonoReader &audio);
+
+    /// Level for a zoom, the coarsest one that still has a column for every pixel
+    static i32 LevelFor(f64 samplesPerPx);
+
+    /// The tile if it is cached, a null image if not. Missing tiles are computed in the order
+    /// they were last asked for, those still queued a few frames later are skipped.
+    QImage Tile(i32 level, i64 index);
+    QImage CachedTile(i32 level, i64 index) const; ///< Never queues anything
+    void NextFrame() { mFrame++; } ///< Call when the view has moved, before asking for its tiles
+
+  signals:
+    void TileReady();
+
+  private:
+    struct Level
+    {
+      std::list<i64> order; ///< Most recently used first
+      QHash<i64, QPair<QImage, std::list<i64>::iterator>> tiles;
+    };
+
+    static u64 Key(i32 level, i64 index) { return (u64)level << 56 | (u64)index; }
+    static QImage Compute(const MonoReader &audio, const Fft &fft, const QVector<QPair<i32, i32>> &bins,
+                          i32 level, i64 index);
+    void Insert(u32 generation, i32 level, i64 index, const QImage &tile);
+
+    MonoReader mAudio;
+    Fft mFft;
+    QVector<QPair<i32, i32>> mRowBins; ///< [first, last) FFT bin of every row, for mAudio's rate
+    QHash<i32, Level> mLevels;
+    QSet<u64> mPending;
+    u32 mGeneration;
+    std::atomic<i32> mFrame;
+    QThreadPool mPool;
+};
@@ -0,0 +1,72 @@
+#include <srtreader.h>
+#include <QTextStream>
+#include <stdio.h>
+#include <util.h>
+#include <wordsplit.h>
+
+Status AppendDialog(DialogSeq &model, u64 begin, u64 end, const QString &text, const TextMeasurer &measurer)
+{
+  return AppendDialog(model, begin, end, text, SplitDialog(text, measurer));
+}
+
+Status AppendDialog(DialogSeq &model, u64 begin, u64 end, const QString &text, QVector<DiscreteWord> words)
+{
+  if(model.size())
+  {
+    auto lastEnd = model.back().end();
+    if(begin < lastEnd)
+      return FailOccupied;
+  }
+  Dialog d { .type = Dialog::Real,
+             .begin = begin,
+             .duration = end - begin,
+             .words = std::move(words),
+             .completeText = text };
+  d.UpdatedWidth();
+  model.append(d);
+  return Success;
+}
+
+i32 ReadSrt(QIODevice *dev, const WordSplitter &splitter, DialogSeq &model)
+{
+  // Crappy SRT read routine
+  QTextStream ts(dev);
+  QString line, currtext;
+  QVector<QPair<u64, u64>> times;
+  QStringList texts;
+  int h1 = 0, m1 = 0, s1 = 0, ms1 = 0, h2 = 0, m2 = 0, s2 = 0, ms2 = 0;
+  i32 ret = 0;
+  ts.setCodec("UTF-8");
+  while(!ts.atEnd())
+  { // Assume input is completely sane
+    line = ts.readLine(); // Sequence number
+    line = ts.readLine(); // Timecode
+    sscanf(line.toStdString().c_str(),
+           "%d:%d:%d,%d --> %d:%d:%d,%d",
+           &h1, &m1, &s1, &ms1, &h2, &m2, &s2, &ms2);
+    currtext = ts.readLine();
+    while(!ts.atEnd())
+    {
+      if((line = ts.readLine()) == "")
+        break;
+      else
+        currtext += '\n' + line;
+    };
+
+    times.append(qMakePair(TCtoMS(h1, m1, s1, ms1), TCtoMS(h2, m2, s2, ms2)));
+    texts.append(currtext);
+
+    // Cleanup
+    currtext.clear();
+    h1 = 0, m1 = 0, s1 = 0, ms1 = 0, h2 = 0, m2 = 0, s2 = 0, ms2 = 0;
+  }
+
+  // Add them into internal data model
+  auto words = splitter.SplitAll(texts);
+  for(i32 i = 0; i < texts.size(); i++)
+  {
+    if(AppendDialog(model, times[i].first, times[i].second, texts[i], std::move(words[i])) == Success)
+      ret++;
+  }
+  return ret;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <QIODevice>
+#include <common.h>
+#include <dialogseq.h>
+#include <textmeasurer.h>
+#include <wordsplit.h>
+
+/// Append a dialog made from text. Refused with FailOccupied if it begins before the last one ends.
+Status AppendDialog(DialogSeq &model, u64 begin, u64 end, const QString &text, const TextMeasurer &measurer);
+/// Same, with the text already split into words
+Status AppendDialog(DialogSeq &model, u64 begin, u64 end, const QString &text, QVector<DiscreteWord> words);
+
+/// Parse SRT from dev and append the dialogs to model. Returns how many were appended.
+/// The dialogs are split into words all at once, in parallel.
+i32 ReadSrt(QIODevice *dev, const WordSplitter &splitter, DialogSeq &model);
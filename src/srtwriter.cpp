@@ -0,0 +1,135 @@
+#include <srtwriter.h>
+#include <QSaveFile>
+#include <algorithm>
+#include <string.h>
+
+// Typical dialog: sequence number, two timecodes, text and line breaks
+static constexpr i32 EstimatedDialogBytes = 96;
+
+SrtWriter::SrtWriter(i32 expectedDialogs) : mLength(0), mCount(0)
+{
+  mBuf.resize(std::max(expectedDialogs, 16) * EstimatedDialogBytes);
+}
+
+void SrtWriter::Append(const Dialog &d)
+{
+  WriteNumber(++mCount);
+  *Reserve(1) = '\n'; mLength++;
+  WriteTimecode(d.begin);
+  memcpy(Reserve(5), " --> ", 5); mLength += 5;
+  WriteTimecode(d.end());
+  *Reserve(1) = '\n'; mLength++;
+  for(auto &j : d.words)
+  {
+    WriteText(j.text.constData(), j.text.size());
+    if(j.delim.cell())
+      WriteText(&j.delim, 1);
+  }
+  memcpy(Reserve(2), "\n\n", 2); mLength += 2;
+}
+
+const QByteArray &SrtWriter::Data()
+{
+  mBuf.truncate(mLength);
+  return mBuf;
+}
+
+char *SrtWriter::Reserve(i32 bytes)
+{
+  if(mLength + bytes > mBuf.size())
+    mBuf.resize(std::max(mBuf.size() * 2, mLength + bytes));
+  return mBuf.data() + mLength;
+}
+
+void SrtWriter::WriteNumber(u64 x)
+{
+  char digits[20];
+  i32 n = 0;
+  do
+  {
+    digits[n++] = '0' + x % 10;
+    x /= 10;
+  } while(x);
+  auto p = Reserve(n);
+  while(n)
+    *p++ = digits[--n];
+  mLength = p - mBuf.data();
+}
+
+void SrtWriter::WriteTimecode(u64 ms)
+{
+  auto h = ms / 3600000;
+  if(h > 99)
+  {
+    // Rare enough to not bother with a fast path
+    WriteNumber(h);
+  }
+  else
+  {
+    auto p = Reserve(2);
+    p[0] = '0' + h / 10;
+    p[1] = '0' + h % 10;
+    mLength += 2;
+  }
+  u32 m = ms % 3600000 / 60000, s = ms % 60000 / 1000, f = ms % 1000;
+  auto p = Reserve(10);
+  p[0] = ':';
+  p[1] = '0' + m / 10;
+  p[2] = '0' + m % 10;
+  p[3] = ':';
+  p[4] = '0' + s / 10;
+  p[5] = '0' + s % 10;
+  p[6] = ',';
+  p[7] = '0' + f / 100;
+  p[8] = '0' + f / 10 % 10;
+  p[9] = '0' + f % 10;
+  mLength += 10;
+}
+
+void SrtWriter::WriteText(const QChar *src, i32 size)
+{
+  auto p = Reserve(size * 3); // A UTF-16 unit never takes more than 3 bytes, surrogate pairs take 4 for 2
+  for(i32 i = 0; i < size; i++)
+  {
+    u32 c = src[i].unicode();
+    if(c < 0x80)
+      *p++ = c;
+    else if(c < 0x800)
+    {
+      *p++ = 0xC0 | (c >> 6);
+      *p++ = 0x80 | (c & 0x3F);
+    }
+    else if(src[i].isHighSurrogate() && i + 1 < size && src[i + 1].isLowSurrogate())
+    {
+      c = QChar::surrogateToUcs4(src[i], src[i + 1]);
+      i++;
+      *p++ = 0xF0 | (c >> 18);
+      *p++ = 0x80 | ((c >> 12) & 0x3F);
+      *p++ = 0x80 | ((c >> 6) & 0x3F);
+      *p++ = 0x80 | (c & 0x3F);
+    }
+    else
+    {
+      *p++ = 0xE0 | (c >> 12);
+      *p++ = 0x80 | ((c >> 6) & 0x3F);
+      *p++ = 0x80 | (c & 0x3F);
+    }
+  }
+  mLength = p - mBuf.data();
+}
+
+QString SaveSrt(const QString &name, const QByteArray &data)
+{
+  QSaveFile f(name);
+  if(!f.open(QFile::WriteOnly))
+    return f.errorString();
+  if(f.write(data) != data.size())
+  {
+    auto err = f.errorString();
+    f.cancelWriting();
+    return err;
+  }
+  if(!f.commit())
+    return f.errorString();
+  return QString();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <dialog.h>
+#include <rint.h>
+
+/// Formats dialogs as SRT straight into one growing UTF-8 buffer.
+///
+/// No QString is built on the way, timecodes and sequence numbers are written digit by digit
+/// and the words are encoded as they are copied. Safe to use on any thread.
+class SrtWriter
+{
+  public:
+    explicit SrtWriter(i32 expectedDialogs = 0);
+
+    void Append(const Dialog &d);
+    const QByteArray &Data(); ///< Trims the buffer to what was written
+
+  private:
+    char *Reserve(i32 bytes); ///< Returns the write pointer with at least this many bytes after it
+    void WriteNumber(u64 x);
+    void WriteTimecode(u64 ms);
+    void WriteText(const QChar *src, i32 size);
+
+    QByteArray mBuf;
+    i32 mLength, mCount;
+};
+
+/// Serialize and write to name atomically, the old file is kept intact if anything fails.
+/// Returns an empty string on success, otherwise the error message.
+QString SaveSrt(const QString &name, const QByteArray &data);
@@ -0,0 +1,27 @@
+#include <textmeasurer.h>
+
+f64 FixedPitchMeasurer::WordWidth(const QString &word) const
+{
+  i32 cells = 0;
+  for(i32 i = 0; i < word.size(); i++)
+  {
+    u32 ucs4 = word[i].unicode();
+    if(word[i].isHighSurrogate() && i + 1 < word.size() && word[i + 1].isLowSurrogate())
+      ucs4 = QChar::surrogateToUcs4(word[i], word[++i]);
+    cells += IsWide(ucs4) ? 2 : 1;
+  }
+  return cells * mAdvance + mPadding;
+}
+
+bool FixedPitchMeasurer::IsWide(u32 ucs4)
+{
+  // The big East Asian Wide and Fullwidth blocks, close enough for layout estimates
+  return (ucs4 >= 0x1100 && ucs4 <= 0x115F) ||   // Hangul Jamo
+         (ucs4 >= 0x2E80 && ucs4 <= 0xA4CF) ||   // CJK radicals to Yi
+         (ucs4 >= 0xAC00 && ucs4 <= 0xD7A3) ||   // Hangul syllables
+         (ucs4 >= 0xF900 && ucs4 <= 0xFAFF) ||   // CJK compatibility ideographs
+         (ucs4 >= 0xFE30 && ucs4 <= 0xFE4F) ||   // CJK compatibility forms
+         (ucs4 >= 0xFF00 && ucs4 <= 0xFF60) ||   // Fullwidth forms
+         (ucs4 >= 0xFFE0 && ucs4 <= 0xFFE6) ||
+         (ucs4 >= 0x20000 && ucs4 <= 0x3FFFD);   // CJK extension planes
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QString>
+#include <rint.h>
+
+/// How wide the block a word is drawn in is, so the model can be built without a font.
+///
+/// The editor measures with its display font, which may only be used on the GUI thread. Tools
+/// that run without a QGuiApplication use FixedPitchMeasurer, whose widths are only good for
+/// comparing lines with each other. Work on a thread pool splits with NoMeasurer and measures the
+/// words on the thread that owns the measurer afterwards.
+class TextMeasurer
+{
+  public:
+    virtual ~TextMeasurer() { }
+    virtual f64 WordWidth(const QString &word) const = 0; ///< Including the padding around the block
+};
+
+/// Every word is 0 wide, safe anywhere
+class NoMeasurer : public TextMeasurer
+{
+  public:
+    f64 WordWidth(const QString &word) const override { Q_UNUSED(word) return 0.0; }
+};
+
+/// Same advance for every character, twice that for East Asian wide ones
+class FixedPitchMeasurer : public TextMeasurer
+{
+  public:
+    explicit FixedPitchMeasurer(f64 advance = 7.0, f64 padding = 10.0) : mAdvance(advance), mPadding(padding) { }
+    f64 WordWidth(const QString &word) const override;
+
+    static bool IsWide(u32 ucs4);
+
+  private:
+    f64 mAdvance, mPadding;
+};
@@ -0,0 +1,271 @@
+#include <timestretch.h>
+#include <algorithm>
+#include <limits>
+#include <math.h>
+#include <string.h>
+
+SampleRing::SampleRing(i32 channels, i32 frames) :
+  mChannels(std::max(channels, 1)), mRead(0), mWrite(0), mFinished(false)
+{
+  i64 capacity = 1;
+  while(capacity < frames)
+    capacity *= 2;
+  mMask = capacity - 1;
+  mData.resize(capacity * mChannels);
+}
+
+i32 SampleRing::Readable() const
+{
+  return mWrite.load(std::memory_order_acquire) - mRead.load(std::memory_order_relaxed);
+}
+
+i32 SampleRing::Writable() const
+{
+  return mMask + 1 - (mWrite.load(std::memory_order_relaxed) - mRead.load(std::memory_order_acquire));
+}
+
+i32 SampleRing::Write(const f32 *in, i32 frames)
+{
+  const i64 w = mWrite.load(std::memory_order_relaxed);
+  const i32 n = std::min(frames, Writable());
+  // Up to the end of the buffer, then from its start
+  const i64 at = w & mMask, first = std::min<i64>(n, mMask + 1 - at);
+  memcpy(mData.data() + at * mChannels, in, first * mChannels * sizeof(f32));
+  memcpy(mData.data(), in + first * mChannels, (n - first) * mChannels * sizeof(f32));
+  mWrite.store(w + n, std::memory_order_release);
+  return n;
+}
+
+i32 SampleRing::Read(f32 *out, i32 frames)
+{
+  const i64 r = mRead.load(std::memory_order_relaxed);
+  const i32 n = std::min(frames, Readable());
+  const i64 at = r & mMask, first = std::min<i64>(n, mMask + 1 - at);
+  memcpy(out, mData.data() + at * mChannels, first * mChannels * sizeof(f32));
+  memcpy(out + first * mChannels, mData.data(), (n - first) * mChannels * sizeof(f32));
+  mRead.store(r + n, std::memory_order_release);
+  return n;
+}
+
+void SampleRing::Clear()
+{
+  mRead.store(0);
+  mWrite.store(0);
+  mFinished.store(false);
+}
+
+TimeStretch::TimeStretch(i32 channels, i32 sampleRate) :
+  mChannels(std::max(channels, 1)),
+  mWindow(std::max(16, sampleRate * WindowMs / 1000) & ~1),
+  mHop(mWindow / 2),
+  mTolerance(std::max(1, sampleRate * ToleranceMs / 1000)),
+  mStride(std::max(1, sampleRate / 8000)),
+  mSpeed(1.0)
+{
+  // Periodic, so windows half a window apart add up to one
+  mHann.resize(mWindow);
+  for(i32 i = 0; i < mWindow; i++)
+    mHann[i] = 0.5 - 0.5 * cos(2 * M_PI * i / mWindow);
+
+  // Enough for the window, the search around it and where the last one went on
+  const i32 capacity = 3 * mWindow + 4 * mTolerance;
+  mIn.resize(capacity * mChannels);
+  mMono.resize(capacity);
+  mOla.resize(mWindow * mChannels);
+  Reset();
+}
+
+void TimeStretch::SetSpeed(f64 speed)
+{
+  const f64 lo = MinSpeed, hi = MaxSpeed;
+  mSpeed.store(std::min(std::max(speed, lo), hi), std::memory_order_relaxed);
+}
+
+void TimeStretch::Reset()
+{
+  // Silence before the input, the first window starts there
+  mInFrames = mTolerance + mWindow;
+  mInBase = -mInFrames;
+  mInEnd = std::numeric_limits<i64>::max();
+  std::fill(mIn.begin(), mIn.end(), 0.0f);
+  std::fill(mMono.begin(), mMono.end(), 0.0f);
+  std::fill(mOla.begin(), mOla.end(), 0.0f);
+  mReady = mReadyPos = 0;
+  mAnalysis = 0.0;
+  mPrev = -mHop;
+  mLast = false;
+  mOutBase = 0;
+  mMarkCount.store(0);
+}
+
+bool TimeStretch::Fill(SampleRing &in, i64 until)
+{
+  const i32 capacity = mMono.size();
+  while(mInBase + mInFrames < until)
+  {
+    const i32 n = std::min<i64>(until - (mInBase + mInFrames), capacity - mInFrames);
+    auto frames = mIn.data() + mInFrames * mChannels;
+    // Whatever was written before it finished is there to read
+    const bool finished = in.Finished();
+    i32 got = in.Read(frames, n);
+    if(!got)
+    {
+      if(!finished)
+        return false;
+      if(mInEnd == std::numeric_limits<i64>::max())
+        mInEnd = mInBase + mInFrames;
+      std::fill(frames, frames + n * mChannels, 0.0f);
+      got = n;
+    }
+    const f32 scale = 1.0f / mChannels;
+    for(i32 i = 0; i < got; i++)
+    {
+      f32 sum = 0;
+      for(i32 c = 0; c < mChannels; c++)
+        sum += frames[i * mChannels + c];
+      mMono[mInFrames + i] = sum * scale;
+    }
+    mInFrames += got;
+  }
+  return true;
+}
+
+i64 TimeStretch::BestOffset(i64 natural, i64 target) const
+{
+  const f32 *a = mMono.data() + (natural - mInBase);
+  auto score = [&](i64 offset, i32 step) -> f64
+  {
+    const f32 *b = mMono.data() + (target + offset - mInBase);
+    f64 ab = 0, bb = 1e-12;
+    for(i32 i = 0; i < mWindow; i += step)
+    {
+      ab += a[i] * b[i];
+      bb += b[i] * b[i];
+    }
+    return ab / sqrt(bb);
+  };
+  // Only clearly better matches move away from the last window, not rounding
+  auto better = [](f64 s, f64 best) { return s > best + 1e-5 * fabs(best); };
+
+  // Every stride first, then every frame around the best. Ties go on from the last window,
+  // which keeps 1x and silence untouched.
+  i64 best = std::min<i64>(std::max<i64>(natural - target, -mTolerance), mTolerance);
+  f64 bestScore = score(best, mStride);
+  for(i64 d = -mTolerance; d <= mTolerance; d += mStride)
+  {
+    auto s = score(d, mStride);
+    if(better(s, bestScore))
+    {
+      best = d;
+      bestScore = s;
+    }
+  }
+  if(mStride > 1)
+  {
+    const i64 coarse = best;
+    bestScore = score(coarse, 1);
+    for(i64 d = std::max<i64>(coarse - mStride + 1, -mTolerance); d <= std::min<i64>(coarse + mStride - 1, mTolerance); d++)
+    {
+      auto s = d == coarse ? bestScore : score(d, 1);
+      if(better(s, bestScore))
+      {
+        best = d;
+        bestScore = s;
+      }
+    }
+  }
+  return target + best;
+}
+
+bool TimeStretch::Step(SampleRing &in)
+{
+  const i64 target = floor(mAnalysis), natural = mPrev + mHop,
+            lo = std::min<i64>(target - mTolerance, natural),
+            hi = std::max<i64>(target + mTolerance + mWindow, natural + mWindow);
+
+  // Nothing before lo is reached again
+  if(lo > mInBase)
+  {
+    const i64 drop = std::min<i64>(lo - mInBase, mInFrames);
+    memmove(mIn.data(), mIn.data() + drop * mChannels, (mInFrames - drop) * mChannels * sizeof(f32));
+    memmove(mMono.data(), mMono.data() + drop, (mInFrames - drop) * sizeof(f32));
+    mInBase += drop;
+    mInFrames -= drop;
+  }
+  if(!Fill(in, hi))
+    return false;
+
+  const i64 pos = BestOffset(natural, target);
+  auto src = mIn.data() + (pos - mInBase) * mChannels;
+  for(i32 i = 0; i < mWindow; i++)
+  {
+    for(i32 c = 0; c < mChannels; c++)
+      mOla[i * mChannels + c] += mHann[i] * src[i * mChannels + c];
+  }
+  mReady = mHop;
+  mReadyPos = 0;
+  mPrev = pos;
+
+  const i64 mark = mMarkCount.load(std::memory_order_relaxed);
+  auto &m = mMarks[mark & (MarkCount - 1)];
+  m.out.store(mOutBase, std::memory_order_relaxed);
+  m.src.store(pos, std::memory_order_relaxed);
+  mMarkCount.store(mark + 1, std::memory_order_release);
+  mAnalysis += mHop * mSpeed.load(std::memory_order_relaxed);
+  // From here on only silence would be added
+  mLast = target >= mInEnd;
+  return true;
+}
+
+i32 TimeStretch::Process(SampleRing &in, f32 *out, i32 frames)
+{
+  i32 done = 0;
+  while(done < frames)
+  {
+    if(mReadyPos < mReady)
+    {
+      const i32 n = std::min(frames - done, mReady - mReadyPos);
+      memcpy(out + done * mChannels, mOla.data() + mReadyPos * mChannels, n * mChannels * sizeof(f32));
+      mReadyPos += n;
+      done += n;
+      continue;
+    }
+    if(mLast)
+      break;
+    if(mReady)
+    {
+      // The front half is out, move the rest up
+      memmove(mOla.data(), mOla.data() + mHop * mChannels, (mWindow - mHop) * mChannels * sizeof(f32));
+      std::fill(mOla.begin() + (mWindow - mHop) * mChannels, mOla.end(), 0.0f);
+      mReady = mReadyPos = 0;
+      mOutBase += mHop;
+    }
+    if(!Step(in))
+      break;
+  }
+  return done;
+}
+
+i64 TimeStretch::SourceFrame(i64 outFrame) const
+{
+  const i64 count = mMarkCount.load(std::memory_order_acquire);
+  if(!count)
+    return 0;
+  // Newest first. The oldest slot is left out, it may be being written.
+  const i64 oldest = std::max<i64>(count - MarkCount + 1, 0);
+  i64 nextOut = -1, nextSrc = 0;
+  for(i64 i = count - 1; ; i--)
+  {
+    auto &m = mMarks[i & (MarkCount - 1)];
+    const i64 out = m.out.load(std::memory_order_relaxed), src = m.src.load(std::memory_order_relaxed);
+    if(out <= outFrame || i == oldest)
+    {
+      // Between two windows it moves evenly from one to the other, past the last at 1x
+      if(nextOut > out && outFrame < nextOut)
+        return src + (outFrame - out) * (nextSrc - src) / (nextOut - out);
+      return src + (outFrame - out);
+    }
+    nextOut = out;
+    nextSrc = src;
+  }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <rint.h>
+
+/// Interleaved float frames from one thread to one other, without locks. The capacity is fixed
+/// when it is made, rounded up to a power of two.
+class SampleRing
+{
+  public:
+    SampleRing(i32 channels, i32 frames);
+
+    i32 Channels() const { return mChannels; }
+    i32 Readable() const;
+    i32 Writable() const;
+
+    i32 Write(const f32 *in, i32 frames); ///< As much as fits
+    i32 Read(f32 *out, i32 frames);       ///< As much as there is
+
+    /// Nothing more will be written, from the writer
+    void Finish() { mFinished.store(true, std::memory_order_release); }
+    bool Finished() const { return mFinished.load(std::memory_order_acquire); }
+
+    void Clear(); ///< While neither side runs
+
+  private:
+    const i32 mChannels;
+    i64 mMask;
+    std::vector<f32> mData;
+    std::atomic<i64> mRead, mWrite; ///< Frames read and written so far
+    std::atomic<bool> mFinished;
+};
+
+/// Pitch preserving time stretching by WSOLA, for speech.
+///
+/// Windows of WindowMs are overlap-added every half window of output, and taken from the input
+/// every half window times the speed. Each one is moved by up to ToleranceMs to where it lines up
+/// best with what naturally follows the one before, so periods are never cut. The search runs at
+/// about 8 kHz first and is then refined around the best match.
+///
+/// Everything is allocated when it is made: Process() neither allocates nor locks, so it can run
+/// on the audio callback while the speed is changed from any other thread.
+class TimeStretch
+{
+  public:
+    static constexpr f64
+      MinSpeed = 0.5,
+      MaxSpeed = 2.0;
+    static constexpr i32
+      WindowMs = 30,
+      ToleranceMs = 10,
+      MarkCount = 64;
+
+    TimeStretch(i32 channels, i32 sampleRate);
+
+    void SetSpeed(f64 speed); ///< Clamped, takes effect from the next window
+    f64 Speed() const { return mSpeed.load(std::memory_order_relaxed); }
+
+    /// Up to frames of output into out, interleaved, pulling from in as it goes. Returns less if
+    /// in runs dry, and once it is finished pads it with silence until all of it is out.
+    i32 Process(SampleRing &in, f32 *out, i32 frames);
+    bool Done() const { return mLast && mReadyPos >= mReady; } ///< All of a finished input is out
+
+    /// The input frame that went into that frame of output, from any thread. Kept for the last
+    /// MarkCount windows, which is more than any output buffers ahead.
+    i64 SourceFrame(i64 outFrame) const;
+
+    void Reset(); ///< Start over from a new input, while not processing
+
+  private:
+    bool Fill(SampleRing &in, i64 until); ///< Input up to that frame, false if it has to wait
+    i64 BestOffset(i64 natural, i64 target) const;
+    bool Step(SampleRing &in); ///< Adds the next window, false if it has to wait for input
+
+    const i32 mChannels, mWindow, mHop, mTolerance, mStride;
+    std::atomic<f64> mSpeed;
+
+    std::vector<f32> mHann;
+    std::vector<f32> mIn, mMono; ///< Input frames from mInBase on, all channels and mixed down
+    i64 mInBase, mInFrames, mInEnd; ///< mInEnd is the end of the input once it is finished
+    std::vector<f32> mOla;          ///< A window of output being added up
+    i32 mReady, mReadyPos;          ///< Frames at the front of mOla that are done, and given out
+
+    f64 mAnalysis; ///< Where the next window is taken from, before the search
+    i64 mPrev;     ///< Where the last one was taken from
+    bool mLast; ///< The window past the end of the input is in
+
+    // Where each window went in the output and came from in the input, written by Step()
+    struct Mark { std::atomic<i64> out, src; };
+    i64 mOutBase; ///< Output frame at the front of mOla
+    Mark mMarks[MarkCount];
+    std::atomic<i64> mMarkCount;
+};
@@ -0,0 +1,69 @@
+#include <timing.h>
+#include <algorithm>
+#include <math.h>
+
+namespace
+{
+  // Speaking time of a word in characters, a delimiter counting as one
+  f64 Weight(const DiscreteWord &w)
+  {
+    static const QString Stops = QStringLiteral(".?!。？！…"), Commas = QStringLiteral(",;:、，；：");
+    f64 ret = w.text.size() + 1;
+    if(w.text.isEmpty())
+      return ret;
+    auto last = w.text[w.text.size() - 1];
+    if(Stops.contains(last))
+      ret += 6;
+    else if(Commas.contains(last))
+      ret += 3;
+    return ret;
+  }
+}
+
+u64 BoundaryTimer::Estimate(const Dialog &d, i32 words)
+{
+  f64 before = 0, total = 0;
+  for(i32 i = 0; i < d.words.size(); i++)
+  {
+    auto w = Weight(d.words[i]);
+    // The pause after the last word before the cut is shared by both sides
+    if(i < words - 1)
+      before += w;
+    else if(i == words - 1)
+      before += (w + d.words[i].text.size() + 1) / 2;
+    total += w;
+  }
+  if(total <= 0)
+    return d.begin + d.duration / 2;
+  return d.begin + (u64)llround(d.duration * before / total);
+}
+
+u64 BoundaryTimer::SplitTime(const Dialog &d, i32 words) const
+{
+  auto est = Estimate(d, words);
+  if(!mAudio || mAudio->isEmpty() || d.duration < 2 * MinPartMs)
+    return est;
+
+  // Only pauses that leave both sides some time
+  const u64 lo = std::max(d.begin + MinPartMs, est > SearchRadiusMs ? est - SearchRadiusMs : 0),
+            hi = std::min(d.end() - MinPartMs, est + SearchRadiusMs);
+  if(lo >= hi)
+    return est;
+  auto range = mAudio->PausesIn(lo, hi);
+  u64 ret = est;
+  f64 best = 1.0; // What the estimate itself scores
+  for(i32 i = range.first; i < range.second; i++)
+  {
+    auto &p = mAudio->Pauses()[i];
+    auto begin = std::max(p.begin, lo), end = std::min(p.end, hi);
+    auto mid = (begin + end) / 2;
+    // Distance costs up to 1, a long pause takes up to 0.75 off
+    f64 cost = fabs((f64)mid - est) / SearchRadiusMs + 0.25 - 0.75 * std::min<f64>(p.length(), 600) / 600;
+    if(cost < best)
+    {
+      best = cost;
+      ret = mid;
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <dialog.h>
+#include <envelope.h>
+#include <rint.h>
+
+/// Works out when a line cut between two of its words should switch over.
+///
+/// Without audio the time is shared out by characters, with punctuation counted as the pause it
+/// usually is. With an envelope the estimate snaps to the best pause near it, preferring long
+/// and close ones. Either way it is a binary search plus a look at a few pauses, cheap enough
+/// to run on every mouse release.
+class BoundaryTimer
+{
+  public:
+    static constexpr u64
+      SearchRadiusMs = 1500, ///< Farthest from the estimate a pause is looked for
+      MinPartMs = 200; ///< Shortest either side of the cut is left
+
+    explicit BoundaryTimer(const Envelope *audio = nullptr) : mAudio(audio) { }
+
+    /// When words [0, words) of d end and the rest begin, within d
+    u64 SplitTime(const Dialog &d, i32 words) const;
+
+    static u64 Estimate(const Dialog &d, i32 words); ///< From the characters alone
+
+  private:
+    const Envelope *mAudio;
+};
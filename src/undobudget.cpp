@@ -0,0 +1,139 @@
+#include <undobudget.h>
+#include <QUndoStack>
+#include <algorithm>
+#include <vector>
+#include <commands.h>
+
+UndoBudget::UndoBudget(i64 budgetBytes) :
+  mBudget(budgetBytes), mInMemory(0), mOnDisk(0), mSpilledCommands(0), mLow(0), mHigh(0)
+{ }
+
+// Our commands in a stack entry, macros hold theirs as children
+static void CollectCommands(const QUndoCommand *c, std::vector<LRCmd::CmdBase*> &out)
+{
+  // The stack only hands out const pointers, spilling does not change what a command does
+  if(auto cmd = dynamic_cast<const LRCmd::CmdBase*>(c))
+    out.push_back(const_cast<LRCmd::CmdBase*>(cmd));
+  for(i32 i = 0; i < c->childCount(); i++)
+    CollectCommands(c->child(i), out);
+}
+
+static std::vector<LRCmd::CmdBase*> EntryCommands(const QUndoStack &undo, i32 entry)
+{
+  std::vector<LRCmd::CmdBase*> ret;
+  CollectCommands(undo.command(entry), ret);
+  return ret;
+}
+
+void UndoBudget::Count(const QUndoStack &undo, i32 entry)
+{
+  Uncount(entry);
+  auto &e = mEntries[entry];
+  for(auto cmd : EntryCommands(undo, entry))
+  {
+    e.inMemory += cmd->Footprint();
+    e.onDisk += cmd->SpilledBytes();
+    e.spilled += cmd->IsSpilled();
+  }
+  mInMemory += e.inMemory;
+  mOnDisk += e.onDisk;
+  mSpilledCommands += e.spilled;
+}
+
+void UndoBudget::Uncount(i32 entry)
+{
+  auto &e = mEntries[entry];
+  mInMemory -= e.inMemory;
+  mOnDisk -= e.onDisk;
+  mSpilledCommands -= e.spilled;
+  e = Entry { 0, 0, 0 };
+}
+
+void UndoBudget::Truncate(i32 entries)
+{
+  for(i32 i = entries; i < (i32)mEntries.size(); i++)
+    Uncount(i);
+  mEntries.resize(entries);
+  mLow = std::min(mLow, entries);
+  mHigh = std::min(mHigh, entries);
+}
+
+void UndoBudget::Pushed(const QUndoStack &undo, i32 indexBefore)
+{
+  // The push took the redo entries away. The entry below it is only recounted when the new
+  // command merged into it, or merged away to nothing and took it along.
+  auto keep = std::max(0, std::min(indexBefore, undo.count() - 1));
+  Truncate(keep);
+  mEntries.resize(undo.count(), Entry { 0, 0, 0 });
+  for(i32 i = keep; i < undo.count(); i++)
+    Count(undo, i);
+  mHigh = undo.count();
+}
+
+bool UndoBudget::Load(const QUndoStack &undo, i32 entry)
+{
+  bool ok = true;
+  for(auto cmd : EntryCommands(undo, entry))
+    if(!(ok = cmd->Reload()))
+      break;
+  // What was read back is in memory again, so this entry may have to be spilled once more
+  Count(undo, entry);
+  mLow = std::min(mLow, entry);
+  mHigh = std::max(mHigh, entry + 1);
+  return ok;
+}
+
+void UndoBudget::Recount(const QUndoStack &undo)
+{
+  Truncate(0);
+  mEntries.resize(undo.count(), Entry { 0, 0, 0 });
+  for(i32 i = 0; i < undo.count(); i++)
+    Count(undo, i);
+  mLow = 0;
+  mHigh = undo.count();
+}
+
+void UndoBudget::Enforce(const QUndoStack &undo)
+{
+  // Distance from the current index: the next undo is 0, the next redo is 0 as well.
+  // Whole entries go from whichever end is farther, the ones between mLow and mHigh are left.
+  const i32 index = undo.index();
+  while(mInMemory > mBudget)
+  {
+    i32 below = mLow < index ? index - 1 - mLow : -1;
+    i32 above = mHigh > index ? mHigh - 1 - index : -1;
+    if(std::max(below, above) < KeepNearest)
+      break;
+    i32 entry = below >= above ? mLow++ : --mHigh;
+    for(auto cmd : EntryCommands(undo, entry))
+      cmd->Spill(*this);
+    Count(undo, entry);
+  }
+}
+
+void UndoBudget::Clear()
+{
+  if(mFile.isOpen())
+    mFile.resize(0);
+  mInMemory = mOnDisk = 0;
+  mSpilledCommands = 0;
+  mEntries.clear();
+  mLow = mHigh = 0;
+}
+
+i64 UndoBudget::Write(const QByteArray &data)
+{
+  if(!mFile.isOpen() && !mFile.open())
+    return -1;
+  auto at = mFile.size();
+  if(!mFile.seek(at) || mFile.write(data) != data.size())
+    return -1;
+  return at;
+}
+
+QByteArray UndoBudget::Read(i64 offset, i32 size)
+{
+  if(!mFile.seek(offset))
+    return QByteArray();
+  return mFile.read(size);
+}
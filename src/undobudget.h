@@ -0,0 +1,68 @@
+#pragma once
+
+#include <QByteArray>
+#include <QTemporaryFile>
+#include <vector>
+#include <rint.h>
+
+class QUndoCommand;
+class QUndoStack;
+
+/// Keeps the memory held by an undo stack under a budget.
+///
+/// When the commands hold more than the budget, the ones farthest from the current position
+/// have their payload (words, retimed ranges) written to a temporary file and freed. A command
+/// reads its payload back by itself when it is undone or redone. The file is only emptied when
+/// the stack is cleared, so space from commands deleted in between is not reused.
+///
+/// What each stack entry holds is counted once, when it is pushed or read back, and the entries
+/// are spilled from both ends of the stack inwards, so keeping it under budget costs nothing per
+/// edit beyond the entries it touches.
+class UndoBudget
+{
+  public:
+    explicit UndoBudget(i64 budgetBytes = DefaultBudget);
+
+    void SetBudget(i64 bytes) { mBudget = bytes; }
+    i64 Budget() const { return mBudget; }
+
+    /// Count the entry a push added or merged into, after discarding the redo entries it
+    /// replaced. For a macro, call once it is closed with the index from before it was begun.
+    void Pushed(const QUndoStack &undo, i32 indexBefore);
+    /// Read back what a stack entry has spilled before undoing or redoing it, false if any of
+    /// it cannot be read, the entry must then be left alone
+    bool Load(const QUndoStack &undo, i32 entry);
+    void Recount(const QUndoStack &undo); ///< Count every entry, after the stack was rebuilt
+    void Enforce(const QUndoStack &undo); ///< Spill until the stack fits, call after every change to it
+    void Clear(); ///< Call after clearing the stack
+
+    // Accounting
+    i64 InMemory() const { return mInMemory; }
+    i64 OnDisk() const { return mOnDisk; }
+    i32 SpilledCommands() const { return mSpilledCommands; }
+
+    // Storage for the commands
+    i64 Write(const QByteArray &data); ///< Returns where to read it back, -1 on failure
+    QByteArray Read(i64 offset, i32 size);
+
+    static constexpr i64 DefaultBudget = 64ll << 20;
+    static constexpr i32 KeepNearest = 16; ///< Never spill this many commands around the current index
+
+  private:
+    /// What one stack entry holds, macros included
+    struct Entry
+    {
+      i64 inMemory, onDisk;
+      i32 spilled;
+    };
+
+    void Count(const QUndoStack &undo, i32 entry);
+    void Uncount(i32 entry);
+    void Truncate(i32 entries); ///< Forget the entries from there on
+
+    QTemporaryFile mFile;
+    i64 mBudget, mInMemory, mOnDisk;
+    i32 mSpilledCommands;
+    std::vector<Entry> mEntries; ///< One per stack entry
+    i32 mLow, mHigh; ///< Entries before mLow and from mHigh on are already spilled
+};
@@ -1,17 +1,21 @@
 #include "wavdecoder.h"
+#include "flacdecoder.h"
 
 /* Ported from Wav.cpp from QTau http://github.com/qtau-devgroup/editor by digited, BSD license */
 
 #include <qendian.h>
 #include <QDataStream>
 #include <QDebug>
+#include <QFile>
+#include <QtConcurrent>
+#include <math.h>
 
 
 //----- WAV PCM RIFF header parts -----------------------
 // all char[] must be big-endian, while all integers should be unsigned little-endian
 
 typedef struct SWavRiff {
-    uichar  chunkID;     // "RIFF" 0x52494646 BE
+    uichar  chunkID;     // "RIFF" 0x52494646 BE, or "RF64" when the sizes are in a ds64 chunk
     quint32 chunkSize;
     uichar  chunkFormat; // "WAVE" 0x57415645 BE
 
@@ -53,11 +57,45 @@ typedef struct SWavRiff {
 
     bool isCorrect()
     {
-        return !memcmp(chunkID.c, "RIFF", 4) && !memcmp(chunkFormat.c, "WAVE", 4) && chunkSize > 0;
+        return (!memcmp(chunkID.c, "RIFF", 4) || isRf64()) && !memcmp(chunkFormat.c, "WAVE", 4) && chunkSize > 0;
     }
+
+    bool isRf64() { return !memcmp(chunkID.c, "RF64", 4); }
 } wavRIFF;
 
 
+// RF64 (EBU Tech 3306) only, right after the RIFF header: the 64-bit sizes the others can't hold
+typedef struct SWavDs64 {
+    uichar  ds64ID;      // "ds64"
+    quint32 ds64Size;
+    quint64 riffSize;
+    quint64 dataSize;
+    quint64 sampleCount;
+
+    SWavDs64(QDataStream &reader)
+    {
+        reader.setByteOrder(QDataStream::LittleEndian);
+        reader >> ds64ID.i;
+        reader >> ds64Size;
+
+        if (isCorrect())
+        {
+            reader >> riffSize;
+            reader >> dataSize;
+            reader >> sampleCount;
+
+            // followed by the sizes of other big chunks, which we don't need
+            reader.skipRawData(ds64Size - 24);
+        }
+
+        if (!(isCorrect() && reader.status() == QDataStream::Ok))
+            ds64ID.i = 0;
+    }
+
+    bool isCorrect() { return !memcmp(ds64ID.c, "ds64", 4) && ds64Size >= 24; }
+} wavDs64;
+
+
 typedef struct SWavFmt {
     uichar  fmtChunkID;  // "fmt "  0x666d7420 BE
     quint32 fmtSize;
@@ -67,6 +105,7 @@ typedef struct SWavFmt {
     quint32 byteRate;       // 4
     quint16 blockAlign;     // 2
     quint16 bitsPerSample;  // 2
+    quint16 subFormat;      // WAVE_FORMAT_EXTENSIBLE only, what audioFormat would have been
 
     void clear() { memset(fmtChunkID.c, 0, sizeof(SWavFmt)); }
 
@@ -90,6 +129,7 @@ typedef struct SWavFmt {
         reader.setByteOrder(QDataStream::LittleEndian);
         reader >> fmtChunkID.i;
         reader >> fmtSize;
+        subFormat = 0;
 
         if (isCorrect())
         {
@@ -100,7 +140,15 @@ typedef struct SWavFmt {
             reader >> blockAlign;
             reader >> bitsPerSample;
 
-            if (fmtSize > 16)
+            // WAVE_FORMAT_EXTENSIBLE: cbSize, valid bits and channel mask, then a GUID whose
+            // first two bytes are the format code
+            if (audioFormat == 0xFFFE && fmtSize >= 40)
+            {
+                reader.skipRawData(8);
+                reader >> subFormat;
+                reader.skipRawData(fmtSize - 26);
+            }
+            else if (fmtSize > 16)
                 reader.skipRawData(fmtSize - 16);
         }
 
@@ -185,7 +233,17 @@ bool WavDecoder::cacheAll(QIODevice *_dev)
         QDataStream reader(dev);
         wavRIFF rh(reader);
 
-        if (rh.isCorrect())
+        bool sized = true;
+        _ds64_data_size = 0;
+        if (rh.isCorrect() && rh.isRf64())
+        {
+            wavDs64 ds(reader);
+            sized = ds.isCorrect();
+            if (sized)
+                _ds64_data_size = ds.dataSize;
+        }
+
+        if (rh.isCorrect() && sized)
             result = findFormatChunk(reader) && findDataChunk(reader);
     }
 
@@ -196,73 +254,342 @@ bool WavDecoder::cacheAll(QIODevice *_dev)
 
         fmt.byteOrder = WavFormat::LittleEndian;
 
-        mData = dev->read(_data_chunk_length * fmt.sampleSize / 8 * fmt.channelCount);
+        mData.clear();
+        mPager.reset();
+        auto file = qobject_cast<QFileDevice*>(dev);
+        if (mCompact && file && !file->fileName().isEmpty() && fmt.bytesPerFrame > 0)
+        {
+            // Through in chunks, only what is ingested stays
+            static constexpr i64 ChunkFrames = 1 << 20;
+            const i64 frameBytes = fmt.bytesPerFrame;
+            mFrames = std::min<i64>(_data_chunk_length, (file->size() - (i64)_data_chunk_location) / frameBytes);
+            BeginIngest(mFrames);
+            for (i64 at = 0; at < mFrames; )
+            {
+                auto chunk = dev->read(std::min<i64>(mFrames - at, ChunkFrames) * frameBytes);
+                const i64 n = chunk.size() / frameBytes;
+                if (!n)
+                    break;
+                IngestParallel(chunk.constData(), at, n);
+                at += n;
+            }
+            EndIngest();
+
+            const QString name = file->fileName();
+            const i64 location = _data_chunk_location;
+            SetPager([=](i64 frame, i64 count) -> QByteArray
+            {
+                QFile f(name);
+                if (!f.open(QFile::ReadOnly) || !f.seek(location + frame * frameBytes))
+                    return QByteArray();
+                return f.read(count * frameBytes);
+            });
+        }
+        else
+        {
+            mData = dev->read(_data_chunk_length * fmt.sampleSize / 8 * fmt.channelCount);
+            mFrames = fmt.bytesPerFrame > 0 ? mData.size() / fmt.bytesPerFrame : 0;
+            BeginIngest(mFrames);
+            IngestParallel(mData.constData(), 0, mFrames);
+            EndIngest();
+        }
     }
 
     return result;
 }
 
-QPair<f32, f32> WavDecoder::GetWaveformPeaksForRange(i32 samplebegin, i32 sampleend)
+QPair<f32, f32> WavDecoder::GetWaveformPeaksForRange(i64 begin, i64 end)
 {
-  QPair<f32, f32> ret;
-  f32 max = 0, min = 0;
+  begin = std::max<i64>(begin, 0);
+  end = std::min(end, mFrames);
+  if(begin >= end)
+    return qMakePair(0.0f, 0.0f);
+  if(end - begin >= PeakPyramid::BucketFrames)
+    return mPeaks.Range(begin, end);
+
+  // Closer than a bucket a pixel, from the samples themselves
+  QByteArray paged;
+  auto d = reinterpret_cast<const u8*>(mData.constData()) + begin * fmt.bytesPerFrame;
+  if(mPager)
+  {
+    paged = ReadFrames(begin, end - begin);
+    d = reinterpret_cast<const u8*>(paged.constData());
+  }
+  auto m = Measure(d, end - begin);
+  return qMakePair(m.max, m.min);
+}
 
-  auto d = mData.data();
-  if(samplebegin < 0)
-    samplebegin = 0;
-  auto sampleCount = mData.size() / (fmt.sampleSize / 8);
-  if(sampleend > sampleCount)
-    sampleend = sampleCount - 1;
+QByteArray WavDecoder::GetSamples(i32 begin, i32 end)
+{
+  return mData.mid(begin, end - begin);
+}
+
+WavDecoder *WavDecoder::ForDevice(QIODevice *dev, QObject *parent)
+{
+  auto magic = dev->peek(4);
+  if(magic == "fLaC" || magic.startsWith("ID3"))
+    return new FlacDecoder(parent);
+  return new WavDecoder(parent);
+}
 
-  switch(fmt.sampleType)
+QByteArray WavDecoder::ReadFrames(i64 frame, i64 count) const
+{
+  const i64 frameBytes = fmt.bytesPerFrame;
+  QByteArray ret(std::max<i64>(count, 0) * frameBytes, Silence());
+  if(mPager)
   {
-    case WavFormat::Int8:
-      for(int i = samplebegin; i < sampleend; i++)
-      {
-        f32 val = (f32)((i8*)d)[i];
-        max = std::max(val, max);
-        min = std::min(val, min);
-      }
-      ret.first = max / 127;
-      ret.second = min / 128;
-      break;
+    mPager->Read(frame, std::max<i64>(count, 0), ret.data());
+    return ret;
+  }
+  auto from = std::max<i64>(frame, 0) * frameBytes, to = std::min<i64>((frame + count) * frameBytes, mData.size());
+  if(from < to)
+    memcpy(ret.data() + (from - frame * frameBytes), mData.constData() + from, to - from);
+  return ret;
+}
 
-    case WavFormat::Int16:
-      for(int i = samplebegin; i < sampleend; i++)
-      {
-//        qDebug() << d << mData.size() << i;
-        f32 val = (f32)((i16*)d)[i];
-        max = std::max(val, max);
-        min = std::min(val, min);
-      }
-      ret.first = max / 32767;
-      ret.second = min / 32768;
-      break;
+void WavDecoder::clear()
+{
+  mData.clear();
+  mFrames = 0;
+  mEnvelope.clear();
+  mPeaks.clear();
+  mPager.reset();
+}
 
-    case WavFormat::Float32:
-      for(int i = samplebegin; i < sampleend; i++)
+i64 WavDecoder::ResidentBytes() const
+{
+  return mData.size() + mPeaks.Bytes() + mEnvelope.Rms().size() * (i64)sizeof(f32) +
+         (mPager ? mPager->ResidentBytes() : 0);
+}
+
+void WavDecoder::SetPager(SamplePager::Loader load)
+{
+  mPager = std::make_shared<SamplePager>(load, fmt.bytesPerFrame, mFrames, Silence());
+}
+
+void WavDecoder::BeginIngest(i64 frames)
+{
+  const i32 bytes = fmt.sampleSize / 8;
+  mPartialWindows.clear();
+  mPartialBuckets.clear();
+  if(bytes < 1 || bytes > 4 || fmt.channelCount < 1 || fmt.sampleRate <= 0)
+  {
+    mWindowFrames = 0;
+    return;
+  }
+  mWindowFrames = std::max<i64>(1, (i64)fmt.sampleRate * Envelope::WindowMs / 1000);
+  mRms = QVector<f32>((frames + mWindowFrames - 1) / mWindowFrames, 0.0f);
+  mRmsOut = mRms.data();
+  mPeaks.Reset(frames);
+  mPeakOut = mPeaks.Base();
+}
+
+WavDecoder::Partial WavDecoder::Measure(const u8 *pcm, i64 frames) const
+{
+  const i32 bytes = fmt.sampleSize / 8;
+  const bool isFloat = fmt.sampleType == WavFormat::Float32;
+  const i64 samples = frames * fmt.channelCount;
+  Partial ret { 0.0, samples, 0.0f, 0.0f };
+  for(i64 i = 0; i < samples; i++, pcm += bytes)
+  {
+    const f64 v = DecodeSample(pcm, bytes, isFloat);
+    ret.sum += v * v;
+    ret.min = std::min<f32>(ret.min, v);
+    ret.max = std::max<f32>(ret.max, v);
+  }
+  return ret;
+}
+
+void WavDecoder::Ingest(const char *pcm, i64 first, i64 frames)
+{
+  if(!mWindowFrames)
+    return;
+  const i64 end = std::min(first + frames, mFrames), frameBytes = fmt.bytesPerFrame;
+  auto d = reinterpret_cast<const u8*>(pcm);
+
+  // Windows and buckets all in here are done, the rest is kept until the other parts come
+  auto walk = [&](i64 span, QHash<i64, Partial> &partials, const std::function<void(i64, const Partial&)> &done)
+  {
+    for(i64 i = std::max<i64>(first, 0) / span; i * span < end; i++)
+    {
+      const i64 from = std::max(i * span, first), to = std::min((i + 1) * span, end);
+      auto m = Measure(d + (from - first) * frameBytes, to - from);
+      if(from == i * span && to == std::min((i + 1) * span, mFrames))
       {
-        f32 val = ((f32*)d)[i];
-        max = std::max(val, max);
-        min = std::min(val, min);
+        done(i, m);
+        continue;
       }
-      ret.first = max;
-      ret.second = min;
-      break;
+      QMutexLocker lock(&mPartialLock);
+      auto &p = partials[i];
+      p.sum += m.sum;
+      p.min = std::min(p.min, m.min);
+      p.max = std::max(p.max, m.max);
+    }
+  };
+  walk(mWindowFrames, mPartialWindows, [this](i64 i, const Partial &m)
+  {
+    mRmsOut[i] = m.count ? sqrt(m.sum / m.count) : 0.0f;
+  });
+  walk(PeakPyramid::BucketFrames, mPartialBuckets, [this](i64 i, const Partial &m)
+  {
+    mPeakOut[i] = Peak::Quantize(m.min, m.max);
+  });
+}
+
+void WavDecoder::IngestParallel(const char *pcm, i64 first, i64 frames)
+{
+  const i64 chunkFrames = 1 << 16, frameBytes = fmt.bytesPerFrame;
+  QVector<i64> chunks;
+  for(i64 i = 0; i < frames; i += chunkFrames)
+    chunks.append(i);
+  QtConcurrent::blockingMap(chunks, [=](i64 &at)
+  {
+    Ingest(pcm + at * frameBytes, first + at, std::min(chunkFrames, frames - at));
+  });
+}
+
+void WavDecoder::EndIngest()
+{
+  if(!mWindowFrames)
+  {
+    mEnvelope.clear();
+    mPeaks.clear();
+    return;
+  }
+  // Over the whole window, what never came in is silent
+  for(auto i = mPartialWindows.constBegin(); i != mPartialWindows.constEnd(); ++i)
+  {
+    const i64 from = i.key() * mWindowFrames, to = std::min(from + mWindowFrames, mFrames);
+    mRmsOut[i.key()] = sqrt(i->sum / ((to - from) * fmt.channelCount));
+  }
+  for(auto i = mPartialBuckets.constBegin(); i != mPartialBuckets.constEnd(); ++i)
+    mPeakOut[i.key()] = Peak::Quantize(i->min, i->max);
+  mPartialWindows.clear();
+  mPartialBuckets.clear();
+  mWindowFrames = 0;
+  mEnvelope.SetRms(std::move(mRms));
+  mRms = QVector<f32>();
+  mPeaks.Build();
+}
+
+MonoReader WavDecoder::Reader() const
+{
+  const bool isFloat = fmt.sampleType == WavFormat::Float32;
+  if(mPager)
+    return MonoReader(mPager, mFrames, fmt.sampleSize / 8, isFloat, fmt.channelCount, fmt.sampleRate);
+  return MonoReader(mData, fmt.sampleSize / 8, isFloat, fmt.channelCount, fmt.sampleRate);
+}
+
+SamplePager::SamplePager(Loader load, i32 frameBytes, i64 frames, char silence) :
+  mLoad(load), mFrameBytes(frameBytes), mFrames(frames), mSilence(silence)
+{
+
+}
+
+QByteArray SamplePager::Block(i64 index)
+{
+  {
+    QMutexLocker lock(&mLock);
+    auto i = mBlocks.find(index);
+    if(i != mBlocks.end())
+    {
+      mOrder.splice(mOrder.begin(), mOrder, i->second);
+      return i->first;
+    }
+  }
+
+  // Two threads may both load a block, the first one in keeps it
+  auto data = mLoad(index * BlockFrames, std::min<i64>(BlockFrames, mFrames - index * BlockFrames));
+  QMutexLocker lock(&mLock);
+  if(!mBlocks.contains(index))
+  {
+    mOrder.push_front(index);
+    mBlocks.insert(index, qMakePair(data, mOrder.begin()));
+    while(mBlocks.size() > MaxBlocks)
+    {
+      mBlocks.remove(mOrder.back());
+      mOrder.pop_back();
+    }
+  }
+  return data;
+}
 
-    default:
-      break;
+void SamplePager::Read(i64 frame, i64 count, char *out)
+{
+  const i64 end = frame + count;
+  for(i64 at = frame; at < end; )
+  {
+    auto dst = out + (at - frame) * mFrameBytes;
+    if(at < 0 || at >= mFrames)
+    {
+      const i64 to = at < 0 ? std::min<i64>(end, 0) : end;
+      memset(dst, mSilence, (to - at) * mFrameBytes);
+      at = to;
+      continue;
+    }
+    const i64 index = at / BlockFrames, base = index * BlockFrames,
+              to = std::min(end, std::min<i64>(base + BlockFrames, mFrames));
+    // A short read leaves the rest silent
+    auto block = Block(index);
+    const i64 have = std::max<i64>(std::min<i64>(to, base + block.size() / mFrameBytes) - at, 0);
+    if(have)
+      memcpy(dst, block.constData() + (at - base) * mFrameBytes, have * mFrameBytes);
+    memset(dst + have * mFrameBytes, mSilence, (to - at - have) * mFrameBytes);
+    at = to;
   }
+}
 
+i64 SamplePager::ResidentBytes() const
+{
+  QMutexLocker lock(&mLock);
+  i64 ret = 0;
+  for(auto &i : mBlocks)
+    ret += i.first.size();
   return ret;
 }
 
-QByteArray WavDecoder::GetSamples(i32 begin, i32 end)
+MonoReader::MonoReader(const QByteArray &data, i32 bytes, bool isFloat, i32 channels, i32 sampleRate) :
+  mData(data), mBytes(bytes), mFloat(isFloat), mChannels(std::max(channels, 1)), mSampleRate(sampleRate)
 {
-  return mData.mid(begin, end - begin);
+  mFrames = bytes >= 1 && bytes <= 4 ? data.size() / (bytes * mChannels) : 0;
 }
 
-WavDecoder::WavDecoder(QObject *parent) : QObject(parent)
+MonoReader::MonoReader(std::shared_ptr<SamplePager> pager, i64 frames, i32 bytes, bool isFloat, i32 channels, i32 sampleRate) :
+  mPager(pager), mBytes(bytes), mFloat(isFloat), mChannels(std::max(channels, 1)), mSampleRate(sampleRate)
+{
+  mFrames = bytes >= 1 && bytes <= 4 ? frames : 0;
+}
+
+void MonoReader::Read(i64 frame, i32 count, f32 *out) const
+{
+  auto data = reinterpret_cast<const u8*>(mData.constData());
+  i64 origin = 0;
+  QByteArray paged;
+  if(mPager)
+  {
+    paged.resize(std::max(count, 0) * mChannels * mBytes);
+    mPager->Read(frame, std::max(count, 0), paged.data());
+    data = reinterpret_cast<const u8*>(paged.constData());
+    origin = frame;
+  }
+  const f64 scale = 1.0 / mChannels;
+  for(i32 i = 0; i < count; i++, frame++)
+  {
+    if(frame < 0 || frame >= mFrames)
+    {
+      out[i] = 0.0f;
+      continue;
+    }
+    f64 sum = 0;
+    auto s = data + (frame - origin) * mChannels * mBytes;
+    for(i32 c = 0; c < mChannels; c++, s += mBytes)
+      sum += DecodeSample(s, mBytes, mFloat);
+    out[i] = sum * scale;
+  }
+}
+
+WavDecoder::WavDecoder(QObject *parent) : QObject(parent), mFrames(0), mCompact(false), mWindowFrames(0),
+  mRmsOut(nullptr), mPeakOut(nullptr)
 {
 
 }
@@ -279,13 +606,20 @@ bool WavDecoder::findFormatChunk(QDataStream &reader)
 
         if (wf.isCorrect())
         {
-            if      (wf.bitsPerSample == 8)  fmt.sampleType = WavFormat::Int8;
-            else if (wf.bitsPerSample == 32) fmt.sampleType = WavFormat::Float32;
+            // Integer PCM or IEEE float, nothing compressed
+            const quint16 code = wf.audioFormat == 0xFFFE ? wf.subFormat : wf.audioFormat;
+            if (!(code == 1 || (code == 3 && wf.bitsPerSample == 32)))
+                break;
+
+            if      (code == 3)              fmt.sampleType = WavFormat::Float32;
+            else if (wf.bitsPerSample == 8)  fmt.sampleType = WavFormat::Int8;
+            else if (wf.bitsPerSample == 32) fmt.sampleType = WavFormat::Int32;
             else                             fmt.sampleType = WavFormat::Int16;
 
             fmt.sampleSize   = wf.bitsPerSample;
             fmt.channelCount = wf.numChannels  ;
             fmt.sampleRate   = wf.sampleRate   ;
+            fmt.bytesPerFrame = fmt.sampleSize / 8 * fmt.channelCount;
 
             result = true;
             break;
@@ -315,8 +649,10 @@ bool WavDecoder::findDataChunk(QDataStream &reader)
 
         if (wd.isCorrect())
         {
+            // RF64 puts the real size in ds64
+            const quint64 size = wd.dataSize == 0xFFFFFFFFu && _ds64_data_size ? _ds64_data_size : wd.dataSize;
             _data_chunk_location = dev->pos();
-            _data_chunk_length   = wd.dataSize / (fmt.sampleSize / 8 * fmt.channelCount);
+            _data_chunk_length   = size / (fmt.sampleSize / 8 * fmt.channelCount);
 
             result = true;
             break;
@@ -5,8 +5,16 @@
 
 #include <QIODevice>
 #include <QBuffer>
+#include <QHash>
+#include <QMutex>
 #include <QPair>
+#include <functional>
+#include <list>
+#include <memory>
+#include <string.h>
 #include <rint.h>
+#include <envelope.h>
+#include <peaks.h>
 
 struct WavFormat
 {
@@ -18,10 +26,81 @@ struct WavFormat
         LittleEndian, BigEndian
     } byteOrder;
     enum _TSampleType{
-        Int8, Int16, Float32
+        Int8, Int16, Int32, Float32
     } sampleType;
 };
 
+/// One little endian PCM sample of 1 to 4 bytes, or a 4 byte float, scaled to [-1, 1]
+inline f64 DecodeSample(const u8 *s, i32 bytes, bool isFloat)
+{
+  switch(bytes)
+  {
+    case 1: return (s[0] - 128) / 128.0; // 8 bit WAV is unsigned
+    case 2: return (i16)(s[0] | s[1] << 8) / 32768.0;
+    case 3: return (i32)((u32)s[0] << 8 | (u32)s[1] << 16 | (u32)s[2] << 24) / 2147483648.0;
+    default:
+    {
+      if(!isFloat)
+        return (i32)((u32)s[0] | (u32)s[1] << 8 | (u32)s[2] << 16 | (u32)s[3] << 24) / 2147483648.0;
+      f32 f;
+      memcpy(&f, s, 4);
+      return f;
+    }
+  }
+}
+
+/// Blocks of interleaved PCM loaded on demand, the least recently used dropped past MaxBlocks.
+/// Thread-safe, loads run outside the lock.
+class SamplePager
+{
+  public:
+    typedef std::function<QByteArray(i64 frame, i64 count)> Loader; ///< Called on any thread
+
+    static constexpr i32
+      BlockFrames = 1 << 15,
+      MaxBlocks = 32;
+
+    SamplePager(Loader load, i32 frameBytes, i64 frames, char silence);
+
+    void Read(i64 frame, i64 count, char *out); ///< Silence outside the audio
+    i64 ResidentBytes() const;
+
+  private:
+    QByteArray Block(i64 index);
+
+    Loader mLoad;
+    const i32 mFrameBytes;
+    const i64 mFrames;
+    const char mSilence;
+
+    mutable QMutex mLock;
+    std::list<i64> mOrder; ///< Most recently used first
+    QHash<i64, QPair<QByteArray, std::list<i64>::iterator>> mBlocks;
+};
+
+/// The audio mixed down to mono, from the cache or through the pager. Keeps its own reference
+/// to either, so it can be read on any thread while the decoder loads something else.
+class MonoReader
+{
+  public:
+    MonoReader() : mBytes(0), mFloat(false), mChannels(1), mSampleRate(0), mFrames(0) { }
+    MonoReader(const QByteArray &data, i32 bytes, bool isFloat, i32 channels, i32 sampleRate);
+    MonoReader(std::shared_ptr<SamplePager> pager, i64 frames, i32 bytes, bool isFloat, i32 channels, i32 sampleRate);
+
+    bool isEmpty() const { return mFrames == 0; }
+    i64 Frames() const { return mFrames; }
+    i32 SampleRate() const { return mSampleRate; }
+    void Read(i64 frame, i32 count, f32 *out) const; ///< Zeros outside the audio
+
+  private:
+    QByteArray mData;
+    std::shared_ptr<SamplePager> mPager;
+    i32 mBytes;
+    bool mFloat;
+    i32 mChannels, mSampleRate;
+    i64 mFrames;
+};
+
 union uichar {
     char    c[4];
     quint32 i;
@@ -35,19 +114,41 @@ public:
 
     WavDecoder(QObject *parent);
 
+    /// WavDecoder or FlacDecoder, by the first bytes of the device. Nothing is read yet.
+    static WavDecoder *ForDevice(QIODevice *dev, QObject *parent);
+
+    /// Keep only the peaks and the envelope, and page the samples in from the file when they are
+    /// asked for. Set before cacheAll(), only files can be paged.
+    void SetCompact(bool compact) { mCompact = compact; }
+    bool IsCompact() const { return (bool)mPager; }
+
     // should read all contents of file/socket and decode it to PCM in buf
     virtual bool cacheAll(QIODevice *);
 
-    QPair<f32, f32> GetWaveformPeaksForRange(i32 begin, i32 end);
+    /// Interleaved PCM of frames [frame, frame + count) in the cache format, silence outside
+    QByteArray ReadFrames(i64 frame, i64 count) const;
 
-    i32 SampleRate() { return fmt.sampleRate; }
-    i32 GetLengthMs() { return mData.size() / (fmt.sampleSize / 8) * 1000 / fmt.sampleRate; }
+    /// Highest and lowest sample of all channels in frames [begin, end)
+    QPair<f32, f32> GetWaveformPeaksForRange(i64 begin, i64 end);
 
-    void clear() { mData.clear(); }
+    const WavFormat &Format() const { return fmt; }
+    i32 SampleRate() const { return fmt.sampleRate; }
+    i64 Frames() const { return mFrames; }
+    i32 GetLengthMs() { return fmt.sampleRate > 0 ? mFrames * 1000 / fmt.sampleRate : 0; }
+
+    void clear();
     i32 size() { return mData.size(); }
 
     QByteArray GetSamples(i32 begin, i32 end);
 
+    /// Built along with the cache, in parallel over chunks of the data
+    const Envelope &GetEnvelope() const { return mEnvelope; }
+    MonoReader Reader() const;
+    void SetSilenceParams(const SilenceParams &params) { mEnvelope.Reindex(params); }
+
+    /// Memory taken by the audio, paged blocks included
+    virtual i64 ResidentBytes() const;
+
 
 protected:
     WavFormat fmt; // format of that raw PCM data
@@ -55,12 +156,45 @@ protected:
     bool findFormatChunk(QDataStream &reader);
     bool findDataChunk(QDataStream &reader);
 
-    QByteArray mData;
+    QByteArray mData; ///< Empty once compact
+    i64 mFrames;
+    Envelope mEnvelope;
+    PeakPyramid mPeaks;
+    bool mCompact;
+    std::shared_ptr<SamplePager> mPager;
+
+    // The envelope and the peaks are built from any number of ranges of the audio, in any order
+    // and on any thread. Windows and buckets cut by a range are put together at the end.
+    void BeginIngest(i64 frames);
+    void Ingest(const char *pcm, i64 first, i64 frames);
+    void IngestParallel(const char *pcm, i64 first, i64 frames); ///< Spread over the thread pool
+    void EndIngest();
+
+    void SetPager(SamplePager::Loader load);
+    char Silence() const { return fmt.sampleSize == 8 ? '\x80' : '\0'; } ///< 8 bit WAV is unsigned
 
 protected:
     QIODevice *dev;
     quint64 _data_chunk_location;  // bytes
-    int     _data_chunk_length;    // in frames
+    qint64  _data_chunk_length;    // in frames
+    quint64 _ds64_data_size;       // bytes, RF64 only, where the data chunk says 0xFFFFFFFF
+
+private:
+    struct Partial
+    {
+      f64 sum;
+      i64 count;
+      f32 min, max;
+    };
+
+    Partial Measure(const u8 *pcm, i64 frames) const;
+
+    i64 mWindowFrames; ///< 0 unless ingesting
+    QVector<f32> mRms;
+    f32 *mRmsOut;
+    Peak *mPeakOut;
+    QMutex mPartialLock;
+    QHash<i64, Partial> mPartialWindows, mPartialBuckets;
 
 };
 
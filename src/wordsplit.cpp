@@ -0,0 +1,280 @@
+#include <wordsplit.h>
+#include <QTextBoundaryFinder>
+#include <QtConcurrent>
+#include <algorithm>
+
+namespace
+{
+  static constexpr i32 ChunkDialogs = 512;
+
+  u32 CodePointAt(const QString &s, i32 i)
+  {
+    if(s[i].isHighSurrogate() && i + 1 < s.size() && s[i + 1].isLowSurrogate())
+      return QChar::surrogateToUcs4(s[i], s[i + 1]);
+    return s[i].unicode();
+  }
+
+  u32 CodePointBefore(const QString &s, i32 i)
+  {
+    if(s[i - 1].isLowSurrogate() && i >= 2 && s[i - 2].isHighSurrogate())
+      return QChar::surrogateToUcs4(s[i - 2], s[i - 1]);
+    return s[i - 1].unicode();
+  }
+
+  // Scripts the dictionary is asked about
+  bool ForDictionary(u32 ucs4)
+  {
+    switch(QChar::script(ucs4))
+    {
+      case QChar::Script_Han:
+      case QChar::Script_Hiragana:
+      case QChar::Script_Katakana:
+        return true;
+      default:
+        return ucs4 == 0x30FC; // Prolonged sound mark, common to both kana
+    }
+  }
+
+  // Scripts written without spaces between words
+  bool Spaceless(u32 ucs4)
+  {
+    switch(QChar::script(ucs4))
+    {
+      case QChar::Script_Thai:
+      case QChar::Script_Lao:
+      case QChar::Script_Khmer:
+      case QChar::Script_Myanmar:
+        return true;
+      default:
+        return ForDictionary(ucs4) || (ucs4 >= 0x3000 && ucs4 <= 0x303F); // CJK punctuation
+    }
+  }
+
+  // Closing punctuation goes with the word before, opening with the one after
+  bool NoBreakBefore(u32 ucs4)
+  {
+    auto c = QChar::category(ucs4);
+    return c == QChar::Punctuation_Close || c == QChar::Punctuation_FinalQuote || c == QChar::Punctuation_Other;
+  }
+
+  bool NoBreakAfter(u32 ucs4)
+  {
+    auto c = QChar::category(ucs4);
+    return c == QChar::Punctuation_Open || c == QChar::Punctuation_InitialQuote;
+  }
+
+  // Where dialog[from, to), which has no delimiters, is cut into words
+  void Breaks(const QString &dialog, i32 from, i32 to, const DictionarySegmenter *dict, QVector<i32> &out)
+  {
+    out.clear();
+    // Scripts that use spaces never get this far
+    auto s = dialog.constData();
+    if(std::none_of(s + from, s + to, [](QChar c) { return c.unicode() >= 0x0E00; }))
+      return;
+
+    QTextBoundaryFinder words(QTextBoundaryFinder::Word, s + from, to - from);
+    for(i32 p = words.toNextBoundary(); p > 0 && p < to - from; p = words.toNextBoundary())
+    {
+      const i32 at = from + p;
+      const u32 before = CodePointBefore(dialog, at), after = CodePointAt(dialog, at);
+      // Within a run of Han and kana the dictionary knows better
+      if(dict && ForDictionary(before) && ForDictionary(after))
+        continue;
+      if(Spaceless(before) || Spaceless(after))
+        out.append(at);
+    }
+
+    if(dict)
+    {
+      const i32 found = out.size();
+      for(i32 i = from; i < to;)
+      {
+        if(!ForDictionary(CodePointAt(dialog, i)))
+        {
+          i++;
+          continue;
+        }
+        i32 end = i;
+        while(end < to && ForDictionary(CodePointAt(dialog, end)))
+          end += QChar::requiresSurrogates(CodePointAt(dialog, end)) ? 2 : 1;
+        dict->Segment(dialog, i, end, out);
+        i = end;
+      }
+      if(out.size() > found)
+      {
+        // Never inside a grapheme, whatever the dictionary says
+        QTextBoundaryFinder graphemes(QTextBoundaryFinder::Grapheme, s + from, to - from);
+        auto cut = std::remove_if(out.begin() + found, out.end(), [&](i32 at) -> bool
+        {
+          if(at <= from || at >= to)
+            return true;
+          graphemes.setPosition(at - from);
+          return !graphemes.isAtBoundary();
+        });
+        out.erase(cut, out.end());
+        std::sort(out.begin(), out.end());
+      }
+    }
+
+    auto cut = std::remove_if(out.begin(), out.end(), [&](i32 at)
+    {
+      return NoBreakBefore(CodePointAt(dialog, at)) || NoBreakAfter(CodePointBefore(dialog, at));
+    });
+    out.erase(cut, out.end());
+  }
+}
+
+WordListSegmenter::WordListSegmenter(const QStringList &words) : mLongest(0)
+{
+  for(auto &i : words)
+  {
+    auto word = i.trimmed();
+    if(word.isEmpty())
+      continue;
+    mWords.insert(word);
+    mLongest = std::max(mLongest, word.size());
+  }
+}
+
+void WordListSegmenter::Segment(const QString &text, i32 begin, i32 end, QVector<i32> &breaks) const
+{
+  for(i32 i = begin; i < end;)
+  {
+    i32 len = std::min(mLongest, end - i);
+    while(len > 1 && !mWords.contains(QString::fromRawData(text.constData() + i, len)))
+      len--;
+    if(len <= 1)
+      len = QChar::requiresSurrogates(CodePointAt(text, i)) ? 2 : 1;
+    i += len;
+    if(i < end)
+      breaks.append(i);
+  }
+}
+
+QVector<DiscreteWord> SplitDialog(const QString &dialog, const TextMeasurer &measurer,
+                                  const DictionarySegmenter *dict)
+{
+  QVector<DiscreteWord> ret;
+  QVector<i32> breaks;
+
+  // A stretch between delimiters, the last of its words takes the delimiter
+  auto add = [&](i32 from, i32 to, QChar delim)
+  {
+    Breaks(dialog, from, to, dict, breaks);
+    breaks.append(to);
+    for(auto at : breaks)
+    {
+      auto newstr = dialog.mid(from, at - from);
+      ret.append(DiscreteWord {
+                   .text = newstr,
+                   .delim = at == to ? delim : QChar('\0'),
+                   ._cachedBlockWidthPx = measurer.WordWidth(newstr)
+                 });
+      from = at;
+    }
+  };
+
+  i32 last = 0;
+  for(i32 i = 0; i < dialog.size(); i++)
+  {
+    auto c = dialog[i];
+    if(c == ' ' || c == '\n' || c == '\t')
+    {
+      add(last, i, c);
+      last = i + 1;
+    }
+  }
+  // The rest after the last delimiter, even if that is nothing
+  if(dialog.size())
+    add(last, dialog.size(), '\0');
+  return ret;
+}
+
+void MeasureWords(QVector<DiscreteWord> &words, const TextMeasurer &measurer)
+{
+  for(auto &i : words)
+    i._cachedBlockWidthPx = measurer.WordWidth(i.text);
+}
+
+QChar JoinDelim(const QString &left, const QString &right)
+{
+  if((left.size() && Spaceless(CodePointBefore(left, left.size()))) ||
+     (right.size() && Spaceless(CodePointAt(right, 0))))
+    return '\0';
+  return ' ';
+}
+
+WordSplitter::WordSplitter(const TextMeasurer &measurer) : mMeasurer(measurer)
+{
+
+}
+
+void WordSplitter::SetDictionary(std::shared_ptr<const DictionarySegmenter> dict)
+{
+  mDict = dict;
+  mCache.clear();
+}
+
+QVector<DiscreteWord> WordSplitter::Split(const QString &dialog) const
+{
+  auto it = mCache.constFind(dialog);
+  if(it != mCache.constEnd())
+    return *it;
+  auto ret = SplitDialog(dialog, mMeasurer, mDict.get());
+  if(mCache.size() >= MaxCached)
+    mCache.clear();
+  mCache.insert(dialog, ret);
+  return ret;
+}
+
+QVector<QVector<DiscreteWord>> WordSplitter::SplitAll(const QStringList &dialogs) const
+{
+  QVector<QVector<DiscreteWord>> ret(dialogs.size());
+  QVector<i32> missing;
+  for(i32 i = 0; i < dialogs.size(); i++)
+  {
+    auto it = mCache.constFind(dialogs[i]);
+    if(it != mCache.constEnd())
+      ret[i] = *it;
+    else
+      missing.append(i);
+  }
+
+  // Segmenting goes to the pool, the measurer stays on this thread
+  auto out = ret.data();
+  auto dict = mDict.get();
+  auto segment = [&dialogs, out, dict](i32 i)
+  {
+    NoMeasurer unmeasured;
+    out[i] = SplitDialog(dialogs[i], unmeasured, dict);
+  };
+  if(missing.size() <= ChunkDialogs)
+    std::for_each(missing.begin(), missing.end(), segment);
+  else
+  {
+    QVector<i32> chunks;
+    for(i32 i = 0; i < missing.size(); i += ChunkDialogs)
+      chunks.append(i);
+    const i32 *index = missing.constData(), count = missing.size();
+    QtConcurrent::blockingMap(chunks, [index, count, &segment](i32 &from)
+    {
+      std::for_each(index + from, index + std::min(from + ChunkDialogs, count), segment);
+    });
+  }
+
+  for(auto i : missing)
+  {
+    // The same text may be missing more than once
+    auto it = mCache.constFind(dialogs[i]);
+    if(it != mCache.constEnd())
+    {
+      out[i] = *it;
+      continue;
+    }
+    MeasureWords(out[i], mMeasurer);
+    if(mCache.size() >= MaxCached)
+      mCache.clear();
+    mCache.insert(dialogs[i], out[i]);
+  }
+  return ret;
+}
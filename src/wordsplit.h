@@ -0,0 +1,72 @@
+#pragma once
+
+#include <QHash>
+#include <QSet>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <memory>
+#include <dialog.h>
+#include <textmeasurer.h>
+
+/// Breaks runs of Chinese and Japanese into words, where Unicode word boundaries only give
+/// single ideographs. Implementations must be safe to call from several threads at once.
+class DictionarySegmenter
+{
+  public:
+    virtual ~DictionarySegmenter() { }
+    /// Append where text[begin, end) breaks into words, ascending and strictly inside it
+    virtual void Segment(const QString &text, i32 begin, i32 end, QVector<i32> &breaks) const = 0;
+};
+
+/// Longest match from the left against a list of words, anything not in it stands alone
+class WordListSegmenter : public DictionarySegmenter
+{
+  public:
+    explicit WordListSegmenter(const QStringList &words);
+    void Segment(const QString &text, i32 begin, i32 end, QVector<i32> &breaks) const override;
+    i32 size() const { return mWords.size(); }
+
+  private:
+    QSet<QString> mWords;
+    i32 mLongest;
+};
+
+/// Cut a dialog into words. Each word keeps the space, newline or tab that followed it.
+///
+/// Text without spaces, such as Chinese, Japanese or Thai, is cut further at Unicode word
+/// boundaries, or where dict says for Han and kana. Those words have no delimiter. Punctuation
+/// stays with the word it belongs to and nothing is cut inside a grapheme.
+QVector<DiscreteWord> SplitDialog(const QString &dialog, const TextMeasurer &measurer,
+                                  const DictionarySegmenter *dict = nullptr);
+
+/// Fill in the widths of words split with NoMeasurer
+void MeasureWords(QVector<DiscreteWord> &words, const TextMeasurer &measurer);
+
+/// What goes between two words that end up next to each other: nothing if either side is
+/// written without spaces, a space otherwise
+QChar JoinDelim(const QString &left, const QString &right);
+
+/// SplitDialog() with one measurer and dictionary, remembering the words of the dialogs it has
+/// split, so repeated and reopened cues are neither segmented nor measured again.
+/// Use it on the thread the measurer belongs to, only segmenting goes to other threads.
+class WordSplitter
+{
+  public:
+    static constexpr i32 MaxCached = 1 << 16; ///< Dialogs, all are forgotten past that
+
+    explicit WordSplitter(const TextMeasurer &measurer);
+
+    const TextMeasurer &Measurer() const { return mMeasurer; }
+    const DictionarySegmenter *Dictionary() const { return mDict.get(); }
+    void SetDictionary(std::shared_ptr<const DictionarySegmenter> dict); ///< Not while splitting
+
+    QVector<DiscreteWord> Split(const QString &dialog) const;
+    /// Every one of them, segmented on the global thread pool when there are many
+    QVector<QVector<DiscreteWord>> SplitAll(const QStringList &dialogs) const;
+
+  private:
+    const TextMeasurer &mMeasurer;
+    std::shared_ptr<const DictionarySegmenter> mDict;
+    mutable QHash<QString, QVector<DiscreteWord>> mCache;
+};